@@ -0,0 +1,142 @@
+"""
+Accelerometer Capture for the ArduinoAccel sketch
+
+The ArduinoAccel sketch streams an ADXL345 accelerometer at up to 3200 Hz as binary packets
+(the packet layout is described in ArduinoAccel/include/AccelPacket.h). This script records
+those packets for a fixed time and saves them as a CSV file with the same columns as the
+phone's "Raw Data.csv", so the Lab 1 notebook works with either source.
+
+Usage:
+1. Upload the ArduinoAccel sketch to your Arduino
+2. Set PORT, DURATION_S and OUTPUT_FILE below (PORT = None picks the first USB serial port)
+3. Run this file by pushing the triangular play button in the top right of the file
+
+The sample times come from the sensor's own clock (sample index / data rate), which is far
+more regular than the Arduino's timestamps. The index only counts the samples that were
+delivered, so when the sensor's FIFO overflows (the packet after it is flagged) the samples
+it lost are missing from the count. From that packet on the times are taken again from the
+Arduino's micros() in the packet, so the time column jumps over the hole instead of running
+early. Packets that were damaged on the way are skipped and reported at the end, as is the
+time lost to overflows.
+"""
+
+import csv
+import math
+import struct
+import time
+
+import serial
+import serial.tools.list_ports
+
+PORT = None               # e.g. "COM5" or "/dev/ttyACM0", None = pick automatically
+BAUD_RATE = 1000000       # Must match BAUD_RATE in the sketch
+SAMPLE_RATE_HZ = 3200     # Must match RATE_CODE in the sketch
+DURATION_S = 10           # How long to record
+OUTPUT_FILE = "Raw Data.csv"
+
+G = 9.80665               # m/s^2 per g
+G_PER_COUNT = 0.0039      # ADXL345 full resolution scale factor
+
+SYNC = b"\xa5\x5a"
+HEADER = struct.Struct("<BBBII")   # sequence, count, flags, first index, micros
+HEADER_BYTES = 2 + HEADER.size
+SAMPLE = struct.Struct("<hhh")
+FLAG_OVERRUN = 0x01
+
+
+def find_port():
+    """Return the first port that looks like a USB serial adapter"""
+    for port in serial.tools.list_ports.comports():
+        text = f"{port.device} {port.description}".lower()
+        if "usb" in text or "serial" in text or "ch340" in text or "acm" in text:
+            return port.device
+    raise RuntimeError("No Arduino serial port found, set PORT by hand")
+
+
+def decode_packets(buffer):
+    """Decode every complete packet in buffer.
+
+    Returns (packets, leftover bytes, number of damaged packets). Each packet is a tuple
+    (sequence, flags, first_index, micros, [(x, y, z), ...]) with raw sensor counts.
+    """
+    packets = []
+    damaged = 0
+    i = 0
+    while True:
+        i = buffer.find(SYNC, i)
+        if i < 0 or len(buffer) - i < HEADER_BYTES:
+            break
+        sequence, count, flags, first_index, micros = HEADER.unpack_from(buffer, i + 2)
+        length = HEADER_BYTES + count * SAMPLE.size + 1
+        if count > 33:
+            i += 1
+            continue
+        if len(buffer) - i < length:
+            break
+        if sum(buffer[i + 2:i + length]) & 0xFF != 0:
+            damaged += 1
+            i += 1
+            continue
+        samples = [SAMPLE.unpack_from(buffer, i + HEADER_BYTES + k * SAMPLE.size) for k in range(count)]
+        packets.append((sequence, flags, first_index, micros, samples))
+        i += length
+    keep = buffer[i:] if i >= 0 else buffer[-1:]
+    return packets, bytearray(keep), damaged
+
+
+def main():
+    port = PORT or find_port()
+    print(f"Recording {DURATION_S} s from {port} at {BAUD_RATE} baud...")
+
+    rows = []
+    damaged = 0
+    overruns = 0
+    lost_s = 0.0
+    offset = None      # s from the index time (index / rate) to the Arduino's clock
+    elapsed_us = 0     # Arduino's micros() since the first packet, past the 32 bit wrap
+    last_micros = None
+    buffer = bytearray()
+    with serial.Serial(port, BAUD_RATE, timeout=0.1) as ser:
+        ser.reset_input_buffer()
+        end = time.monotonic() + DURATION_S
+        while time.monotonic() < end:
+            buffer += ser.read(max(1, ser.in_waiting))
+            packets, buffer, bad = decode_packets(buffer)
+            damaged += bad
+            for sequence, flags, first_index, micros, samples in packets:
+                if last_micros is not None:
+                    elapsed_us += (micros - last_micros) & 0xFFFFFFFF
+                last_micros = micros
+                # The newest sample of the burst was taken just before the Arduino read it
+                anchor = elapsed_us / 1e6 - (first_index + len(samples) - 1) / SAMPLE_RATE_HZ
+                if offset is None:
+                    offset = anchor
+                if flags & FLAG_OVERRUN:
+                    overruns += 1
+                    # Samples were lost before this packet: move the time on by what went missing
+                    if anchor > offset:
+                        lost_s += anchor - offset
+                        offset = anchor
+                for k, (x, y, z) in enumerate(samples):
+                    t = (first_index + k) / SAMPLE_RATE_HZ + offset
+                    ax, ay, az = (v * G_PER_COUNT * G for v in (x, y, z))
+                    rows.append((t, ax, ay, az, math.sqrt(ax * ax + ay * ay + az * az)))
+
+    if rows:
+        t0 = rows[0][0]
+        rows = [(row[0] - t0,) + row[1:] for row in rows]
+
+    with open(OUTPUT_FILE, "w", newline="") as f:
+        writer = csv.writer(f, quoting=csv.QUOTE_NONNUMERIC)
+        writer.writerow(["Time (s)", "Acceleration x (m/s^2)", "Acceleration y (m/s^2)",
+                         "Acceleration z (m/s^2)", "Absolute acceleration (m/s^2)"])
+        writer.writerows(rows)
+
+    print(f"Saved {len(rows)} samples to {OUTPUT_FILE}")
+    if damaged or overruns:
+        print(f"Warning: {damaged} damaged packets skipped, sensor FIFO overflowed {overruns} times"
+              f" (about {lost_s * 1000:.1f} ms of samples lost)")
+
+
+if __name__ == "__main__":
+    main()
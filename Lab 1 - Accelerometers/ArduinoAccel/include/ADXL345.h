@@ -0,0 +1,172 @@
+/*
+ * ADXL345 FIFO Driver
+ *
+ * A small driver for the ADXL345 3-axis MEMS accelerometer that keeps the sensor in
+ * stream mode and empties its 32 sample FIFO in bursts. The sensor does the sampling
+ * with its own clock, so we get a perfectly even sample rate (up to 3200 Hz) no matter
+ * how busy the Arduino is, as long as we empty the FIFO before it fills up.
+ *
+ * The driver does not talk to the SPI hardware directly. Instead it uses a "bus" object
+ * that must provide these three functions:
+ *
+ *   void writeRegister(uint8_t reg, uint8_t value);
+ *   void readRegisters(uint8_t reg, uint8_t *dest, uint8_t count); // multi-byte read
+ *   void waitMicros(uint16_t us);
+ *
+ * On the Arduino the bus is the SPI port (see main.cpp). On your computer the bus is
+ * the ADXL345Sim register model (see ADXL345Sim.h), which lets us test the driver and
+ * its throughput without any hardware.
+ *
+ * Register names and bit meanings follow the ADXL345 data sheet (Rev. G).
+ */
+
+#ifndef ADXL345_H
+#define ADXL345_H
+
+#include <stdint.h>
+
+namespace adxl345 {
+
+// Register map (only the registers this driver and the simulator use)
+const uint8_t REG_DEVID       = 0x00;
+const uint8_t REG_BW_RATE     = 0x2C;
+const uint8_t REG_POWER_CTL   = 0x2D;
+const uint8_t REG_INT_ENABLE  = 0x2E;
+const uint8_t REG_INT_MAP     = 0x2F;
+const uint8_t REG_INT_SOURCE  = 0x30;
+const uint8_t REG_DATA_FORMAT = 0x31;
+const uint8_t REG_DATAX0      = 0x32; // DATAX0 through DATAZ1 are 0x32 - 0x37
+const uint8_t REG_FIFO_CTL    = 0x38;
+const uint8_t REG_FIFO_STATUS = 0x39;
+
+const uint8_t DEVID_VALUE = 0xE5;
+
+// POWER_CTL bits
+const uint8_t POWER_MEASURE = 0x08;
+
+// INT_ENABLE / INT_MAP / INT_SOURCE bits
+const uint8_t INT_DATA_READY = 0x80;
+const uint8_t INT_WATERMARK  = 0x02;
+const uint8_t INT_OVERRUN    = 0x01;
+
+// DATA_FORMAT bits
+const uint8_t FORMAT_INT_INVERT = 0x20;
+const uint8_t FORMAT_FULL_RES   = 0x08;
+const uint8_t FORMAT_RANGE_16G  = 0x03;
+
+// FIFO_CTL modes (bits 7:6), the watermark goes in bits 4:0
+const uint8_t FIFO_BYPASS = 0x00;
+const uint8_t FIFO_FIFO   = 0x40;
+const uint8_t FIFO_STREAM = 0x80;
+const uint8_t FIFO_MODE_MASK = 0xC0;
+const uint8_t FIFO_SAMPLES_MASK = 0x1F;
+const uint8_t FIFO_ENTRIES_MASK = 0x3F;
+
+const uint8_t FIFO_DEPTH = 32;
+
+// BW_RATE codes for the output data rates we care about (normal power mode)
+const uint8_t RATE_3200_HZ = 0x0F;
+const uint8_t RATE_1600_HZ = 0x0E;
+const uint8_t RATE_800_HZ  = 0x0D;
+const uint8_t RATE_400_HZ  = 0x0C;
+const uint8_t RATE_200_HZ  = 0x0B;
+const uint8_t RATE_100_HZ  = 0x0A;
+
+// Output data rate in Hz for a BW_RATE code (codes 6 - 15, 6.25 Hz is rounded down)
+inline uint16_t rateHz(uint8_t code) {
+  return (uint16_t)(3200UL >> (15 - (code & 0x0F)));
+}
+
+// Sample period in nanoseconds for a BW_RATE code
+inline uint32_t ratePeriodNs(uint8_t code) {
+  return 312500UL << (15 - (code & 0x0F));
+}
+
+// In full resolution mode every range uses the same scale factor
+const float G_PER_LSB = 0.0039f;
+
+// The sensor needs 5 us between the end of one data register read and the start of
+// the next one, otherwise the next FIFO entry has not been moved into the registers yet.
+const uint16_t FIFO_POP_DELAY_US = 5;
+
+struct Sample {
+  int16_t x;
+  int16_t y;
+  int16_t z;
+};
+
+template <class Bus>
+class Driver {
+public:
+  explicit Driver(Bus &bus) : bus_(bus), overrun_(false) {}
+
+  // Configure the sensor for stream mode with a watermark interrupt on INT1.
+  // Returns false if the sensor does not answer with the right device ID.
+  bool begin(uint8_t rateCode, uint8_t watermark) {
+    uint8_t id = 0;
+    bus_.readRegisters(REG_DEVID, &id, 1);
+    if (id != DEVID_VALUE) {
+      return false;
+    }
+
+    if (watermark < 1) watermark = 1;
+    if (watermark > FIFO_DEPTH - 1) watermark = FIFO_DEPTH - 1;
+
+    bus_.writeRegister(REG_POWER_CTL, 0);                         // standby while we configure
+    bus_.writeRegister(REG_BW_RATE, rateCode & 0x0F);
+    bus_.writeRegister(REG_DATA_FORMAT, FORMAT_FULL_RES | FORMAT_RANGE_16G); // INT pins active high
+    bus_.writeRegister(REG_FIFO_CTL, FIFO_BYPASS);                // clears any old FIFO contents
+    bus_.writeRegister(REG_FIFO_CTL, FIFO_STREAM | watermark);
+    bus_.writeRegister(REG_INT_MAP, 0);                           // everything on INT1
+    bus_.writeRegister(REG_INT_ENABLE, INT_WATERMARK | INT_OVERRUN);
+    bus_.writeRegister(REG_POWER_CTL, POWER_MEASURE);             // start sampling
+    return true;
+  }
+
+  // Number of samples waiting in the FIFO
+  uint8_t entries() {
+    uint8_t status = 0;
+    bus_.readRegisters(REG_FIFO_STATUS, &status, 1);
+    return status & FIFO_ENTRIES_MASK;
+  }
+
+  // Empties the FIFO into out[] (at most maxCount samples) and returns how many were read.
+  // Each sample is one 6 byte burst read of DATAX0 - DATAZ1, which pops one FIFO entry.
+  uint8_t drain(Sample *out, uint8_t maxCount) {
+    uint8_t source = 0;
+    bus_.readRegisters(REG_INT_SOURCE, &source, 1);
+    if (source & INT_OVERRUN) {
+      overrun_ = true;
+    }
+
+    uint8_t count = entries();
+    if (count > maxCount) count = maxCount;
+
+    uint8_t raw[6];
+    for (uint8_t i = 0; i < count; i++) {
+      if (i > 0) {
+        bus_.waitMicros(FIFO_POP_DELAY_US);
+      }
+      bus_.readRegisters(REG_DATAX0, raw, 6);
+      out[i].x = (int16_t)((uint16_t)raw[0] | ((uint16_t)raw[1] << 8));
+      out[i].y = (int16_t)((uint16_t)raw[2] | ((uint16_t)raw[3] << 8));
+      out[i].z = (int16_t)((uint16_t)raw[4] | ((uint16_t)raw[5] << 8));
+    }
+    return count;
+  }
+
+  // True if the FIFO overflowed (samples were lost) since the last call
+  bool takeOverrun() {
+    bool flag = overrun_;
+    overrun_ = false;
+    return flag;
+  }
+
+private:
+  Bus &bus_;
+  bool overrun_;
+};
+
+} // namespace adxl345
+
+#endif
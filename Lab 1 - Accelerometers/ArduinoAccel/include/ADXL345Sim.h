@@ -0,0 +1,231 @@
+/*
+ * ADXL345 Register Model
+ *
+ * A software model of the ADXL345 that behaves like the real chip at the register level:
+ * it produces samples at the rate set in BW_RATE, stores them in a 32 entry FIFO
+ * (bypass, FIFO and stream modes), pops one entry for every read of the data registers,
+ * and drives the INT1/INT2 pins from INT_ENABLE, INT_MAP and DATA_FORMAT.
+ *
+ * It is only used on your computer (the "native" environment). The ADXL345 driver
+ * cannot tell the difference between this model and the SPI bus, which lets us check
+ * that the driver never loses a sample and measure how much time it needs.
+ *
+ * Time only moves forward when advance() is called, so a test decides exactly how long
+ * every bus transaction takes.
+ */
+
+#ifndef ADXL345_SIM_H
+#define ADXL345_SIM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "ADXL345.h"
+
+class ADXL345Sim {
+public:
+  // The model can produce either a counting test pattern (x counts up by one every
+  // sample, which makes lost or repeated samples easy to spot) or a motion you supply.
+  typedef void (*MotionFunction)(double seconds, float g[3]);
+
+  ADXL345Sim() { reset(); }
+
+  void reset() {
+    memset(regs_, 0, sizeof(regs_));
+    regs_[adxl345::REG_DEVID] = adxl345::DEVID_VALUE;
+    regs_[adxl345::REG_BW_RATE] = adxl345::RATE_100_HZ;
+    nowNs_ = 0;
+    nextSampleNs_ = 0;
+    lastPopNs_ = 0;
+    head_ = 0;
+    count_ = 0;
+    sampleIndex_ = 0;
+    motion_ = 0;
+    produced = 0;
+    dropped = 0;
+    popTooSoon = 0;
+    maxEntries = 0;
+  }
+
+  void setMotion(MotionFunction motion) { motion_ = motion; }
+
+  // ----- Bus interface, same functions the driver expects from the SPI bus -----
+
+  void writeRegister(uint8_t reg, uint8_t value) {
+    if (reg == adxl345::REG_INT_SOURCE || reg == adxl345::REG_FIFO_STATUS ||
+        reg == adxl345::REG_DEVID || (reg >= adxl345::REG_DATAX0 && reg < adxl345::REG_DATAX0 + 6)) {
+      return; // read-only
+    }
+    if (reg == adxl345::REG_POWER_CTL && (value & adxl345::POWER_MEASURE) &&
+        !(regs_[reg] & adxl345::POWER_MEASURE)) {
+      nextSampleNs_ = nowNs_ + adxl345::ratePeriodNs(regs_[adxl345::REG_BW_RATE]);
+    }
+    if (reg == adxl345::REG_FIFO_CTL && (value & adxl345::FIFO_MODE_MASK) == adxl345::FIFO_BYPASS) {
+      count_ = 0; // entering bypass mode clears the FIFO
+    }
+    regs_[reg] = value;
+    updateInterrupts();
+  }
+
+  void readRegisters(uint8_t reg, uint8_t *dest, uint8_t count) {
+    bool dataRead = false;
+    for (uint8_t i = 0; i < count; i++) {
+      uint8_t r = (uint8_t)(reg + i);
+      if (r >= adxl345::REG_DATAX0 && r < adxl345::REG_DATAX0 + 6) {
+        if (!dataRead && nowNs_ - lastPopNs_ < adxl345::FIFO_POP_DELAY_US * 1000UL) {
+          popTooSoon++;
+        }
+        dataRead = true;
+      }
+      dest[i] = r < sizeof(regs_) ? regs_[r] : 0;
+    }
+    if (dataRead) {
+      // Reading the data registers clears DATA_READY and OVERRUN and moves the next
+      // FIFO entry into the data registers.
+      regs_[adxl345::REG_INT_SOURCE] &= (uint8_t)~(adxl345::INT_DATA_READY | adxl345::INT_OVERRUN);
+      pop();
+      lastPopNs_ = nowNs_;
+    }
+    updateInterrupts();
+  }
+
+  void waitMicros(uint16_t us) { advance((uint64_t)us * 1000); }
+
+  // ----- Time -----
+
+  void advance(uint64_t ns) {
+    uint64_t end = nowNs_ + ns;
+    while (measuring() && nextSampleNs_ <= end) {
+      nowNs_ = nextSampleNs_;
+      produce();
+      nextSampleNs_ += adxl345::ratePeriodNs(regs_[adxl345::REG_BW_RATE]);
+    }
+    nowNs_ = end;
+  }
+
+  uint64_t nowNs() const { return nowNs_; }
+
+  // ----- Interrupt pins -----
+
+  bool int1() const { return pinLevel(false); }
+  bool int2() const { return pinLevel(true); }
+
+  // Value the test pattern puts in the x axis of sample number n
+  static int16_t patternX(uint32_t n) { return (int16_t)(n & 0x0FFF); }
+
+  // Statistics for the tests
+  uint32_t produced;   // samples the sensor converted
+  uint32_t dropped;    // samples lost because the FIFO was full
+  uint32_t popTooSoon; // data register reads that did not respect the 5 us pop delay
+  uint8_t maxEntries;  // highest FIFO fill level seen
+
+private:
+  bool measuring() const { return regs_[adxl345::REG_POWER_CTL] & adxl345::POWER_MEASURE; }
+
+  uint8_t fifoMode() const { return regs_[adxl345::REG_FIFO_CTL] & adxl345::FIFO_MODE_MASK; }
+
+  void produce() {
+    adxl345::Sample s;
+    if (motion_) {
+      float g[3];
+      motion_((double)nowNs_ * 1e-9, g);
+      s.x = toRaw(g[0]);
+      s.y = toRaw(g[1]);
+      s.z = toRaw(g[2]);
+    } else {
+      s.x = patternX(sampleIndex_);
+      s.y = (int16_t)-s.x;
+      s.z = (int16_t)(sampleIndex_ >> 12);
+    }
+    sampleIndex_++;
+    produced++;
+
+    if (fifoMode() == adxl345::FIFO_BYPASS) {
+      head_ = 0;
+      fifo_[0] = s;
+      if (count_ == 1) {
+        regs_[adxl345::REG_INT_SOURCE] |= adxl345::INT_OVERRUN;
+      }
+      count_ = 1;
+    } else if (count_ < adxl345::FIFO_DEPTH) {
+      fifo_[(head_ + count_) % adxl345::FIFO_DEPTH] = s;
+      count_++;
+    } else if (fifoMode() == adxl345::FIFO_FIFO) {
+      dropped++; // FIFO mode stops collecting when full
+      regs_[adxl345::REG_INT_SOURCE] |= adxl345::INT_OVERRUN;
+    } else {
+      // Stream (and trigger) mode: the oldest sample is overwritten
+      fifo_[head_] = s;
+      head_ = (uint8_t)((head_ + 1) % adxl345::FIFO_DEPTH);
+      dropped++;
+      regs_[adxl345::REG_INT_SOURCE] |= adxl345::INT_OVERRUN;
+    }
+    if (count_ > maxEntries) maxEntries = count_;
+    regs_[adxl345::REG_INT_SOURCE] |= adxl345::INT_DATA_READY;
+    loadDataRegisters();
+    updateInterrupts();
+  }
+
+  void pop() {
+    if (count_ == 0) return;
+    if (fifoMode() != adxl345::FIFO_BYPASS) {
+      head_ = (uint8_t)((head_ + 1) % adxl345::FIFO_DEPTH);
+    }
+    count_--;
+    loadDataRegisters();
+  }
+
+  void loadDataRegisters() {
+    if (count_ == 0) return; // registers keep the last sample
+    const adxl345::Sample &s = fifo_[head_];
+    uint8_t *d = &regs_[adxl345::REG_DATAX0];
+    d[0] = (uint8_t)s.x; d[1] = (uint8_t)((uint16_t)s.x >> 8);
+    d[2] = (uint8_t)s.y; d[3] = (uint8_t)((uint16_t)s.y >> 8);
+    d[4] = (uint8_t)s.z; d[5] = (uint8_t)((uint16_t)s.z >> 8);
+  }
+
+  void updateInterrupts() {
+    uint8_t watermark = regs_[adxl345::REG_FIFO_CTL] & adxl345::FIFO_SAMPLES_MASK;
+    uint8_t &source = regs_[adxl345::REG_INT_SOURCE];
+    if (fifoMode() != adxl345::FIFO_BYPASS && count_ >= watermark && watermark > 0) {
+      source |= adxl345::INT_WATERMARK;
+    } else {
+      source &= (uint8_t)~adxl345::INT_WATERMARK;
+    }
+    if (count_ == 0) {
+      source &= (uint8_t)~adxl345::INT_DATA_READY;
+    }
+    regs_[adxl345::REG_FIFO_STATUS] = count_ & adxl345::FIFO_ENTRIES_MASK;
+  }
+
+  bool pinLevel(bool int2) const {
+    uint8_t active = regs_[adxl345::REG_INT_SOURCE] & regs_[adxl345::REG_INT_ENABLE];
+    uint8_t mapped = int2 ? (active & regs_[adxl345::REG_INT_MAP])
+                          : (active & (uint8_t)~regs_[adxl345::REG_INT_MAP]);
+    bool level = mapped != 0;
+    if (regs_[adxl345::REG_DATA_FORMAT] & adxl345::FORMAT_INT_INVERT) {
+      level = !level; // active low
+    }
+    return level;
+  }
+
+  static int16_t toRaw(float g) {
+    float counts = g / adxl345::G_PER_LSB;
+    if (counts > 4095.0f) counts = 4095.0f;   // 13 bit full resolution at +-16 g
+    if (counts < -4096.0f) counts = -4096.0f;
+    return (int16_t)lroundf(counts);
+  }
+
+  uint8_t regs_[0x3A];
+  adxl345::Sample fifo_[adxl345::FIFO_DEPTH];
+  uint8_t head_;
+  uint8_t count_;
+  uint64_t nowNs_;
+  uint64_t nextSampleNs_;
+  uint64_t lastPopNs_;
+  uint32_t sampleIndex_;
+  MotionFunction motion_;
+};
+
+#endif
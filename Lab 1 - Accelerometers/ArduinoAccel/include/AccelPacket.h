@@ -0,0 +1,75 @@
+/*
+ * Packed Accelerometer Frames
+ *
+ * At 3200 Hz a text line per sample ("12345,-12,4,256\r\n") would need far more than the
+ * serial port can carry, so the accelerometer sketch sends binary packets instead.
+ * Every FIFO burst becomes one packet:
+ *
+ *   byte 0-1   sync bytes 0xA5 0x5A
+ *   byte 2     packet sequence number (counts up, wraps at 255)
+ *   byte 3     number of samples N in this packet
+ *   byte 4     flags (bit 0 = the sensor FIFO overflowed before this packet)
+ *   byte 5-8   index of the first sample since power on (uint32, little endian); samples lost
+ *              in a FIFO overflow aren't counted, the micros() of a flagged packet places it
+ *   byte 9-12  micros() when the burst was read (uint32, little endian)
+ *   then N x 6 bytes: x, y, z as int16 little endian (3.9 mg per count)
+ *   last byte  checksum: all bytes after the sync bytes summed, then negated
+ *
+ * AccelCapture.py in the Lab 1 folder decodes these packets into a CSV file.
+ */
+
+#ifndef ACCEL_PACKET_H
+#define ACCEL_PACKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ADXL345.h"
+
+namespace accel_packet {
+
+const uint8_t SYNC0 = 0xA5;
+const uint8_t SYNC1 = 0x5A;
+const uint8_t FLAG_OVERRUN = 0x01;
+
+const size_t HEADER_BYTES = 13;
+const size_t SAMPLE_BYTES = 6;
+const size_t MAX_SAMPLES = adxl345::FIFO_DEPTH + 1; // FIFO plus the data registers
+
+inline size_t packetBytes(uint8_t count) { return HEADER_BYTES + count * SAMPLE_BYTES + 1; }
+
+inline uint8_t *putU32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+  return p + 4;
+}
+
+// Builds a packet in out[] (which must hold packetBytes(count) bytes) and returns its length.
+inline size_t pack(uint8_t *out, uint8_t seq, uint8_t flags, uint32_t firstIndex, uint32_t micros,
+                   const adxl345::Sample *samples, uint8_t count) {
+  uint8_t *p = out;
+  *p++ = SYNC0;
+  *p++ = SYNC1;
+  *p++ = seq;
+  *p++ = count;
+  *p++ = flags;
+  p = putU32(p, firstIndex);
+  p = putU32(p, micros);
+  for (uint8_t i = 0; i < count; i++) {
+    *p++ = (uint8_t)samples[i].x; *p++ = (uint8_t)((uint16_t)samples[i].x >> 8);
+    *p++ = (uint8_t)samples[i].y; *p++ = (uint8_t)((uint16_t)samples[i].y >> 8);
+    *p++ = (uint8_t)samples[i].z; *p++ = (uint8_t)((uint16_t)samples[i].z >> 8);
+  }
+  uint8_t sum = 0;
+  for (uint8_t *q = out + 2; q < p; q++) {
+    sum = (uint8_t)(sum + *q);
+  }
+  *p++ = (uint8_t)(0 - sum);
+  return (size_t)(p - out);
+}
+
+} // namespace accel_packet
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * Arduino Accelerometer Data Acquisition
+ *
+ * This sketch reads an ADXL345 3-axis accelerometer over SPI at the sensor's full
+ * output data rate (3200 Hz) and streams the data to the computer. It replaces the
+ * phone accelerometer we used in Lab 1 when you need a faster or more regular sample rate.
+ *
+ * The ADXL345 samples on its own clock and stores up to 32 samples in its FIFO. When the
+ * FIFO holds WATERMARK samples it raises its INT1 pin, and we read the whole FIFO in one
+ * burst. The Arduino only has to wake up a few hundred times a second instead of for every
+ * sample, and no sample is ever lost as long as the serial port can keep up.
+ *
+ * The data is sent as binary packets (see include/AccelPacket.h) because text would not
+ * fit through the serial port at 3200 Hz. Use AccelCapture.py in the Lab 1 folder to record
+ * the data into a CSV file with the same columns as the phone's "Raw Data.csv".
+ *
+ * Wiring (ADXL345 breakout to Uno):
+ *   VCC -> 3.3V, GND -> GND
+ *   CS  -> 10, SDA/SDI -> 11 (MOSI), SDO -> 12 (MISO), SCL/SCLK -> 13 (SCK)
+ *   INT1 -> 2  (must be a pin that can handle interrupts!)
+ * Most breakouts have level shifters; if yours does not, you need one for the 5V Uno pins.
+ *
+ * You can test the driver and check the throughput without hardware by running the
+ * "native" environment, which uses a software model of the sensor (include/ADXL345Sim.h).
+ *
+ * Author: Prof. Gordon Hoople
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "ADXL345.h"
+#include "AccelPacket.h"
+
+// Pins
+const uint8_t CS_PIN = 10;
+const uint8_t INT_PIN = 2;  // Must be a pin that can handle interrupts!
+
+// Sensor settings
+const uint8_t RATE_CODE = adxl345::RATE_3200_HZ; // Output data rate, see ADXL345.h for the other rates
+const uint8_t WATERMARK = 16;                    // Read the FIFO when it is half full
+
+// 3200 Hz packed frames need about 22 kB/s, which does not fit in 115200 baud.
+// The Uno runs 1000000 baud with no timing error. Lower RATE_CODE if your computer can't keep up.
+const unsigned long BAUD_RATE = 1000000;
+
+// SPI bus object used by the driver. The ADXL345 uses SPI mode 3 and allows up to 5 MHz.
+class SpiBus {
+public:
+  void begin() {
+    pinMode(CS_PIN, OUTPUT);
+    digitalWrite(CS_PIN, HIGH);
+    SPI.begin();
+  }
+
+  void writeRegister(uint8_t reg, uint8_t value) {
+    SPI.beginTransaction(settings);
+    digitalWrite(CS_PIN, LOW);
+    SPI.transfer(reg & 0x3F);
+    SPI.transfer(value);
+    digitalWrite(CS_PIN, HIGH);
+    SPI.endTransaction();
+  }
+
+  void readRegisters(uint8_t reg, uint8_t *dest, uint8_t count) {
+    uint8_t command = 0x80 | (reg & 0x3F);  // bit 7 = read
+    if (count > 1) {
+      command |= 0x40;                      // bit 6 = multi-byte
+    }
+    SPI.beginTransaction(settings);
+    digitalWrite(CS_PIN, LOW);
+    SPI.transfer(command);
+    for (uint8_t i = 0; i < count; i++) {
+      dest[i] = SPI.transfer(0x00);
+    }
+    digitalWrite(CS_PIN, HIGH);
+    SPI.endTransaction();
+  }
+
+  void waitMicros(uint16_t us) { delayMicroseconds(us); }
+
+private:
+  SPISettings settings = SPISettings(4000000, MSBFIRST, SPI_MODE3);
+};
+
+SpiBus bus;
+adxl345::Driver<SpiBus> accel(bus);
+
+// Interrupt flag
+volatile bool fifoReady = false;
+
+// Interrupt routine: Sets flag when the FIFO reaches the watermark
+void fifoReadyISR() {
+  fifoReady = true;
+}
+
+adxl345::Sample samples[accel_packet::MAX_SAMPLES];
+uint8_t packet[accel_packet::HEADER_BYTES + accel_packet::MAX_SAMPLES * accel_packet::SAMPLE_BYTES + 1];
+uint8_t sequence = 0;
+uint32_t sampleIndex = 0;
+
+void setup() {
+  // Serial Communication Setup
+  Serial.begin(BAUD_RATE);
+
+  bus.begin();
+  pinMode(INT_PIN, INPUT);
+
+  if (!accel.begin(RATE_CODE, WATERMARK)) {
+    // Without a sensor there is nothing to stream. Blink the LED so the problem is visible
+    // even when no serial monitor is open.
+    pinMode(LED_BUILTIN, OUTPUT);
+    while (1) {
+      digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
+      delay(200);
+    }
+  }
+
+  // Attach interrupt for the watermark (INT1 goes HIGH)
+  attachInterrupt(digitalPinToInterrupt(INT_PIN), fifoReadyISR, RISING);
+}
+
+void loop() {
+  // The pin stays high while the FIFO is above the watermark, so checking the level as well
+  // as the flag means a burst can never be missed.
+  if (!fifoReady && digitalRead(INT_PIN) == LOW) {
+    return;
+  }
+  fifoReady = false;
+
+  unsigned long burstMicros = micros();
+  uint8_t count = accel.drain(samples, accel_packet::MAX_SAMPLES);
+  if (count == 0) {
+    return;
+  }
+
+  uint8_t flags = accel.takeOverrun() ? accel_packet::FLAG_OVERRUN : 0;
+  size_t length = accel_packet::pack(packet, sequence++, flags, sampleIndex, burstMicros, samples, count);
+  sampleIndex += count;  // delivered samples only, a FIFO overrun loses some uncounted
+
+  // Serial.write only blocks if the transmit buffer is full. The sensor keeps sampling
+  // into its FIFO while we wait, so short waits cost nothing.
+  Serial.write(packet, length);
+}
@@ -0,0 +1,200 @@
+/*
+ * Accelerometer Driver Throughput Test (runs on your computer)
+ *
+ * Runs the same ADXL345 driver and packet code as the Arduino sketch against the
+ * ADXL345Sim register model. Every SPI transfer, delay and serial byte advances a
+ * simulated clock using the timings of an Uno, so we can see whether the sketch keeps
+ * up with the sensor for each sample rate and baud rate without any hardware.
+ *
+ * The model runs in test pattern mode, so every received sample is checked: a lost,
+ * repeated or corrupted sample shows up as a pattern error.
+ *
+ * Run with: pio run -e native -t exec
+ * The program exits with an error if the sketch's default settings lose any data.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include "ADXL345.h"
+#include "ADXL345Sim.h"
+#include "AccelPacket.h"
+
+// Uno timing estimates (16 MHz, Arduino SPI and HardwareSerial libraries)
+const uint32_t SPI_BYTE_NS = 3000;          // 2 us on the wire at 4 MHz plus SPI.transfer() overhead
+const uint32_t SPI_TRANSACTION_NS = 10000;  // beginTransaction + two digitalWrite calls
+const uint32_t ISR_LATENCY_NS = 5000;       // interrupt entry until loop() sees the flag
+const uint32_t PACK_BYTE_NS = 500;          // building the packet and the checksum
+const uint32_t SERIAL_BUFFER = 64;          // HardwareSerial transmit buffer on the Uno
+
+// Serial port model: bytes leave the transmit buffer at the baud rate.
+// Serial.write() blocks while the buffer is full, which costs the sketch time.
+struct SerialModel {
+  uint32_t baud;
+  uint64_t busyUntilNs;   // when the byte currently being shifted out is done
+  uint32_t queued;        // bytes not yet sent, including the one being shifted out
+  std::vector<uint8_t> bytes;
+
+  uint64_t byteNs() const { return 10ULL * 1000000000ULL / baud; }
+
+  void update(uint64_t now) {
+    while (queued > 0 && busyUntilNs <= now) {
+      queued--;
+      if (queued > 0) busyUntilNs += byteNs();
+    }
+  }
+
+  bool full() const { return queued > SERIAL_BUFFER; }
+
+  void push(uint8_t b, uint64_t now) {
+    update(now);
+    if (queued == 0) busyUntilNs = now + byteNs();
+    queued++;
+    bytes.push_back(b);
+  }
+};
+
+// Bus object the driver talks to: forwards to the model and charges the Uno's time
+struct SimBus {
+  ADXL345Sim *sim;
+  uint64_t busyNs;
+
+  void spend(uint64_t ns) {
+    sim->advance(ns);
+    busyNs += ns;
+  }
+  void writeRegister(uint8_t reg, uint8_t value) {
+    spend(SPI_TRANSACTION_NS + 2 * SPI_BYTE_NS);
+    sim->writeRegister(reg, value);
+  }
+  void readRegisters(uint8_t reg, uint8_t *dest, uint8_t count) {
+    spend(SPI_TRANSACTION_NS + (count + 1) * SPI_BYTE_NS);
+    sim->readRegisters(reg, dest, count);
+  }
+  void waitMicros(uint16_t us) { spend((uint64_t)us * 1000); }
+};
+
+struct Result {
+  uint32_t produced;
+  uint32_t delivered;
+  uint32_t dropped;
+  uint32_t patternErrors;
+  uint32_t checksumErrors;
+  uint8_t maxEntries;
+  double cpuBusy;
+  double linkBusy;
+};
+
+// Checks the received byte stream the same way AccelCapture.py does
+static void checkStream(const std::vector<uint8_t> &bytes, Result &r) {
+  size_t i = 0;
+  uint32_t expected = 0;
+  while (i + accel_packet::HEADER_BYTES < bytes.size()) {
+    if (bytes[i] != accel_packet::SYNC0 || bytes[i + 1] != accel_packet::SYNC1) {
+      i++;
+      continue;
+    }
+    uint8_t count = bytes[i + 3];
+    size_t length = accel_packet::packetBytes(count);
+    if (i + length > bytes.size()) break;
+    uint8_t sum = 0;
+    for (size_t k = i + 2; k < i + length; k++) sum = (uint8_t)(sum + bytes[k]);
+    if (sum != 0) {
+      r.checksumErrors++;
+      i++;
+      continue;
+    }
+    const uint8_t *p = &bytes[i + accel_packet::HEADER_BYTES];
+    for (uint8_t s = 0; s < count; s++, p += accel_packet::SAMPLE_BYTES) {
+      int16_t x = (int16_t)(p[0] | (p[1] << 8));
+      if (x != ADXL345Sim::patternX(expected)) {
+        r.patternErrors++;
+        expected = (uint32_t)x; // resynchronise on the received value
+      }
+      expected++;
+      r.delivered++;
+    }
+    i += length;
+  }
+}
+
+static Result run(uint8_t rateCode, uint32_t baud, double seconds) {
+  ADXL345Sim sim;
+  SimBus bus = {&sim, 0};
+  adxl345::Driver<SimBus> accel(bus);
+  SerialModel serial = {baud, 0, 0, {}};
+  Result r = {};
+
+  adxl345::Sample samples[accel_packet::MAX_SAMPLES];
+  uint8_t packet[accel_packet::HEADER_BYTES + accel_packet::MAX_SAMPLES * accel_packet::SAMPLE_BYTES + 1];
+  uint8_t sequence = 0;
+  uint32_t sampleIndex = 0;
+
+  accel.begin(rateCode, 16);
+  uint64_t endNs = (uint64_t)(seconds * 1e9);
+  uint64_t idleStep = 2000; // loop() polling step while nothing is happening
+
+  while (sim.nowNs() < endNs) {
+    if (!sim.int1()) {
+      sim.advance(idleStep);
+      continue;
+    }
+    bus.spend(ISR_LATENCY_NS);
+    uint8_t count = accel.drain(samples, accel_packet::MAX_SAMPLES);
+    if (count == 0) continue;
+    uint8_t flags = accel.takeOverrun() ? accel_packet::FLAG_OVERRUN : 0;
+    size_t length = accel_packet::pack(packet, sequence++, flags, sampleIndex,
+                                       (uint32_t)(sim.nowNs() / 1000), samples, count);
+    sampleIndex += count;
+    bus.spend(length * PACK_BYTE_NS);
+
+    // Serial.write(): wait for room in the transmit buffer one byte at a time
+    for (size_t k = 0; k < length; k++) {
+      serial.update(sim.nowNs());
+      while (serial.full()) {
+        bus.spend(serial.busyUntilNs - sim.nowNs());
+        serial.update(sim.nowNs());
+      }
+      serial.push(packet[k], sim.nowNs());
+    }
+  }
+
+  r.produced = sim.produced;
+  r.dropped = sim.dropped;
+  r.maxEntries = sim.maxEntries;
+  r.cpuBusy = (double)bus.busyNs / (double)sim.nowNs();
+  r.linkBusy = (double)serial.bytes.size() * 10.0 / baud / seconds;
+  checkStream(serial.bytes, r);
+  if (sim.popTooSoon > 0) r.patternErrors += sim.popTooSoon;
+  return r;
+}
+
+int main() {
+  const uint8_t rates[] = {adxl345::RATE_400_HZ, adxl345::RATE_800_HZ, adxl345::RATE_1600_HZ,
+                           adxl345::RATE_3200_HZ};
+  const uint32_t bauds[] = {115200, 500000, 1000000};
+  const double seconds = 10.0;
+  bool defaultOk = true;
+
+  printf("ADXL345 FIFO driver throughput (%.0f s simulated per row, watermark 16)\n\n", seconds);
+  printf("%8s %8s %10s %10s %8s %8s %6s %6s %6s  %s\n", "ODR(Hz)", "baud", "produced", "delivered",
+         "lost", "errors", "maxFIFO", "cpu%", "link%", "result");
+
+  for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+    for (size_t j = 0; j < sizeof(bauds) / sizeof(bauds[0]); j++) {
+      Result r = run(rates[i], bauds[j], seconds);
+      uint32_t errors = r.patternErrors + r.checksumErrors;
+      bool ok = r.dropped == 0 && errors == 0;
+      printf("%8u %8u %10u %10u %8u %8u %6u %6.1f %6.1f  %s\n", adxl345::rateHz(rates[i]), bauds[j],
+             r.produced, r.delivered, r.dropped, errors, r.maxEntries, 100.0 * r.cpuBusy,
+             100.0 * r.linkBusy, ok ? "ok" : "LOSES DATA");
+      if (rates[i] == adxl345::RATE_3200_HZ && bauds[j] == 1000000 && !ok) {
+        defaultOk = false;
+      }
+    }
+  }
+
+  printf("\nSketch defaults (3200 Hz, 1000000 baud): %s\n", defaultOk ? "lossless" : "LOSES DATA");
+  return defaultOk ? 0 : 1;
+}
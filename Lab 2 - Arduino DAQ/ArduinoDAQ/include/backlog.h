@@ -0,0 +1,165 @@
+/*
+ * Store-and-forward backlog for when the computer stops listening
+ *
+ * A USB glitch or a sleeping laptop doesn't stop the sketch, it just prints into a port
+ * nobody reads. The backlog keeps the lines in RAM instead, so they can be sent once the
+ * computer is back. Each line is stored with its sequence number: every line offered to the
+ * backlog gets the next number, also the ones it doesn't keep, so the receiver can tell
+ * which lines were left out.
+ *
+ * A long outage doesn't fit, so the backlog thins out the data lines (the ones that don't
+ * start with # or !) instead of giving up: when it is full it drops every other data line it
+ * holds and from then on only keeps every second one, then every fourth, and so on. That
+ * way it always covers the whole outage, just more coarsely the longer it lasts. Metadata
+ * lines (#EVENT, #WARNING, !ALARM...) aren't thinned, but once they fill more than half of the
+ * backlog the oldest of them makes room instead of the data.
+ *
+ * Lines are stored back to back as [length][sequence, 4 bytes][text], sent ones are taken
+ * off the front.
+ */
+
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include <stdint.h>
+#include <string.h>
+
+template <uint16_t BYTES>
+class Backlog {
+public:
+  Backlog() : sequence_(0) { clear(); }
+
+  // Forgets the stored lines and goes back to keeping every line
+  void clear() {
+    head_ = tail_ = 0;
+    count_ = 0;
+    divider_ = 1;
+    skip_ = 0;
+  }
+
+  // Offers a line (without the line ending) to the backlog
+  void add(const char *line, uint8_t length) {
+    uint32_t sequence = sequence_++;
+    if (length > 0 && line[0] != '#' && line[0] != '!') {
+      if (skip_ > 0) {
+        skip_--;
+        return;
+      }
+      skip_ = (uint16_t)(divider_ - 1);
+    }
+    uint16_t size = (uint16_t)(HEADER + length);
+    if (size > BYTES) {
+      return;
+    }
+    while (tail_ + size > BYTES) {
+      if (head_ > 0) {
+        compact();
+      } else if (dataBytes() < tail_ / 2 || !thin()) {
+        dropOldestMetadata();
+      }
+    }
+    buffer_[tail_] = length;
+    memcpy(&buffer_[tail_ + 1], &sequence, 4);
+    memcpy(&buffer_[tail_ + HEADER], line, length);
+    tail_ = (uint16_t)(tail_ + size);
+    count_++;
+  }
+
+  bool empty() const { return head_ == tail_; }
+  uint16_t count() const { return count_; }
+  uint16_t divider() const { return divider_; }
+
+  // The oldest stored line, check empty() first
+  const char *line() const { return (const char *)&buffer_[head_ + HEADER]; }
+  uint8_t length() const { return buffer_[head_]; }
+  uint32_t sequence() const {
+    uint32_t sequence;
+    memcpy(&sequence, &buffer_[head_ + 1], 4);
+    return sequence;
+  }
+
+  // Takes the oldest line off once it has been sent
+  void pop() {
+    head_ = (uint16_t)(head_ + HEADER + buffer_[head_]);
+    count_--;
+  }
+
+private:
+  static const uint8_t HEADER = 5;
+
+  // Moves the stored lines to the front of the buffer
+  void compact() {
+    memmove(buffer_, &buffer_[head_], tail_ - head_);
+    tail_ = (uint16_t)(tail_ - head_);
+    head_ = 0;
+  }
+
+  static bool isData(const uint8_t *record) {
+    return record[0] > 0 && record[HEADER] != '#' && record[HEADER] != '!';
+  }
+
+  uint16_t dataBytes() const {
+    uint16_t bytes = 0;
+    for (uint16_t at = head_; at < tail_; at = (uint16_t)(at + HEADER + buffer_[at])) {
+      if (isData(&buffer_[at])) {
+        bytes = (uint16_t)(bytes + HEADER + buffer_[at]);
+      }
+    }
+    return bytes;
+  }
+
+  // Drops every other stored data line and halves the rate new ones are kept at. Returns
+  // false if there were too few data lines to make room.
+  bool thin() {
+    uint16_t from = head_;
+    uint16_t to = head_;
+    bool drop = false;
+    bool dropped = false;
+    while (from < tail_) {
+      uint16_t size = (uint16_t)(HEADER + buffer_[from]);
+      bool data = isData(&buffer_[from]);
+      if (data && drop) {
+        count_--;
+        dropped = true;
+      } else {
+        memmove(&buffer_[to], &buffer_[from], size);
+        to = (uint16_t)(to + size);
+      }
+      if (data) {
+        drop = !drop;
+      }
+      from = (uint16_t)(from + size);
+    }
+    tail_ = to;
+    if (dropped && divider_ < 0x8000) {
+      divider_ = (uint16_t)(divider_ * 2);
+      skip_ = (uint16_t)(divider_ - 1);
+    }
+    return dropped;
+  }
+
+  // Drops the oldest metadata line, or the oldest line if there are only data lines
+  void dropOldestMetadata() {
+    uint16_t at = head_;
+    while (at < tail_ && isData(&buffer_[at])) {
+      at = (uint16_t)(at + HEADER + buffer_[at]);
+    }
+    if (at >= tail_) {
+      at = head_;
+    }
+    uint16_t size = (uint16_t)(HEADER + buffer_[at]);
+    memmove(&buffer_[at], &buffer_[at + size], tail_ - at - size);
+    tail_ = (uint16_t)(tail_ - size);
+    count_--;
+  }
+
+  uint8_t buffer_[BYTES];
+  uint16_t head_;       // oldest stored line
+  uint16_t tail_;       // end of the stored lines
+  uint16_t count_;
+  uint16_t divider_;    // only every divider-th data line is kept
+  uint16_t skip_;       // data lines to leave out before the next one is kept
+  uint32_t sequence_;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Store-and-forward while the computer is gone
+ *
+ * Part of main.cpp, included after its settings (see HOST_TIMEOUT there). The heartbeat
+ * commands tell whether the computer listens. While it doesn't, storeLine() keeps the lines in
+ * the backlog (see backlog.h) instead of sending them, and serviceBacklog() sends them once
+ * the heartbeat is back.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include "backlog.h"
+
+// Where the lines go
+enum HostState : uint8_t {
+  HOST_UNKNOWN,   // no heartbeat yet, print as usual
+  HOST_ONLINE,    // print, and keep the lines since the last heartbeat in case it was the last
+  HOST_OFFLINE,   // the heartbeat stopped, only keep the lines
+  HOST_DRAINING   // the heartbeat is back, print and send the backlog
+};
+HostState hostState = HOST_UNKNOWN;
+unsigned long lastHeartbeat = 0;
+Backlog<BACKLOG_BYTES> backlog;
+
+// Notices a missing heartbeat
+void checkHeartbeat() {
+  if ((hostState == HOST_ONLINE || hostState == HOST_DRAINING) &&
+      hal::millis() - lastHeartbeat > HOST_TIMEOUT) {
+    hostState = HOST_OFFLINE;
+  }
+}
+
+// Line tap for store-and-forward (see backlog.h). Returns false to keep a line off the link.
+bool storeLine(const char *line, uint8_t length) {
+  checkHeartbeat();  // before the line goes out: with native USB a missing computer can block it
+  if (hostState == HOST_ONLINE || hostState == HOST_OFFLINE) {
+    backlog.add(line, length);
+  }
+  return hostState != HOST_OFFLINE;
+}
+
+// A heartbeat from the computer. The lines kept since the last one have arrived, unless the
+// computer was gone: then it gets the backlog.
+void heartbeat() {
+  unsigned long now = hal::millis();
+  if (hostState == HOST_UNKNOWN) {
+    Line::setTap(storeLine);
+    hostState = HOST_ONLINE;
+  } else if (hostState == HOST_OFFLINE) {
+    hostState = HOST_DRAINING;
+    Line line;
+    line.text("#RECONNECT,").number(lastHeartbeat).comma().number(now).comma();
+    line.number(backlog.count()).comma().number(backlog.divider()).sendDirect();
+  }
+  if (hostState == HOST_ONLINE) {
+    backlog.clear();
+  }
+  lastHeartbeat = now;
+}
+
+// Sends the backlog while the link has room for it
+void serviceBacklog() {
+  checkHeartbeat();
+  while (hostState == HOST_DRAINING) {
+    if (backlog.empty()) {
+      backlog.clear();
+      hostState = HOST_ONLINE;
+      return;
+    }
+    Line line;
+    line.text("#BACKLOG,").number(backlog.sequence()).comma();
+    for (uint8_t i = 0; i < backlog.length(); i++) {
+      line.character(backlog.line()[i]);
+    }
+    if (hal::linkWritable() < (size_t)line.length() + 2) {
+      return;  // try again next loop
+    }
+    line.sendDirect();
+    backlog.pop();
+  }
+}
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * Line: builds one line of text output in memory and sends it in one piece.
+ *
+ * Formatting the whole line first and handing it to the serial link in a single write is
+ * faster than a chain of Serial.print() calls, and it works the same on every board
+ * because it only needs hal::linkWrite(). Example:
+ *
+ *   Line line;
+ *   line.number(time).comma().number(value).send();   // sends "1234,567\r\n"
+ *
+ * A tap (see setTap) sees every line that is sent, and can keep it from going out. The
+ * store-and-forward backlog uses it to hold on to the lines while the computer is gone.
+ * An output (see setOutput) gets the finished lines instead of the link, for a transport
+ * that frames them (see reliable.h).
+ *
+ * Urgent lines (alarms) jump the queue: a waiting hook (see setWaiting) runs before every
+ * line and while a line waits for the link, and sends them with sendUrgent(). With a queue
+ * limit an ordinary line only goes into the link's transmit buffer while it holds at most
+ * that many bytes, so an urgent line never has more than the limit plus one line ahead of it.
+ */
+
+#ifndef LINE_H
+#define LINE_H
+
+#include <stdint.h>
+#include "hal.h"
+
+class Line {
+public:
+  static const uint8_t CAPACITY = 128;
+
+  // Gets every line (without the line ending) before it is sent, returns false to drop it
+  typedef bool (*Tap)(const char *line, uint8_t length);
+
+  static void setTap(Tap tap) { tap_() = tap; }
+
+  // Gets the finished lines (with the line ending) instead of the link
+  typedef void (*Output)(const char *line, uint8_t length);
+
+  static void setOutput(Output output) { output_() = output; }
+
+  // Runs before every ordinary line and while it waits, to send urgent lines first. Ordinary
+  // lines also wait while the link holds more than queueLimit bytes (0 = no limit, it only
+  // applies to the link itself, not to an output).
+  typedef void (*Waiting)();
+
+  static void setWaiting(Waiting waiting, uint8_t queueLimit) {
+    waiting_() = waiting;
+    queueLimit_() = queueLimit;
+  }
+
+  Line() : length_(0) {}
+
+  Line &text(const char *s) {
+    while (*s) character(*s++);
+    return *this;
+  }
+
+  Line &character(char c) {
+    if (length_ < CAPACITY - 2) buffer_[length_++] = c; // always leave room for \r\n
+    return *this;
+  }
+
+  Line &comma() { return character(','); }
+
+  Line &number(uint32_t value) {
+    char digits[10];
+    uint8_t n = 0;
+    do {
+      digits[n++] = (char)('0' + value % 10);
+      value /= 10;
+    } while (value > 0);
+    while (n > 0) character(digits[--n]);
+    return *this;
+  }
+
+  Line &signedNumber(int32_t value) {
+    if (value < 0) {
+      character('-');
+      return number((uint32_t)(-(value + 1)) + 1);
+    }
+    return number((uint32_t)value);
+  }
+
+  // Prints value with a fixed number of decimals, like Serial.print(value, decimals)
+  Line &decimal(float value, uint8_t decimals = 2) {
+    if (value != value) return text("nan");
+    if (value < 0) {
+      character('-');
+      value = -value;
+    }
+    uint32_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) scale *= 10;
+    uint32_t scaled = (uint32_t)(value * scale + 0.5f);
+    number(scaled / scale);
+    if (decimals > 0) {
+      character('.');
+      uint32_t fraction = scaled % scale;
+      for (uint32_t d = scale / 10; d > 0; d /= 10) {
+        character((char)('0' + (fraction / d) % 10));
+      }
+    }
+    return *this;
+  }
+
+  uint8_t length() const { return length_; }
+
+  // Adds the line ending and sends the line, waiting for room in the transmit buffer
+  // just like Serial.println() does.
+  void send() {
+    Tap tap = tap_();
+    if (tap && !tap(buffer_, length_)) {
+      length_ = 0;
+      return;
+    }
+    sendDirect();
+  }
+
+  // Sends the line ahead of the ordinary ones, from the waiting hook
+  void sendUrgent() {
+    bool &urgent = urgent_();
+    bool was = urgent;
+    urgent = true;
+    send();
+    urgent = was;
+  }
+
+  // Sends the line without showing it to the tap
+  void sendDirect() {
+    buffer_[length_++] = '\r';
+    buffer_[length_++] = '\n';
+    Waiting waiting = waiting_();
+    if (waiting && !urgent_()) {
+      urgent_() = true;  // the hook's own lines don't wait for it
+      waiting();
+      uint8_t limit = queueLimit_();
+      while (limit > 0 && !output_() && hal::linkQueued() > limit) {
+        waiting();
+      }
+      urgent_() = false;
+    }
+    Output output = output_();
+    if (output) {
+      output(buffer_, length_);
+      length_ = 0;
+      return;
+    }
+    const uint8_t *p = (const uint8_t *)buffer_;
+    uint8_t left = length_;
+    while (left > 0) {
+      size_t sent = hal::linkWrite(p, left);
+      p += sent;
+      left = (uint8_t)(left - sent);
+    }
+    length_ = 0;
+  }
+
+private:
+  static Tap &tap_() {
+    static Tap tap = 0;
+    return tap;
+  }
+
+  static Output &output_() {
+    static Output output = 0;
+    return output;
+  }
+
+  static Waiting &waiting_() {
+    static Waiting waiting = 0;
+    return waiting;
+  }
+
+  static uint8_t &queueLimit_() {
+    static uint8_t limit = 0;
+    return limit;
+  }
+
+  static bool &urgent_() {
+    static bool urgent = false;
+    return urgent;
+  }
+
+  char buffer_[CAPACITY];
+  uint8_t length_;
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Digital lock-in amplifier
+ *
+ * The sketch drives a sine wave (as PWM) on a pin and moves one step along it every
+ * sample, so every scan is taken at a known point of the reference wave. Multiplying the
+ * samples by the reference sine and cosine and adding them up over whole periods keeps only
+ * the part of each input that moves at exactly the reference frequency, with its phase.
+ * Everything else (noise, 50 Hz pickup, the DC level) averages away, so responses much
+ * smaller than one ADC step can be measured. A low-pass filter (two first order stages, like
+ * the 12 dB/octave setting of a lab lock-in) then smooths the result.
+ *
+ * The multiply-and-add uses integer sine/cosine tables and the filter stages are fixed point
+ * too (y += (x - y) >> filterShift, once per reference period), so it is cheap enough for the
+ * Uno; only the amplitude/phase math uses floats, when a line is printed.
+ */
+
+#ifndef LOCKIN_H
+#define LOCKIN_H
+
+#include <math.h>
+#include <stdint.h>
+
+// One period of the reference sine, scaled to +-8191
+static const uint8_t LOCKIN_STEPS = 32;
+static const int16_t LOCKIN_SINE[LOCKIN_STEPS] = {
+  0, 1598, 3135, 4551, 5792, 6811, 7567, 8034, 8191, 8034, 7567, 6811, 5792, 4551, 3135, 1598,
+  0, -1598, -3135, -4551, -5792, -6811, -7567, -8034, -8191, -8034, -7567, -6811, -5792, -4551, -3135, -1598};
+
+template <uint8_t CHANNELS>
+class LockIn {
+public:
+  // Each filter stage has a time constant of 2^filterShift reference periods
+  explicit LockIn(uint8_t filterShift)
+    : shift_(filterShift), count_(0), periods_(0) {
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      x_[c] = y_[c] = 0;
+      for (uint8_t k = 0; k < 2; k++) xFiltered_[k][c] = yFiltered_[k][c] = 0;
+    }
+  }
+
+  // PWM duty cycle for a step of the reference wave (0 - 255)
+  static uint8_t referenceDuty(uint8_t step) {
+    return (uint8_t)(128 + (LOCKIN_SINE[step] >> 6));
+  }
+
+  // Adds one scan taken at this step of the reference wave
+  void add(uint8_t step, const uint16_t *values) {
+    int16_t s = LOCKIN_SINE[step];
+    int16_t c = LOCKIN_SINE[(step + LOCKIN_STEPS / 4) % LOCKIN_STEPS];
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+      x_[i] += (int32_t)values[i] * s;
+      y_[i] += (int32_t)values[i] * c;
+    }
+    count_++;
+
+    if (step == LOCKIN_STEPS - 1) {
+      // Only use complete periods, otherwise the DC level doesn't cancel out
+      if (count_ == LOCKIN_STEPS) {
+        // A period's sum stays within +-4095 * 8191 * 21 (12 bit ADC), so the differences
+        // fit in 32 bits
+        for (uint8_t i = 0; i < CHANNELS; i++) {
+          xFiltered_[0][i] += (x_[i] - xFiltered_[0][i]) >> shift_;
+          yFiltered_[0][i] += (y_[i] - yFiltered_[0][i]) >> shift_;
+          xFiltered_[1][i] += (xFiltered_[0][i] - xFiltered_[1][i]) >> shift_;
+          yFiltered_[1][i] += (yFiltered_[0][i] - yFiltered_[1][i]) >> shift_;
+        }
+        periods_++;
+      }
+      for (uint8_t i = 0; i < CHANNELS; i++) x_[i] = y_[i] = 0;
+      count_ = 0;
+    }
+  }
+
+  // Complete reference periods so far
+  uint32_t periods() const { return periods_; }
+
+  // Amplitude of the channel's response at the reference frequency, in raw counts
+  float amplitude(uint8_t channel) const {
+    float x = (float)xFiltered_[1][channel];
+    float y = (float)yFiltered_[1][channel];
+    return 2.0f * sqrtf(x * x + y * y) / (8191.0f * LOCKIN_STEPS);
+  }
+
+  // Phase of the response relative to the reference wave, in degrees
+  float phase(uint8_t channel) const {
+    return atan2f((float)yFiltered_[1][channel], (float)xFiltered_[1][channel]) * (180.0f / 3.14159265f);
+  }
+
+private:
+  uint8_t shift_;
+  int32_t x_[CHANNELS];  // sums over the current period
+  int32_t y_[CHANNELS];
+  int32_t xFiltered_[2][CHANNELS]; // the two filter stages
+  int32_t yFiltered_[2][CHANNELS];
+  uint8_t count_;
+  uint32_t periods_;
+};
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * Lock-in mode: drive a reference sine on a PWM pin and print each channel's response to it
+ *
+ * Part of main.cpp, see mode_raw.h for what a mode header provides.
+ */
+
+#ifndef MODE_LOCKIN_H
+#define MODE_LOCKIN_H
+
+#include "lockin.h"
+
+// Lock-in mode settings. The reference sine has LOCKIN_STEPS (32) samples per period, so its
+// frequency is 1000 / (32 * SAMPLE_PERIOD) Hz, e.g. SAMPLE_PERIOD = 1 gives 31.25 Hz.
+// Drive your excitation (shaker, LED, heater...) from LOCKIN_PIN through an RC filter.
+const uint8_t LOCKIN_PIN = 3;              // PWM pin for the reference (3 has a 31 kHz carrier on the Uno)
+const uint8_t LOCKIN_FILTER_SHIFT = 5;     // Low-pass time constant: 2^5 = 32 reference periods per stage
+const uint16_t LOCKIN_OUTPUT_PERIODS = 16; // Print a line every 16 reference periods
+
+LockIn<NUM_CHANNELS> lockin(LOCKIN_FILTER_SHIFT);
+volatile uint8_t referenceStep = LOCKIN_STEPS - 1; // the first tick moves it to step 0
+
+// "time" and ",amplitude,phase" per channel, once every LOCKIN_OUTPUT_PERIODS reference periods
+const uint32_t LOCKIN_LINE = budget::TIME_DIGITS + NUM_CHANNELS * (budget::VALUE_DIGITS + 12) + 2;
+const uint32_t TICK_MILLIBYTES = budget::divideUp(LOCKIN_LINE * 1000, LOCKIN_OUTPUT_PERIODS * LOCKIN_STEPS);
+const uint32_t FIXED_BYTES_PER_S = 0;
+const bool MODE_SAMPLE_TIMER = true;
+
+// Runs from the timer interrupt once every sample period
+void lockinTick() {
+  tickBegin();
+  // Step the reference first, so it keeps running even if this scan has to be dropped
+  uint8_t step = (uint8_t)((referenceStep + 1) % LOCKIN_STEPS);
+  referenceStep = step;
+  hal::pwmWrite(LOCKIN_PIN, lockin.referenceDuty(step));
+  uint16_t values[NUM_CHANNELS];
+  readChannels(values, 0);
+  checkAlarms(tickTime, values, 0xFFFFFFFFUL);
+  volatile Scan *scan = queueSlot(values);
+  if (scan) {
+    scan->step = step;
+    queuePush();
+  }
+}
+
+void modeSetup() {
+  hal::pwmBegin(LOCKIN_PIN);
+  hal::pwmWrite(LOCKIN_PIN, lockin.referenceDuty(LOCKIN_STEPS - 1));
+}
+
+void modeStart() {
+  Line header;
+  header.text("Time (ms)");
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    header.text(",S").number(settings.channels[i]).text(" amplitude (raw)");
+    header.text(",S").number(settings.channels[i]).text(" phase (deg)");
+  }
+  header.send(); // Print header for the lock-in data
+  // Reference frequency in Hz
+  Line info;
+  info.text("#LOCKIN,").decimal(1000.0f / (LOCKIN_STEPS * settings.samplePeriod), 3).send();
+  startSampling(lockinTick);
+}
+
+void modeService() {}
+
+// Prints the amplitude and phase of every channel every LOCKIN_OUTPUT_PERIODS reference periods
+void modeScan(const Scan &scan) {
+  uint32_t periods = lockin.periods();
+  lockin.add(scan.step, scan.value);
+  if (lockin.periods() != periods && lockin.periods() % LOCKIN_OUTPUT_PERIODS == 0) {
+    Line line;
+    line.number(scan.time);
+    for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+      line.comma().decimal(lockin.amplitude(i), 3).comma().decimal(lockin.phase(i), 1);
+    }
+    line.send();
+  }
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Multi-rate mode: read slow channels less often than fast ones (see DIVIDER)
+ *
+ * Part of main.cpp, see mode_raw.h for what a mode header provides.
+ */
+
+#ifndef MODE_MULTIRATE_H
+#define MODE_MULTIRATE_H
+
+#include "multirate.h"
+
+// Multi-rate mode settings. SAMPLE_PERIOD is the base tick, channel i is read on every
+// DIVIDER[i]-th tick: with SAMPLE_PERIOD = 2 and {1, 10, 50} A0 is read every 2 ms, A1 every
+// 20 ms and A2 every 100 ms. Set the GUI's period to SAMPLE_PERIOD.
+const uint8_t DIVIDER[NUM_CHANNELS] = {1, 10, 50};
+
+MultiRate<NUM_CHANNELS> schedule(DIVIDER);
+
+// Every tick prints the time stamp and the commas, each channel only on its own ticks
+constexpr uint32_t dueMilliBytes(uint8_t i) {
+  return i >= NUM_CHANNELS ? 0
+       : budget::VALUE_DIGITS * 1000 / (DIVIDER[i] > 1 ? DIVIDER[i] : 1) + dueMilliBytes(i + 1);
+}
+const uint32_t TICK_MILLIBYTES = (budget::TIME_DIGITS + NUM_CHANNELS + 2 + COUNTER_BYTES) * 1000
+                               + dueMilliBytes(0);
+const uint32_t FIXED_BYTES_PER_S = 0;
+const bool MODE_SAMPLE_TIMER = true;
+
+// Reads only the channels in due (bit i = channel i), the others are set to 0
+void readDueChannels(uint32_t due, uint16_t *values) {
+  uint8_t pins[NUM_CHANNELS];
+  uint16_t read[NUM_CHANNELS];
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    if (due & ((uint32_t)1 << i)) {
+      pins[count++] = settings.channels[i];
+    }
+  }
+  if (LOW_POWER) {
+    hal::adcPower(true);
+  }
+  hal::adcScan(pins, count, read);
+  if (LOW_POWER) {
+    hal::adcPower(false);
+  }
+  count = 0;
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    values[i] = (due & ((uint32_t)1 << i)) ? read[count++] : 0;
+  }
+}
+
+// Runs from the timer interrupt once every sample period
+void multiRateTick() {
+  tickBegin();
+  uint32_t due = schedule.next();
+  if (due == 0) {
+    return;  // no channel is read on this tick
+  }
+  uint16_t values[NUM_CHANNELS];
+  readDueChannels(due, values);
+  checkAlarms(tickTime, values, due);
+  volatile Scan *scan = queueSlot(values);
+  if (scan) {
+    scan->due = due;
+    queuePush();
+  }
+}
+
+void modeSetup() {}
+
+void modeStart() {
+  sendHeader();
+  // Tells the GUI the base tick and every channel's divider, so it can fill in the empty fields
+  schedule.plan();
+  Line info;
+  info.text("#MULTIRATE,").number(settings.samplePeriod);
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    info.comma().number(schedule.divider(i));
+  }
+  info.send();
+  startSampling(multiRateTick);
+}
+
+void modeService() {}
+
+// Prints the scan like sendScan(), with the fields of the channels that weren't read empty
+void modeScan(const Scan &scan) {
+  Line line;
+  line.number(scan.time);
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    line.comma();
+    if (scan.due & ((uint32_t)1 << i)) {
+      line.number(scan.value[i]);
+    }
+  }
+#if USE_COUNTER
+  addCounter(line, scan);
+#endif
+  line.send();
+}
+
+#endif
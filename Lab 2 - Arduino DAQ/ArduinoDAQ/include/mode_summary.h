@@ -0,0 +1,48 @@
+/*
+ * Summary mode: min, max, mean and RMS of each channel once per SUMMARY_WINDOW
+ *
+ * Part of main.cpp, see mode_raw.h for what a mode header provides.
+ */
+
+#ifndef MODE_SUMMARY_H
+#define MODE_SUMMARY_H
+
+#include "summary.h"
+
+// Summary mode settings. For week-long monitoring you would sample fast (e.g. SAMPLE_PERIOD = 4)
+// and only keep one line per second. Set the GUI's period to SUMMARY_WINDOW.
+const unsigned long SUMMARY_WINDOW = 1000;  // Window length in milliseconds, a multiple of SAMPLE_PERIOD
+const uint16_t BURST_THRESHOLD = 100;       // Raw counts away from the last mean that trigger a raw burst, 0 = off
+const uint8_t BURST_LENGTH = 32;            // Scans in a raw burst
+const uint8_t BURST_PRE_TRIGGER = 8;        // How many of them are from before the trigger
+
+SummaryWindow<NUM_CHANNELS, BURST_LENGTH> summary(BURST_THRESHOLD, BURST_PRE_TRIGGER);
+
+// A summary line per window ("time,samples" and min,max,mean,rms per channel), and a burst of
+// #RAW lines after every one of them
+const uint32_t SUMMARY_LINE = budget::TIME_DIGITS + 1 + budget::digits(SUMMARY_WINDOW)
+                            + NUM_CHANNELS * (4 + 4 * budget::VALUE_DIGITS + 6) + 2;
+const uint32_t TICK_MILLIBYTES = 0;
+const uint32_t FIXED_BYTES_PER_S = budget::divideUp(
+    (SUMMARY_LINE + BURST_LENGTH * budget::scanLineBytes(NUM_CHANNELS, 5)) * 1000, SUMMARY_WINDOW);
+const bool MODE_SAMPLE_TIMER = true;
+
+void modeSetup() {}
+
+void modeStart() {
+  summary.sendHeader(settings.channels); // Print header for the summary data
+  startSampling(scanTick);
+}
+
+void modeService() {
+  summary.service();
+}
+
+void modeScan(const Scan &scan) {
+  summary.add(scan.time, scan.value);
+  if (summary.count() >= SUMMARY_WINDOW / settings.samplePeriod) {
+    summary.emit();
+  }
+}
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * Sample clock sync between boards
+ *
+ * Part of main.cpp, included after sampling.h when SYNC_ROLE isn't SYNC_OFF (see there). The
+ * leader drives the pulses from its sample tick, a follower pulls its sample timer onto them
+ * from the capture interrupt. Both mark every pulse in their stream with sendSync().
+ */
+
+#ifndef SYNC_H
+#define SYNC_H
+
+// Sync pulses, from the interrupts to loop(). Only the last one is kept, they are far apart.
+struct SyncMark {
+  uint32_t index;
+  uint32_t time;       // time stamp of the scan the pulse came after
+  uint32_t offsetNs;   // how long after that scan started
+};
+volatile SyncMark syncMark;
+volatile bool syncMarkWaiting = false;
+volatile uint32_t syncIndex = 0;
+volatile uint16_t syncTicks = 2;        // sample periods per pulse
+volatile uint16_t syncPhase = 0;        // leader: ticks since the last pulse
+// Follower: the loop that keeps the sample timer on the pulses (see syncEdge)
+volatile bool syncSeen = false;         // a pulse came already, syncLastTime is valid
+volatile uint32_t syncLastTime = 0;     // tickTime at the last pulse
+volatile bool syncCounting = false;     // syncPulseTick is valid
+volatile uint32_t tickCount = 0;
+volatile uint32_t syncPulseTick = 0;    // tickCount at the last pulse
+volatile int32_t syncDrift = 0;         // ns added to the ticks of every interval, for the clock difference
+volatile int32_t syncDriftRest = 0;     // the part of it not handed out yet
+volatile int32_t periodNudgeNs = 0;     // nudges of the period that is running
+
+// Hands a sync pulse to loop()
+void markSync(uint32_t offsetNs) {
+  volatile SyncMark &mark = syncMark;
+  mark.index = syncIndex;
+  mark.time = tickTime;
+  mark.offsetNs = offsetNs;
+  syncMarkWaiting = true;
+}
+
+// Runs at the start of every tick
+void syncTick() {
+#if SYNC_ROLE == SYNC_LEADER
+  if (syncPhase == 0) {
+    hal::pinWrite(SYNC_PIN, true);
+    markSync(0);
+    syncIndex++;
+  } else if (syncPhase == 1) {
+    hal::pinWrite(SYNC_PIN, false);
+  }
+  syncPhase = (uint16_t)((syncPhase + 1) % syncTicks);
+#else
+  // Hand out the drift correction evenly over the ticks of an interval
+  tickCount++;
+  int32_t total = syncDriftRest + syncDrift;
+  int32_t nudge = total / (int32_t)syncTicks;
+  syncDriftRest = total - nudge * (int32_t)syncTicks;
+  periodNudgeNs = nudge;
+  if (nudge != 0) {
+    hal::timerNudge(nudge);
+  }
+#endif
+}
+
+#if SYNC_ROLE == SYNC_FOLLOWER
+// Runs from the capture interrupt for every pulse from the leader, after the tick of the
+// sample period it fell in. Our ticks should come with the pulses, so the error is how long
+// before the pulse the nearest tick came (negative: after). Half of it moves the running
+// period straight away, a quarter goes into the drift that every interval is corrected by from
+// then on. If the error is more than half a period, counting the ticks since the last pulse
+// still tells how many whole periods we are off, so the loop can't settle a period off.
+void syncEdge(uint32_t sinceTickNs, bool) {
+  uint32_t period = settings.samplePeriod * 1000000UL;
+  uint32_t running = period + (uint32_t)periodNudgeNs;
+  uint32_t ticks = tickCount;
+  int32_t error;
+  if (sinceTickNs <= running / 2) {
+    error = (int32_t)sinceTickNs;
+  } else {
+    error = -(int32_t)(running - sinceTickNs);  // the pulse goes with the coming tick
+    ticks++;
+  }
+  if (syncSeen && tickTime - syncLastTime <= 2 * SYNC_INTERVAL) {
+    syncIndex++;
+  } else {
+    syncIndex = 0;  // the first pulse, or the leader started again
+  }
+  syncSeen = true;
+  syncLastTime = tickTime;
+  markSync(sinceTickNs);
+
+  if (syncCounting) {
+    int32_t slipped = (int32_t)(ticks - syncPulseTick) - (int32_t)syncTicks;
+    int64_t total = (int64_t)slipped * period + error;
+    const int64_t LIMIT = 1000000000LL;
+    error = (int32_t)(total > LIMIT ? LIMIT : total < -LIMIT ? -LIMIT : total);
+  }
+  syncCounting = true;
+  syncPulseTick = ticks;
+
+  int32_t most = (int32_t)(period / 4);
+  int32_t nudge = error / 2;
+  nudge = nudge > most ? most : nudge < -most ? -most : nudge;
+  hal::timerNudge(nudge);
+  periodNudgeNs += nudge;
+  // Up to 1 % of the interval, the boards' clocks are never that far apart
+  const int32_t MOST_DRIFT = (int32_t)(SYNC_INTERVAL * 10000UL);
+  int32_t drift = syncDrift + error / 4;
+  syncDrift = drift > MOST_DRIFT ? MOST_DRIFT : drift < -MOST_DRIFT ? -MOST_DRIFT : drift;
+}
+#endif
+
+// Prints the last sync pulse as "#SYNC,index,time,offset_us"
+void sendSync() {
+  SyncMark mark;
+  {
+    hal::IrqGuard guard;
+    if (!syncMarkWaiting) {
+      return;
+    }
+    mark.index = syncMark.index;
+    mark.time = syncMark.time;
+    mark.offsetNs = syncMark.offsetNs;
+    syncMarkWaiting = false;
+  }
+  Line line;
+  line.text("#SYNC,").number(mark.index).comma().number(mark.time).comma();
+  addMicroseconds(line, mark.offsetNs);
+  line.send();
+}
+
+// For startStream(), with interrupts off. The pulse numbers go on, but the timer starts at a
+// new phase.
+void resetSync() {
+  unsigned long ticks = SYNC_INTERVAL / settings.samplePeriod;
+  syncTicks = (uint16_t)(ticks < 2 ? 2 : ticks);
+  syncPhase = 0;
+  syncCounting = false;
+  syncDriftRest = 0;
+  periodNudgeNs = 0;
+}
+
+#endif
@@ -0,0 +1,200 @@
+// HAL functions that are the same on every Arduino board: time, analog inputs,
+// digital pins and the serial link. The sample timer lives in the board specific files.
+
+#if defined(ARDUINO) && !defined(HAL_NATIVE)
+
+#include <Arduino.h>
+#if defined(ARDUINO_ARCH_AVR) || defined(ARDUINO_ARCH_RP2040)
+  #include <EEPROM.h>
+#endif
+#include "hal.h"
+
+// The Arduino Zero's native USB port is SerialUSB, every other board calls it Serial
+#if defined(ARDUINO_ARCH_SAMD)
+  #define HAL_LINK SerialUSB
+#else
+  #define HAL_LINK Serial
+#endif
+
+// The Uno talks through a USB-serial bridge with a 64 byte transmit buffer that we can
+// check. Native USB ports don't report their buffer reliably, so we write in 64 byte pieces.
+#if defined(ARDUINO_ARCH_AVR) && !defined(__AVR_ATmega32U4__)
+  #define HAL_LINK_HAS_TX_BUFFER 1
+#else
+  #define HAL_LINK_HAS_TX_BUFFER 0
+#endif
+
+namespace hal {
+
+uint32_t micros() { return ::micros(); }
+uint32_t millis() { return ::millis(); }
+
+void adcBegin() {
+#if HAL_ADC_BITS > 10
+  analogReadResolution(HAL_ADC_BITS);
+#endif
+}
+
+uint16_t adcRead(uint8_t channel) {
+  return (uint16_t)analogRead(A0 + channel);
+}
+
+// AVR boards let the ADC time the scan itself, see hal_avr.cpp
+#if !defined(ARDUINO_ARCH_AVR)
+void adcScan(const uint8_t *channels, uint8_t count, uint16_t *values, uint16_t *times) {
+  uint32_t start = ::micros();
+  for (uint8_t i = 0; i < count; i++) {
+    if (times) times[i] = (uint16_t)(::micros() - start);
+    values[i] = adcRead(channels[i]);
+  }
+}
+#endif
+
+void pinOutput(uint8_t pin) { pinMode(pin, OUTPUT); }
+void pinInput(uint8_t pin, bool pullup) { pinMode(pin, pullup ? INPUT_PULLUP : INPUT); }
+void pinWrite(uint8_t pin, bool high) { digitalWrite(pin, high ? HIGH : LOW); }
+bool pinRead(uint8_t pin) { return digitalRead(pin) == HIGH; }
+
+bool attachEdge(uint8_t pin, Edge edge, void (*handler)()) {
+  int irq = digitalPinToInterrupt(pin);
+  if (irq == NOT_AN_INTERRUPT) {
+    return false;
+  }
+  int mode = edge == EDGE_RISING ? RISING : (edge == EDGE_FALLING ? FALLING : CHANGE);
+  attachInterrupt(irq, handler, mode);
+  return true;
+}
+
+void detachEdge(uint8_t pin) {
+  int irq = digitalPinToInterrupt(pin);
+  if (irq != NOT_AN_INTERRUPT) {
+    detachInterrupt(irq);
+  }
+}
+
+// Event capture with a pin interrupt that reads micros(). The board's timer file records when
+// the last tick came. AVR boards capture with Timer1 instead, see hal_avr.cpp.
+#if !defined(ARDUINO_ARCH_AVR)
+extern volatile uint32_t lastTickMicros;
+static void (*volatile captureHandler)(uint32_t, bool) = 0;
+
+static void onCaptureEdge() {
+  uint32_t now = ::micros();
+  bool rising = digitalRead(HAL_CAPTURE_PIN) == HIGH;
+  if (captureHandler) {
+    captureHandler((now - lastTickMicros) * 1000UL, rising);
+  }
+}
+
+bool captureBegin(Edge edge, void (*handler)(uint32_t, bool)) {
+  captureHandler = handler;
+  return attachEdge(HAL_CAPTURE_PIN, edge, onCaptureEdge);
+}
+
+void captureStop() {
+  detachEdge(HAL_CAPTURE_PIN);
+  captureHandler = 0;
+}
+
+// These ADCs can't be started by a timer through this HAL yet (the SAMD21's event system could)
+bool etsBegin(uint8_t, Edge, void (*)(uint16_t, uint32_t)) { return false; }
+void etsArm(uint32_t) {}
+void etsStop() {}
+#endif
+
+void pwmBegin(uint8_t pin) {
+  pinMode(pin, OUTPUT);
+  analogWrite(pin, 128);
+#if defined(ARDUINO_ARCH_AVR) && !defined(__AVR_ATmega32U4__)
+  // On the Uno pins 3 and 11 run on Timer2, which the sample timer doesn't use (unless the
+  // frequency counter has moved it there, see hal_avr.cpp). Without its
+  // prescaler the PWM runs at 31 kHz instead of 490 Hz, which is much easier to filter.
+  if (pin == 3 || pin == 11) {
+    TCCR2B = (uint8_t)((TCCR2B & ~(_BV(CS22) | _BV(CS21) | _BV(CS20))) | _BV(CS20));
+  }
+#elif defined(ARDUINO_ARCH_RP2040)
+  analogWriteFreq(100000);
+#endif
+}
+
+void pwmWrite(uint8_t pin, uint8_t duty) { analogWrite(pin, duty); }
+
+#if defined(ARDUINO_ARCH_SAMD)
+IrqGuard::IrqGuard() : state_(__get_PRIMASK()) { __disable_irq(); }
+IrqGuard::~IrqGuard() { __set_PRIMASK(state_); }
+#endif
+
+// AVR chips have real EEPROM. The RP2040 core emulates it in a flash sector, which has to be
+// set up with EEPROM.begin() and written back with EEPROM.commit(). The SAMD21 has neither.
+#if defined(ARDUINO_ARCH_AVR) || defined(ARDUINO_ARCH_RP2040)
+static bool nvReady() {
+#if defined(ARDUINO_ARCH_RP2040)
+  static bool started = false;
+  if (!started) {
+    EEPROM.begin(256);
+    started = true;
+  }
+#endif
+  return true;
+}
+
+bool nvRead(uint16_t address, void *data, uint16_t length) {
+  if (!nvReady() || address + length > EEPROM.length()) return false;
+  uint8_t *bytes = (uint8_t *)data;
+  for (uint16_t i = 0; i < length; i++) bytes[i] = EEPROM.read(address + i);
+  return true;
+}
+
+bool nvWrite(uint16_t address, const void *data, uint16_t length) {
+  if (!nvReady() || address + length > EEPROM.length()) return false;
+  const uint8_t *bytes = (const uint8_t *)data;
+#if defined(ARDUINO_ARCH_RP2040)
+  for (uint16_t i = 0; i < length; i++) EEPROM.write(address + i, bytes[i]);
+  return EEPROM.commit();
+#else
+  for (uint16_t i = 0; i < length; i++) EEPROM.update(address + i, bytes[i]); // only rewrites changed bytes
+  return true;
+#endif
+}
+#else
+bool nvRead(uint16_t, void *, uint16_t) { return false; }
+bool nvWrite(uint16_t, const void *, uint16_t) { return false; }
+#endif
+
+void linkBegin(uint32_t baud) {
+  HAL_LINK.begin(baud);
+}
+
+size_t linkWritable() {
+#if HAL_LINK_HAS_TX_BUFFER
+  return (size_t)HAL_LINK.availableForWrite();
+#else
+  return 64;
+#endif
+}
+
+// Native USB sends a packet every millisecond whatever is in the buffer, so only the Uno's
+// serial transmit buffer holds bytes up
+size_t linkQueued() {
+#if HAL_LINK_HAS_TX_BUFFER
+  return (size_t)(SERIAL_TX_BUFFER_SIZE - 1 - HAL_LINK.availableForWrite());
+#else
+  return 0;
+#endif
+}
+
+size_t linkWrite(const uint8_t *data, size_t length) {
+  size_t room = linkWritable();
+  if (length > room) {
+    length = room;
+  }
+  return length > 0 ? HAL_LINK.write(data, length) : 0;
+}
+
+int linkRead() {
+  return HAL_LINK.read();
+}
+
+} // namespace hal
+
+#endif
@@ -0,0 +1,155 @@
+// Checks the simulated board against what hal.h promises, so the sketch can be tried on it.
+// Run with: pio test -e native_uno
+
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "hal.h"
+#include "settings.h"
+
+namespace hal {
+namespace native {
+extern uint64_t nowUs;
+extern FILE *linkOutput;
+void runUntil(uint64_t t);
+}
+}
+
+static uint32_t tickTimes[32];
+static uint8_t ticks = 0;
+
+static void recordTick() {
+  if (ticks < 32) tickTimes[ticks] = hal::micros();
+  ticks++;
+}
+
+void setUp() {
+  ticks = 0;
+}
+
+void tearDown() {
+  hal::timerStop();
+  hal::native::linkOutput = 0;
+}
+
+// tick() comes every period, the count restarts by itself so the period never drifts
+void test_timer_period() {
+  const uint32_t PERIOD = 5000;
+  uint32_t start = hal::micros();
+  TEST_ASSERT_TRUE(hal::timerStart(PERIOD, recordTick));
+  hal::native::runUntil(hal::native::nowUs + 10 * PERIOD);
+  TEST_ASSERT_EQUAL_UINT8(10, ticks);
+  TEST_ASSERT_EQUAL_UINT32(start + PERIOD, tickTimes[0]);
+  for (uint8_t i = 1; i < 10; i++) {
+    TEST_ASSERT_EQUAL_UINT32(PERIOD, tickTimes[i] - tickTimes[i - 1]);
+  }
+}
+
+// A nudge moves only the period that is running, the ones after it are the normal length
+void test_timer_nudge() {
+  const uint32_t PERIOD = 5000;
+  uint32_t start = hal::micros();
+  hal::timerStart(PERIOD, recordTick);
+  hal::timerNudge(3000);  // 3 us
+  hal::native::runUntil(hal::native::nowUs + 3 * PERIOD);
+  TEST_ASSERT_EQUAL_UINT8(2, ticks);
+  TEST_ASSERT_EQUAL_UINT32(start + PERIOD + 3, tickTimes[0]);
+  hal::native::runUntil(hal::native::nowUs + PERIOD);
+  TEST_ASSERT_EQUAL_UINT8(3, ticks);
+  TEST_ASSERT_EQUAL_UINT32(PERIOD, tickTimes[2] - tickTimes[1]);
+}
+
+// The channels of a scan start a fixed time apart, the same every scan (#OFFSETS relies on
+// it). Only the first conversion after switching the ADC on takes longer.
+void test_adc_scan_offsets() {
+  const uint8_t channels[3] = {0, 1, 2};
+  uint16_t values[3];
+  uint16_t times[3];
+  hal::adcPower(false);
+  hal::adcPower(true);
+  hal::adcScan(channels, 3, values, times);
+  TEST_ASSERT_EQUAL_UINT16(0, times[0]);
+  TEST_ASSERT_TRUE(times[1] > HAL_ADC_CONVERSION_US);
+  for (uint8_t n = 0; n < 3; n++) {
+    hal::adcScan(channels, 3, values, times);
+    for (uint8_t i = 0; i < 3; i++) {
+      TEST_ASSERT_EQUAL_UINT16(i * HAL_ADC_CONVERSION_US, times[i]);
+      TEST_ASSERT_TRUE(values[i] <= hal::ADC_MAX);
+    }
+  }
+}
+
+// linkWrite() takes what fits and returns at once, it never waits for the link
+void test_link_write_never_blocks() {
+  FILE *out = tmpfile();
+  hal::native::linkOutput = out;
+  hal::linkBegin(115200);
+  hal::native::runUntil(hal::native::nowUs + 100000);  // let the buffer drain
+  uint8_t data[200];
+  for (uint8_t i = 0; i < sizeof(data); i++) data[i] = i;
+
+  size_t room = hal::linkWritable();
+  uint64_t before = hal::native::nowUs;
+  size_t accepted = hal::linkWrite(data, sizeof(data));
+  TEST_ASSERT_TRUE(accepted > 0);
+  TEST_ASSERT_EQUAL(room, accepted);
+  TEST_ASSERT_TRUE(hal::native::nowUs == before);
+  TEST_ASSERT_EQUAL(0, hal::linkWritable());
+
+  // With the buffer full nothing is taken, and it only waits about one byte time
+  TEST_ASSERT_EQUAL(0, hal::linkWrite(data + accepted, sizeof(data) - accepted));
+  TEST_ASSERT_TRUE(hal::native::nowUs - before <= 10000000ULL / 115200 + 1);
+
+  // Exactly the accepted bytes went out, in order
+  uint8_t sent[sizeof(data)];
+  rewind(out);
+  TEST_ASSERT_EQUAL(accepted, fread(sent, 1, sizeof(sent), out));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(data, sent, accepted);
+  fclose(out);
+}
+
+void test_nv_round_trip() {
+  const uint8_t data[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+  uint8_t back[16] = {0};
+  TEST_ASSERT_TRUE(hal::nvWrite(100, data, sizeof(data)));
+  TEST_ASSERT_TRUE(hal::nvRead(100, back, sizeof(back)));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(data, back, sizeof(data));
+  TEST_ASSERT_FALSE(hal::nvRead(0xFFF0, back, sizeof(back)));
+  TEST_ASSERT_FALSE(hal::nvWrite(0xFFF0, data, sizeof(data)));
+}
+
+// settings.h keeps a block that is only used with the same version and a matching CRC
+struct TestSettings {
+  uint16_t period;
+  uint8_t channels[4];
+};
+
+void test_settings_round_trip() {
+  TestSettings saved = {250, {0, 1, 2, 3}};
+  TestSettings loaded = {0, {0, 0, 0, 0}};
+  TEST_ASSERT_TRUE(settingsSave(saved, 7));
+  TEST_ASSERT_FALSE(settingsLoad(loaded, 8));
+  TEST_ASSERT_EQUAL_UINT16(0, loaded.period);
+  TEST_ASSERT_TRUE(settingsLoad(loaded, 7));
+  TEST_ASSERT_EQUAL_UINT16(250, loaded.period);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(saved.channels, loaded.channels, 4);
+
+  // A damaged block is ignored
+  uint8_t byte;
+  hal::nvRead(sizeof(SettingsHeader), &byte, 1);
+  byte ^= 0x01;
+  hal::nvWrite(sizeof(SettingsHeader), &byte, 1);
+  TEST_ASSERT_FALSE(settingsLoad(loaded, 7));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_timer_period);
+  RUN_TEST(test_timer_nudge);
+  RUN_TEST(test_adc_scan_offsets);
+  RUN_TEST(test_link_write_never_blocks);
+  RUN_TEST(test_nv_round_trip);
+  RUN_TEST(test_settings_round_trip);
+  return UNITY_END();
+}
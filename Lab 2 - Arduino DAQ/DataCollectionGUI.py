@@ -8,6 +8,42 @@ Key Features:
 - Set the data collection time and sampling period
 - View incoming serial data in real-time
 - Save the collected data as a CSV file for analysis
+- Lines that start with # are stream metadata (for example raw bursts from the summary mode).
+  They don't count as samples and are saved next to the data in a separate _meta.csv file
+- Deadband streams (the Arduino only sends channels that changed) and multi-rate streams
+  (slow channels are only read every few samples) are filled back in to a full
+  sample-and-hold timeline when they are saved
+- Adaptive rate streams (marked with #RATE lines) are counted by the time they cover, since
+  the Arduino prints fewer lines while the signals are quiet
+- The Arduino reads its channels one after the other, so each channel is sampled a little
+  later than the time stamp (it reports how much later in an #OFFSETS line). The data is then
+  also saved shifted back to the time stamp in a separate _aligned.csv file, so phase and
+  cross-channel comparisons aren't biased by the delay
+- External events (a switch or trigger on the Arduino's capture pin, sent as #EVENT lines)
+  are also saved in a separate _events.csv file, with their exact time to the microsecond
+- Equivalent-time streams (the DAQ sketch's MODE_ETS, marked with #ETS lines) hold one period
+  of a fast repetitive signal per record, as offset and value. The records are also saved
+  side by side in a separate _ets.csv file, one column per record
+- Sync pulses shared between boards (#SYNC lines, see SYNC_ROLE in the DAQ sketch and
+  USE_SYNC in the strain sketch) are saved in a separate _sync.csv file. Pulses with the same
+  index happened at the same moment, so they line up the files of boards that recorded the
+  same test to within microseconds
+- Alarms (lines starting with !, sent the moment a channel crosses a limit or a sensor fails)
+  are shown in the status bar with a beep as soon as they arrive, without waiting for the
+  data around them. They are saved in a separate _alarms.csv file with how long they took on
+  the Arduino and until they were on the screen
+- Collection survives a USB glitch or the computer going to sleep: the GUI sends the Arduino a
+  heartbeat, and while it doesn't hear it the Arduino keeps its data. The GUI waits for the
+  port to come back, and the data the Arduino kept (#BACKLOG lines) is merged back in by time
+- When the Arduino sketch uses the reliable link (RELIABLE_LINK) the data arrives in numbered
+  blocks with a checksum. Damaged or missing blocks are asked for again, so the saved data is
+  exactly what the Arduino sent; a block that can't be recovered leaves a #GAP line instead
+- The serial port is read by a separate process, which also sends the heartbeat and asks for
+  damaged blocks again. It hands the lines to the window through shared memory, so a busy
+  window (redrawing, saving, garbage collection) never holds up the reading
+- Link Test measures the serial link when the Arduino runs the link test mode: bytes per
+  second that really get through, wrong bytes, lost frames and how long frames take to
+  arrive. Each run is added to link_tests.csv
 
 Usage:
 1. Connect your Arduino via USB
@@ -26,9 +62,649 @@ import serial.tools.list_ports
 import time
 import csv
 import threading
+import multiprocessing
+from multiprocessing import shared_memory
+import queue
 import os
+import math
 from datetime import datetime
 import string
+import struct
+import binascii
+
+
+def row_time(line):
+    """Return the time (first field) of a data line, or None for headers and warnings"""
+    try:
+        return float(line.split(',', 1)[0])
+    except ValueError:
+        return None
+
+
+def merge_row(lines, row):
+    """Insert a data line that arrives late in time order. Returns False if a line with the
+    same time stamp is already there (the Arduino may send again what already got through)."""
+    t = row_time(row)
+    if t is None:
+        return False
+    i = len(lines)
+    while i > 0:
+        u = row_time(lines[i - 1])
+        if u is not None and u <= t:
+            if u == t:
+                return False
+            break
+        if u is None and i == 1:
+            break  # the header
+        i -= 1
+    lines.insert(i, row)
+    return True
+
+
+def fill_sample_and_hold(lines, period_ms):
+    """Rebuild the full timeline of a deadband stream.
+
+    In a deadband stream the Arduino leaves a field empty when that channel hasn't changed,
+    and skips the whole line when nothing changed. This fills every empty field with the last
+    value received for that channel, and adds the skipped lines (holding the previous values)
+    at every sample period in between. Headers and warnings are passed through unchanged.
+    """
+    result = []
+    held = None
+    last_time = None
+    for line in lines:
+        t = row_time(line)
+        if t is None:
+            result.append(line)
+            continue
+        fields = line.split(',')
+        values = fields[1:]
+        if held is not None:
+            values = [v if v != '' else h for v, h in zip(values, held)] + values[len(held):]
+            # Add the skipped sample times, holding the previous values
+            t_fill = last_time + period_ms
+            while t_fill < t - period_ms / 2:
+                result.append(','.join([f"{t_fill:g}"] + held))
+                t_fill += period_ms
+        held = values
+        last_time = t
+        result.append(','.join([fields[0]] + values))
+    return result
+
+
+def fractional_delay(values, shift):
+    """Value of an evenly sampled signal shift samples later than each sample (shift may be a fraction).
+
+    Uses 4-point (cubic) Lagrange interpolation between the neighbouring samples. At the ends
+    of the record the first or last sample is repeated.
+    """
+    n = len(values)
+    result = []
+    for i in range(n):
+        x = i + shift
+        k = math.floor(x)
+        f = x - k
+        p = [values[min(max(k + j, 0), n - 1)] for j in (-1, 0, 1, 2)]
+        result.append(-f * (f - 1) * (f - 2) / 6 * p[0] + (f + 1) * (f - 1) * (f - 2) / 2 * p[1]
+                      - (f + 1) * f * (f - 2) / 2 * p[2] + (f + 1) * f * (f - 1) / 6 * p[3])
+    return result
+
+
+def align_channels(lines, offsets_us):
+    """Shift every channel back to the time stamp of its line.
+
+    offsets_us[c] is how many microseconds after the time stamp channel c was sampled (the
+    #OFFSETS line). The lines must be evenly spaced in time, so use it on normal streams and
+    on filled-in deadband streams, not on adaptive rate streams. Headers and warnings are
+    passed through unchanged.
+    """
+    rows = [(i, line.split(',')) for i, line in enumerate(lines) if row_time(line) is not None]
+    if len(rows) < 2:
+        return list(lines)
+    times = [float(fields[0]) for _, fields in rows]
+    steps = sorted(b - a for a, b in zip(times, times[1:]))
+    period_us = steps[len(steps) // 2] * 1000
+    if period_us <= 0:
+        return list(lines)
+    columns = []
+    for c, offset in enumerate(offsets_us):
+        try:
+            values = [float(fields[1 + c]) for _, fields in rows]
+        except (ValueError, IndexError):
+            return list(lines)
+        columns.append(fractional_delay(values, -offset / period_us))
+    result = list(lines)
+    for r, (i, fields) in enumerate(rows):
+        values = [f"{column[r]:.2f}" for column in columns]
+        result[i] = ','.join([fields[0]] + values + fields[1 + len(columns):])
+    return result
+
+
+# The GUI sends "hb" this often while it collects, so the Arduino knows someone is listening
+HEARTBEAT_INTERVAL = 0.25  # seconds
+
+LINKTEST_SYNC = b'\xa5\x5a'
+LINKTEST_HEADER = 12
+
+# Reliable link blocks (see reliable.h in the Arduino sketch)
+RELIABLE_SYNC = b'\xa5\x5a'
+RELIABLE_HEADER = 6
+# Well inside the time a block stays in the Arduino's window (8 blocks, about 40 ms at
+# 115200 baud), so a nack that gets lost is asked again before the block is gone
+RELIABLE_NACK_INTERVAL = 0.01  # seconds before asking for the same block again
+RELIABLE_GAP_TIMEOUT = 1.0     # seconds before a missing block is given up
+RELIABLE_RESEND_AGE = 64       # blocks; a resend is never older than the Arduino's window
+RELIABLE_LOSS_MAX = 1024       # blocks; more lost at once can only be a reset board
+
+# Lines from the reader process to the window (see LineRing)
+RING_BYTES = 4 * 1024 * 1024  # about 6 minutes of a full 115200 baud link
+READER_POLL = 0.001           # seconds the reader waits when nothing has come
+
+
+def event_rows(meta_lines):
+    """The #EVENT lines as rows of time (ms), edge, scan time (ms) and offset (us).
+
+    Each event comes with the time stamp of the scan it happened in and how many microseconds
+    after that time stamp it happened, so its time is the two added together.
+    """
+    rows = []
+    for line in meta_lines:
+        fields = line.split(',')
+        if fields[0] != '#EVENT' or len(fields) < 4:
+            continue
+        try:
+            scan_ms = float(fields[1])
+            offset_us = float(fields[2])
+        except ValueError:
+            continue
+        rows.append([f"{scan_ms + offset_us / 1000:.3f}", fields[3], fields[1], fields[2]])
+    return rows
+
+
+def sync_rows(meta_lines):
+    """The #SYNC lines as rows of pulse index, time, scan time and offset (us).
+
+    The DAQ sketch sends the time stamp of the scan the pulse came in (ms) and how many
+    microseconds after it the pulse came, like an event. The strain sketch sends the time in
+    the microseconds of its own time column, without an offset. Time is in the stream's own
+    unit either way, so the pulses map one board's time onto another's.
+    """
+    rows = []
+    for line in meta_lines:
+        fields = line.split(',')
+        if fields[0] != '#SYNC' or len(fields) < 3:
+            continue
+        try:
+            time = float(fields[2])
+            offset_us = float(fields[3]) if len(fields) > 3 else None
+        except ValueError:
+            continue
+        if offset_us is None:
+            rows.append([fields[1], fields[2], "", ""])
+        else:
+            rows.append([fields[1], f"{time + offset_us / 1000:.3f}", fields[2], fields[3]])
+    return rows
+
+
+def ets_records(lines):
+    """The records of an equivalent-time stream as rows of offset (us) and one value per record.
+
+    Every record starts again at offset 0. Records that were cut off (at the end of the
+    collection, or points lost to a USB glitch) are left empty where they have no point.
+    """
+    records = []
+    last = None
+    for line in lines:
+        fields = line.split(',')
+        try:
+            offset = float(fields[0])
+        except ValueError:
+            continue
+        if last is None or offset <= last:
+            records.append({})
+        records[-1][fields[0]] = fields[1] if len(fields) > 1 else ""
+        last = offset
+    offsets = sorted({o for r in records for o in r}, key=float)
+    return [[o] + [r.get(o, "") for r in records] for o in offsets]
+
+
+def alarm_rows(alarms):
+    """The !ALARM lines as rows of time, channel, state, value and the two latencies.
+
+    alarms holds [line, received, display_ms] for every alarm, display_ms being how long it
+    took from arriving to being on the screen. The Arduino adds how long the alarm took from
+    the fault to its last byte leaving the board (us).
+    """
+    rows = []
+    for line, received, display_ms in alarms:
+        fields = line.split(',')
+        if fields[0] != '!ALARM' or len(fields) < 6:
+            continue
+        shown = f"{display_ms:.1f}" if display_ms is not None else ""
+        rows.append(fields[1:6] + [shown])
+    return rows
+
+
+def linktest_payload(sequence, length):
+    """The test pattern the Arduino puts in a frame (same generator as linktest.h)"""
+    x = (sequence ^ (sequence >> 16) ^ 0xACE1) & 0xFFFF
+    if x == 0:
+        x = 1
+    payload = bytearray(length)
+    for i in range(length):
+        x ^= (x << 7) & 0xFFFF
+        x ^= x >> 9
+        x ^= (x << 8) & 0xFFFF
+        payload[i] = x & 0xFF
+    return bytes(payload)
+
+
+class LinkTestAnalyzer:
+    """Checks the frames of the link test mode as they arrive.
+
+    Frames are found by their A5 5A start bytes. The payload is compared byte by byte with the
+    pattern the Arduino should have sent, gaps in the sequence numbers are lost frames, and
+    the latency is the time a frame arrived minus the time the Arduino built it. The two
+    clocks aren't synchronised, so latency is measured from the fastest frame: it shows how
+    much longer than the best case frames take, which is what buffering and USB add.
+    """
+
+    def __init__(self, frame_size):
+        self.frame_size = frame_size
+        self.buffer = bytearray()
+        self.frames = 0
+        self.payload_bytes = 0
+        self.byte_errors = 0
+        self.lost_frames = 0
+        self.resyncs = 0
+        self.last_sequence = None
+        self.delays = []
+        self.first_time = None
+        self.last_time = None
+        self.received = 0
+
+    def feed(self, data, host_time):
+        """Add bytes read from the port at host_time (seconds)"""
+        if self.first_time is None:
+            self.first_time = host_time
+        self.last_time = host_time
+        self.received += len(data)
+        self.buffer += data
+        while True:
+            start = self.buffer.find(LINKTEST_SYNC)
+            if start < 0:
+                # Keep a last A5 in case the 5A is still on its way
+                del self.buffer[:max(0, len(self.buffer) - 1)]
+                return
+            if start > 0:
+                self.resyncs += 1
+                del self.buffer[:start]
+            # Wait for the start of the next frame too: if it isn't right behind this one,
+            # bytes went missing and the frame is counted as lost instead of full of errors
+            if len(self.buffer) < self.frame_size + 2:
+                return
+            length, sequence, device_us = struct.unpack_from('<HII', self.buffer, 2)
+            if length != self.frame_size or self.buffer[length:length + 2] != LINKTEST_SYNC:
+                # Not a real start of frame, a damaged header or a short frame: look for the next one
+                self.resyncs += 1
+                del self.buffer[:2]
+                continue
+            frame = bytes(self.buffer[:length])
+            del self.buffer[:length]
+            self.check(frame, sequence, device_us, host_time)
+
+    def check(self, frame, sequence, device_us, host_time):
+        if self.last_sequence is not None:
+            gap = (sequence - self.last_sequence - 1) & 0xFFFFFFFF
+            if gap < 0x80000000:
+                self.lost_frames += gap
+        self.last_sequence = sequence
+        expected = linktest_payload(sequence, len(frame) - LINKTEST_HEADER)
+        self.byte_errors += sum(1 for a, b in zip(frame[LINKTEST_HEADER:], expected) if a != b)
+        self.payload_bytes += len(expected)
+        self.frames += 1
+        self.delays.append(host_time - device_us / 1e6)
+
+    def results(self):
+        """Summary of the run as a dict"""
+        elapsed = (self.last_time - self.first_time) if self.frames else 0
+        sent = self.frames + self.lost_frames
+        latency = {}
+        if self.delays:
+            best = min(self.delays)
+            delays = sorted((d - best) * 1000 for d in self.delays)
+            for name, q in (('p50', 0.50), ('p95', 0.95), ('p99', 0.99)):
+                latency[name] = delays[min(len(delays) - 1, int(q * len(delays)))]
+            latency['max'] = delays[-1]
+        return {
+            'seconds': elapsed,
+            'bytes_per_s': self.received / elapsed if elapsed > 0 else 0,
+            'frames': self.frames,
+            'lost_frames': self.lost_frames,
+            'drop_rate': self.lost_frames / sent if sent else 0,
+            'byte_errors': self.byte_errors,
+            'byte_error_rate': self.byte_errors / self.payload_bytes if self.payload_bytes else 0,
+            'resyncs': self.resyncs,
+            'latency_ms': latency,
+        }
+
+
+class ReliableReceiver:
+    """Puts the text stream of the reliable link back together.
+
+    Blocks are found by their A5 5A start bytes and dropped if their CRC is wrong. A block
+    that doesn't turn up (dropped, or lost on the way) is asked for again with "nack N" until
+    it arrives, the Arduino answers that it has left its window, or RELIABLE_GAP_TIMEOUT
+    passes. Then a #GAP line takes its place, and the line the gap cut in half is left out,
+    so a damaged line never looks like a real one.
+
+    When the Arduino is reset its sequence numbers start again at 0. Its start block says so,
+    and if that gets lost a jump further back than a resend or further ahead than a real loss
+    does; the receiver then drops what it was waiting for and adds a #RESTART line.
+    """
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.text = bytearray()
+        self.expected = None       # next block to hand on
+        self.blocks = {}           # arrived ahead of a missing one (None = given up)
+        self.missing = {}          # sequence -> [time first missed, time last asked for]
+        self.skip_partial = False  # after a gap: drop the bytes up to the next line end
+        self.received = 0
+        self.crc_errors = 0
+        self.nacks = 0
+        self.gaps = 0
+
+    def feed(self, data, now):
+        """Add bytes read from the port at now (seconds), returns the complete lines"""
+        self.buffer += data
+        while True:
+            start = self.buffer.find(RELIABLE_SYNC)
+            if start < 0:
+                # Keep a last A5 in case the 5A is still on its way
+                del self.buffer[:max(0, len(self.buffer) - 1)]
+                break
+            del self.buffer[:start]
+            if len(self.buffer) < RELIABLE_HEADER:
+                break
+            kind, sequence, length = struct.unpack_from('<cHB', self.buffer, 2)
+            size = RELIABLE_HEADER + length + 2
+            if len(self.buffer) < size:
+                break
+            crc, = struct.unpack_from('<H', self.buffer, size - 2)
+            if kind not in (b'D', b'G', b'S') or binascii.crc_hqx(bytes(self.buffer[2:size - 2]), 0xFFFF) != crc:
+                # Damaged, or not a real start of block: look for the next one
+                self.crc_errors += 1
+                del self.buffer[:2]
+                continue
+            payload = bytes(self.buffer[RELIABLE_HEADER:size - 2])
+            del self.buffer[:size]
+            self.block(kind, sequence, payload, now)
+        return self.lines()
+
+    def block(self, kind, sequence, payload, now):
+        if kind == b'S':
+            self.restart(0)
+            return
+        if self.expected is None:
+            self.expected = sequence
+        ahead = (sequence - self.expected) & 0xFFFF
+        behind = (self.expected - sequence) & 0xFFFF
+        if RELIABLE_RESEND_AGE < behind < 0x8000 or RELIABLE_LOSS_MAX < ahead < 0x8000:
+            # The start block got lost. The blocks before this one are asked for like any others.
+            self.restart(0 if sequence <= RELIABLE_LOSS_MAX else sequence)
+        elif 0 < behind < 0x8000:
+            return  # handed on already, a resend that crossed the original
+        self.received += 1
+        self.blocks[sequence] = payload if kind == b'D' else None
+        self.missing.pop(sequence, None)
+        # Every block between the ones handed on and this one that isn't here is missing
+        s = self.expected
+        while s != sequence:
+            if s not in self.blocks and s not in self.missing:
+                self.missing[s] = [now, 0]
+            s = (s + 1) & 0xFFFF
+        self.deliver()
+
+    def restart(self, sequence):
+        """The Arduino was reset, its blocks start again at sequence"""
+        if self.expected is not None:
+            del self.text[self.text.rfind(b'\n') + 1:]  # the line the reset cut off
+            self.text += f"#RESTART,{self.expected}\r\n".encode()
+        self.expected = sequence
+        self.blocks.clear()
+        self.missing.clear()
+        self.skip_partial = False
+
+    def requests(self, now):
+        """Sequence numbers to ask for again now. Gives up on the ones missing too long."""
+        asks = []
+        for sequence, times in list(self.missing.items()):
+            if now - times[0] > RELIABLE_GAP_TIMEOUT:
+                del self.missing[sequence]
+                self.blocks[sequence] = None
+            elif now - times[1] >= RELIABLE_NACK_INTERVAL:
+                times[1] = now
+                asks.append(sequence)
+                self.nacks += 1
+        self.deliver()
+        return asks
+
+    def deliver(self):
+        """Hand on the blocks that are next in line"""
+        while self.expected in self.blocks:
+            payload = self.blocks.pop(self.expected)
+            if payload is None:
+                # The line the gap cut in half can't be trusted, leave it out
+                del self.text[self.text.rfind(b'\n') + 1:]
+                self.text += f"#GAP,{self.expected}\r\n".encode()
+                self.skip_partial = True
+                self.gaps += 1
+            else:
+                if self.skip_partial:
+                    end = payload.find(b'\n')
+                    self.skip_partial = end < 0
+                    payload = payload[end + 1:] if end >= 0 else b''
+                self.text += payload
+            self.expected = (self.expected + 1) & 0xFFFF
+
+    def lines(self):
+        end = self.text.rfind(b'\n')
+        if end < 0:
+            return []
+        chunk = bytes(self.text[:end + 1])
+        del self.text[:end + 1]
+        return [line.strip() for line in chunk.decode('utf-8', errors='replace').split('\n')[:-1]]
+
+
+class LineRing:
+    """Lines from the reader process to the window, through a ring buffer in shared memory.
+
+    One process writes and the other reads. Each record is the time the line arrived
+    (time.monotonic(), the same clock in both processes), its length and the line itself.
+    The header holds the bytes written and read so far and the ring's size. Each side only
+    moves its own count, after the bytes it covers, so no lock is needed.
+    """
+
+    HEADER = struct.Struct('<QQQ')  # written, read, size
+    RECORD = struct.Struct('<dI')   # arrival time, length
+
+    def __init__(self, name=None, size=RING_BYTES):
+        if name is None:
+            self.shm = shared_memory.SharedMemory(create=True, size=self.HEADER.size + size)
+            self.HEADER.pack_into(self.shm.buf, 0, 0, 0, size)
+        else:
+            self.shm = shared_memory.SharedMemory(name=name)
+        self.name = self.shm.name
+        self.size = self.HEADER.unpack_from(self.shm.buf, 0)[2]  # the segment can be rounded up
+
+    def write(self, line, received):
+        """Reader side: adds a line, False if the window hasn't made room for it yet"""
+        data = line.encode('utf-8')
+        record = self.RECORD.pack(received, len(data)) + data
+        written, read, _ = self.HEADER.unpack_from(self.shm.buf, 0)
+        if written + len(record) - read > self.size:
+            return False
+        start = written % self.size
+        first = min(len(record), self.size - start)
+        base = self.HEADER.size
+        self.shm.buf[base + start:base + start + first] = record[:first]
+        self.shm.buf[base:base + len(record) - first] = record[first:]
+        struct.pack_into('<Q', self.shm.buf, 0, written + len(record))
+        return True
+
+    def read(self):
+        """Window side: takes every line that has come, as (line, received) pairs"""
+        written, read, _ = self.HEADER.unpack_from(self.shm.buf, 0)
+        if written == read:
+            return []
+        start = read % self.size
+        length = written - read
+        first = min(length, self.size - start)
+        base = self.HEADER.size
+        data = bytes(self.shm.buf[base + start:base + start + first]) + bytes(self.shm.buf[base:base + length - first])
+        struct.pack_into('<Q', self.shm.buf, 8, written)
+        lines = []
+        at = 0
+        while at < len(data):
+            received, size = self.RECORD.unpack_from(data, at)
+            at += self.RECORD.size
+            lines.append((data[at:at + size].decode('utf-8'), received))
+            at += size
+        return lines
+
+    def close(self, unlink=False):
+        self.shm.close()
+        if unlink:
+            self.shm.unlink()
+
+
+class SerialReader:
+    """The reading side of a collection, in its own process (see reader_main).
+
+    Reads the port, puts the lines back together, answers the Arduino with the heartbeat and
+    the reliable link's resend requests, and waits for the port to come back after a USB
+    glitch, all without waiting for the window. Messages for the window go on status as
+    (kind, text): 'status' for the status bar, 'error' when reading failed, 'meta' for a line
+    to keep with the metadata, and 'done' at the end.
+    """
+
+    def __init__(self, serial_port, baud_rate, ring, stop, status):
+        self.serial_port = serial_port
+        self.baud_rate = baud_rate
+        self.ring = ring
+        self.stop = stop
+        self.status = status
+        self.ser = None
+        self.receiver = None  # ReliableReceiver when the Arduino uses the reliable link
+
+    def run(self):
+        try:
+            self.ser = serial.Serial(self.serial_port, self.baud_rate, timeout=1)
+        except Exception as e:
+            self.status.put(('error', f"Could not open serial port: {str(e)}"))
+            self.status.put(('done', ''))
+            return
+        try:
+            self.status.put(('status', "Connection established. Waiting for data..."))
+            heard = False  # no heartbeat before the first line, the Uno may still be resetting
+            last_heartbeat = 0
+            while not self.stop.is_set():
+                try:
+                    current_time = time.time()
+                    if heard and current_time - last_heartbeat >= HEARTBEAT_INTERVAL:
+                        self.ser.write(b"hb\n")
+                        last_heartbeat = current_time
+                    # Read whatever has come, so an alarm isn't left waiting for the next sample
+                    if self.ser.in_waiting > 0:
+                        received = time.monotonic()
+                        for line in self.read_lines():
+                            if line:
+                                heard = True
+                                self.put(line, received)
+                    else:
+                        time.sleep(READER_POLL)
+                except (serial.SerialException, OSError):
+                    # The port went away (USB glitch, sleep). The Arduino keeps its data meanwhile.
+                    if not self.reconnect():
+                        break
+            if self.receiver:
+                # How much the reliable link had to repair, saved with the metadata
+                r = self.receiver
+                self.status.put(('meta', f"#RELIABLE,{r.received},{r.crc_errors},{r.nacks},{r.gaps}"))
+        except Exception as e:
+            self.status.put(('error', str(e)))
+        finally:
+            if self.ser:
+                self.ser.close()
+                self.ser = None
+            self.status.put(('done', ''))
+
+    def put(self, line, received):
+        """Hands a line to the window. If it is far behind, waits for room, the port's own
+        buffer and the Arduino's backlog hold the data meanwhile."""
+        while not self.ring.write(line, received):
+            if self.stop.is_set():
+                return
+            time.sleep(0.01)
+
+    def read_lines(self):
+        """Lines that arrived, in order.
+
+        Plain text is read a line at a time. Reliable link blocks (recognised by their start
+        bytes) are checked and put back in order first, and missing ones asked for again.
+        """
+        if self.receiver is None:
+            raw = self.ser.readline()
+            if RELIABLE_SYNC not in raw:
+                return [raw.decode('utf-8', errors='replace').strip()]
+            self.receiver = ReliableReceiver()
+        else:
+            raw = self.ser.read(self.ser.in_waiting)
+        now = time.monotonic()
+        lines = self.receiver.feed(raw, now)
+        for sequence in self.receiver.requests(now):
+            self.ser.write(f"nack {sequence}\n".encode())
+        return lines
+
+    def reconnect(self):
+        """Wait until the serial port can be opened again after it went away.
+
+        The port is opened with DTR low, so an Uno doesn't reset and lose the data it kept
+        (on some Linux systems it resets anyway). Returns False if collection was stopped.
+        """
+        if self.ser:
+            try:
+                self.ser.close()
+            except (serial.SerialException, OSError):
+                pass
+            self.ser = None
+        self.status.put(('status', "Connection lost - waiting for the Arduino to come back..."))
+        while not self.stop.is_set():
+            time.sleep(1)
+            ser = serial.Serial()
+            ser.port = self.serial_port
+            ser.baudrate = self.baud_rate
+            ser.timeout = 1
+            ser.dtr = False
+            try:
+                ser.open()
+            except (serial.SerialException, OSError):
+                continue
+            self.ser = ser
+            self.status.put(('status', "Connection back. Collecting data..."))
+            return True
+        return False
+
+
+def reader_main(serial_port, baud_rate, ring_name, stop, status):
+    """Entry point of the reader process"""
+    ring = LineRing(ring_name)
+    try:
+        SerialReader(serial_port, baud_rate, ring, stop, status).run()
+    finally:
+        ring.close()
+
 
 class SerialDataCollector:
     def __init__(self, root):
@@ -39,7 +715,11 @@ class SerialDataCollector:
         # Variables
         self.is_collecting = False
         self.data_list = []
-        self.ser = None
+        self.meta_list = []  # Metadata lines (starting with #) from the stream
+        self.alarms = []  # [line, received, display_ms] of every alarm (starting with !)
+        self.hold_period_ms = None  # Sample period of a deadband stream, None for normal streams
+        self.count_period_ms = None  # Count samples by time at this period instead of by lines
+        self.offsets_us = None  # When each channel is sampled after the time stamp (#OFFSETS)
         self.display_line_count = 0  # Track lines in display
         self.max_display_lines = 1000  # Maximum lines to show
         
@@ -96,7 +776,7 @@ class SerialDataCollector:
         # Baud Rate row
         ttk.Label(conn_frame, text="Baud Rate:").grid(row=1, column=0, sticky=tk.W)
         self.baud_rate_var = tk.StringVar(value="115200")
-        baud_rates = ["9600", "19200", "38400", "57600", "115200"]
+        baud_rates = ["9600", "19200", "38400", "57600", "115200", "230400", "250000", "500000", "1000000", "2000000"]
         self.baud_rate_combo = ttk.Combobox(conn_frame, textvariable=self.baud_rate_var, values=baud_rates, state="readonly", width=15)
         self.baud_rate_combo.grid(row=1, column=1, sticky=tk.W)
         
@@ -140,6 +820,9 @@ class SerialDataCollector:
         self.stop_button = ttk.Button(button_frame, text="Stop", command=self.stop_collection, state=tk.DISABLED)
         self.stop_button.pack(side=tk.LEFT)
         
+        self.link_test_button = ttk.Button(button_frame, text="Link Test", command=self.start_link_test)
+        self.link_test_button.pack(side=tk.LEFT, padx=(15,0))
+        
         # === PROGRESS SECTION ===
         progress_frame = ttk.Frame(main_frame)
         progress_frame.grid(row=2, column=0, columnspan=2, sticky="we", pady=(0,10))
@@ -219,6 +902,11 @@ class SerialDataCollector:
                 
             # Reset data
             self.data_list = []
+            self.meta_list = []
+            self.alarms = []
+            self.hold_period_ms = None
+            self.count_period_ms = None
+            self.offsets_us = None
             self.data_text.delete(1.0, tk.END)
             self.display_line_count = 0  # Reset display counter
             self.progress.config(maximum=target_samples, value=0)  # Use target_samples for display
@@ -246,34 +934,43 @@ class SerialDataCollector:
             self.status_var.set("Error starting collection")
     
     def collect_data(self, serial_port, baud_rate, num_samples, sampling_period, target_samples):
-        """Serial collection logic with connection and data timeout error handling"""
+        """Serial collection logic with connection and data timeout error handling.
+
+        The port itself is read by the reader process (see SerialReader), this thread only
+        sorts the lines it hands over.
+        """
+        # A fresh interpreter rather than a fork of the one running Tk
+        context = multiprocessing.get_context('spawn')
+        ring = LineRing()
+        stop = context.Event()
+        status = context.Queue()
+        reader = context.Process(target=reader_main,
+                                 args=(serial_port, baud_rate, ring.name, stop, status))
+        reader.daemon = True
         try:
             self.root.after(0, lambda: self.status_var.set("Establishing connection..."))
-            try:
-                self.ser = serial.Serial(serial_port, baud_rate, timeout=1)
-            except Exception as e:
-                self.root.after(0, lambda: messagebox.showerror("Serial Error", f"Could not open serial port: {str(e)}"))
-                self.root.after(0, lambda: self.status_var.set(f"Error: Could not open serial port"))
-                self.root.after(0, lambda: self.start_button.config(state=tk.NORMAL))
-                self.root.after(0, lambda: self.stop_button.config(state=tk.DISABLED))
-                return
-
-            self.root.after(0, lambda: self.status_var.set("Connection established. Waiting for data..."))
+            reader.start()
 
             # Data timeout logic: wait up to 5 seconds for first data
             data_timeout = 5  # seconds
             start_time = time.monotonic()
             first_line = None
-            while time.monotonic() - start_time < data_timeout and self.is_collecting:
-                if self.ser.in_waiting > 0:
-                    line = self.ser.readline().decode('utf-8', errors='replace').strip()
-                    if line:
-                        first_line = line
-                        break
+            more_lines = []
+            reader_done = False
+            while time.monotonic() - start_time < data_timeout and self.is_collecting and not reader_done:
+                error, reader_done = self.reader_messages(status)
+                if error:
+                    self.root.after(0, lambda: messagebox.showerror("Serial Error", error))
+                    self.root.after(0, lambda: self.status_var.set(f"Error: Could not open serial port"))
+                    self.root.after(0, lambda: self.start_button.config(state=tk.NORMAL))
+                    self.root.after(0, lambda: self.stop_button.config(state=tk.DISABLED))
+                    return
+                lines = ring.read()
+                if lines:
+                    first_line, more_lines = lines[0][0], lines[1:]
+                    break
                 time.sleep(0.01)
             if not first_line:
-                self.ser.close()
-                self.ser = None
                 self.root.after(0, lambda: messagebox.showerror("No Data", "Error, no incoming data, check port or Arduino code"))
                 self.root.after(0, lambda: self.status_var.set("Error: No incoming data from device"))
                 self.root.after(0, lambda: self.start_button.config(state=tk.NORMAL))
@@ -285,40 +982,219 @@ class SerialDataCollector:
             self.root.after(0, lambda: self.status_var.set("Connection established. Collecting data..."))
             self.root.after(0, lambda: self.update_progress(1, target_samples))
             self.root.after(0, lambda: self.display_new_data(first_line))
+            for line, received in more_lines:
+                self.handle_line(line, sampling_period, target_samples, received)
 
-            sampling_period_sec = sampling_period / 1000.0
-            last_sample_time = time.time()
+            while self.collected_samples() < num_samples and self.is_collecting and not reader_done:
+                error, reader_done = self.reader_messages(status)
+                if error:
+                    raise RuntimeError(error)
+                for line, received in ring.read():
+                    self.handle_line(line, sampling_period, target_samples, received)
+                    if self.collected_samples() >= num_samples:
+                        break
+                time.sleep(0.01)
 
-            while len(self.data_list) < num_samples and self.is_collecting:
-                current_time = time.time()
-                if current_time - last_sample_time >= sampling_period_sec:
-                    if self.ser.in_waiting > 0:
-                        line = self.ser.readline().decode('utf-8', errors='replace').strip()
-                        if line:
-                            self.data_list.append(line)
-                            last_sample_time = current_time
-                            current_count = min(len(self.data_list), target_samples)
-                            self.root.after(0, lambda: self.update_progress(current_count, target_samples))
-                            self.root.after(0, lambda: self.display_new_data(line))
-                time.sleep(0.001)
-
-            self.ser.close()
-            self.ser = None
+            # The reader sends the reliable link's statistics as it finishes
+            stop.set()
+            reader.join(5)
+            self.reader_messages(status)
 
-            if len(self.data_list) >= num_samples:
+            if self.collected_samples() >= num_samples:
                 self.root.after(0, lambda: self.collection_complete(target_samples))
             else:
                 self.root.after(0, lambda: self.collection_stopped(target_samples))
 
         except Exception as e:
-            if self.ser:
-                self.ser.close()
-                self.ser = None
             self.root.after(0, lambda: messagebox.showerror("Serial Error", f"Error: {str(e)}"))
             self.root.after(0, lambda: self.status_var.set(f"Error: {str(e)}"))
             self.root.after(0, lambda: self.start_button.config(state=tk.NORMAL))
             self.root.after(0, lambda: self.stop_button.config(state=tk.DISABLED))
-    
+        finally:
+            stop.set()
+            if reader.is_alive():
+                reader.join(2)
+            ring.close(unlink=True)
+
+    def reader_messages(self, status):
+        """Act on the reader process's messages. Returns the error if there was one, and
+        whether the reader has finished."""
+        error = None
+        done = False
+        try:
+            while True:
+                kind, text = status.get_nowait()
+                if kind == 'status':
+                    self.root.after(0, lambda t=text: self.status_var.set(t))
+                elif kind == 'meta':
+                    self.meta_list.append(text)
+                elif kind == 'error':
+                    error = text
+                elif kind == 'done':
+                    done = True
+        except queue.Empty:
+            pass
+        return error, done
+
+    def handle_line(self, line, sampling_period, target_samples, received=None):
+        """Sort one received line into the data or the metadata. Returns True for data.
+
+        received is when the reader process got it (time.monotonic()), for the alarms.
+        """
+        if line.startswith('#BACKLOG,'):
+            # A line the Arduino kept while we were gone: "#BACKLOG,seq,line"
+            row = line.split(',', 2)[2] if line.count(',') >= 2 else ''
+            if row.startswith('!'):
+                if row not in self.meta_list:
+                    self.alarm(row, received)
+            elif row.startswith('#'):
+                if row not in self.meta_list:
+                    self.meta_list.append(row)
+            elif merge_row(self.data_list, row):
+                current_count = min(self.collected_samples(), target_samples)
+                self.root.after(0, lambda: self.update_progress(current_count, target_samples))
+            self.root.after(0, lambda l=line: self.display_new_data(l))
+        elif line.startswith('!'):
+            self.alarm(line, received)
+        elif line.startswith('#'):
+            # Metadata doesn't count as a sample
+            self.meta_list.append(line)
+            if line.startswith('#DEADBAND,') or line.startswith('#MULTIRATE,'):
+                self.hold_period_ms = float(line.split(',')[1])
+                self.count_period_ms = self.hold_period_ms
+            elif line.startswith('#OFFSETS,'):
+                self.offsets_us = [float(v) for v in line.split(',')[1:]]
+            elif line.startswith('#RATE,'):
+                self.count_period_ms = sampling_period
+            elif line.startswith('#RECONNECT,'):
+                self.root.after(0, lambda: self.status_var.set("Reconnected - catching up on the data the Arduino kept..."))
+            self.root.after(0, lambda l=line: self.display_new_data(l))
+        elif line:
+            self.data_list.append(line)
+            current_count = min(self.collected_samples(), target_samples)
+            self.root.after(0, lambda: self.update_progress(current_count, target_samples))
+            self.root.after(0, lambda: self.display_new_data(line))
+            return True
+        return False
+
+    def alarm(self, line, received=None):
+        """Keep an alarm with the metadata and put it in front of the operator straight away"""
+        self.meta_list.append(line)
+        entry = [line, received if received is not None else time.monotonic(), None]
+        self.alarms.append(entry)
+        self.root.after(0, lambda: self.show_alarm(entry))
+
+    def show_alarm(self, entry):
+        """Runs in the GUI thread: status bar, beep and the data display"""
+        line = entry[0]
+        self.status_var.set(f"ALARM: {line[1:]}")
+        self.root.bell()
+        self.display_new_data(line)
+        entry[2] = (time.monotonic() - entry[1]) * 1000
+
+    def start_link_test(self):
+        """Measure the serial link for the collection time (the Arduino must run the link test mode)"""
+        try:
+            selected_port = self.serial_port_var.get()
+            serial_port = self._port_device_map.get(selected_port, selected_port)
+            baud_rate = int(self.baud_rate_var.get())
+            duration = float(self.collection_time_var.get())
+        except ValueError:
+            messagebox.showerror("Input Error", "Please check your numeric inputs")
+            return
+        self.is_collecting = True
+        self.data_text.delete(1.0, tk.END)
+        self.display_line_count = 0
+        self.start_button.config(state=tk.DISABLED)
+        self.link_test_button.config(state=tk.DISABLED)
+        self.stop_button.config(state=tk.NORMAL)
+        self.status_var.set("Link test: waiting for #LINKTEST line...")
+        test_thread = threading.Thread(target=self.run_link_test, args=(serial_port, baud_rate, duration))
+        test_thread.daemon = True
+        test_thread.start()
+
+    def run_link_test(self, serial_port, baud_rate, duration):
+        ser = None
+        try:
+            ser = serial.Serial(serial_port, baud_rate, timeout=0.1)
+            # The #LINKTEST line (sent after every reset) gives the frame size
+            frame_size = None
+            deadline = time.monotonic() + 5
+            while frame_size is None and time.monotonic() < deadline and self.is_collecting:
+                line = ser.readline().decode('utf-8', errors='replace').strip()
+                if line.startswith('#LINKTEST,'):
+                    frame_size = int(line.split(',')[2])
+                    self.root.after(0, lambda l=line: self.display_new_data(l))
+            if frame_size is None:
+                raise RuntimeError("no #LINKTEST line, is the Arduino running the link test mode?")
+
+            analyzer = LinkTestAnalyzer(frame_size)
+            self.root.after(0, lambda: self.status_var.set("Link test running..."))
+            end = time.monotonic() + duration
+            while time.monotonic() < end and self.is_collecting:
+                data = ser.read(max(1, ser.in_waiting))
+                if data:
+                    analyzer.feed(data, time.monotonic())
+            ser.close()
+            ser = None
+            result = analyzer.results()
+            self.root.after(0, lambda: self.link_test_done(result, baud_rate, frame_size))
+        except Exception as e:
+            if ser:
+                ser.close()
+            self.root.after(0, lambda: messagebox.showerror("Link Test", f"Error: {str(e)}"))
+            self.root.after(0, lambda: self.link_test_done(None, baud_rate, None))
+
+    def link_test_done(self, result, baud_rate, frame_size):
+        self.is_collecting = False
+        self.start_button.config(state=tk.NORMAL)
+        self.link_test_button.config(state=tk.NORMAL)
+        self.stop_button.config(state=tk.DISABLED)
+        if result is None:
+            self.status_var.set("Link test failed")
+            return
+        latency = result['latency_ms']
+        lines = [
+            f"Baud {baud_rate}, frame {frame_size} bytes, {result['seconds']:.1f} s",
+            f"Throughput: {result['bytes_per_s']:.0f} bytes/s ({result['bytes_per_s'] * 1000 / baud_rate:.1f} % of baud/10)",
+            f"Frames: {result['frames']}, lost {result['lost_frames']} ({result['drop_rate'] * 100:.3f} %)",
+            f"Byte errors: {result['byte_errors']} ({result['byte_error_rate']:.2e}), resyncs {result['resyncs']}",
+        ]
+        if latency:
+            lines.append("Latency above best (ms): p50 {p50:.2f}, p95 {p95:.2f}, p99 {p99:.2f}, max {max:.2f}".format(**latency))
+        for line in lines:
+            self.display_new_data(line)
+        # One row per run, so different baud rates and frame sizes can be compared later
+        try:
+            new_file = not os.path.exists("link_tests.csv")
+            with open("link_tests.csv", 'a', newline='') as f:
+                writer = csv.writer(f)
+                if new_file:
+                    writer.writerow(["Date", "Baud", "Frame (bytes)", "Seconds", "Bytes/s", "Frames", "Lost frames",
+                                     "Drop rate", "Byte errors", "Byte error rate", "Resyncs",
+                                     "Latency p50 (ms)", "Latency p95 (ms)", "Latency p99 (ms)", "Latency max (ms)"])
+                writer.writerow([datetime.now().strftime("%Y-%m-%d %H:%M:%S"), baud_rate, frame_size,
+                                 f"{result['seconds']:.3f}", f"{result['bytes_per_s']:.1f}", result['frames'],
+                                 result['lost_frames'], f"{result['drop_rate']:.6f}", result['byte_errors'],
+                                 f"{result['byte_error_rate']:.3e}", result['resyncs']] +
+                                [f"{latency.get(k, 0):.3f}" for k in ('p50', 'p95', 'p99', 'max')])
+            self.status_var.set("Link test complete - added to link_tests.csv")
+        except Exception as e:
+            self.status_var.set(f"Error saving link test: {str(e)}")
+
+    def collected_samples(self):
+        """Number of lines collected so far (including the header).
+
+        Deadband and adaptive rate streams skip lines, so there we count the sample times
+        covered instead of the lines received.
+        """
+        if not self.count_period_ms:
+            return len(self.data_list)
+        times = [t for t in (row_time(line) for line in self.data_list[1:3] + self.data_list[-2:]) if t is not None]
+        if not times:
+            return len(self.data_list)
+        return int(round((max(times) - min(times)) / self.count_period_ms)) + 2
+
     def update_progress(self, current, total):
         """Update progress bar and label"""
         self.progress.config(value=current)
@@ -355,7 +1231,7 @@ class SerialDataCollector:
         self.stop_button.config(state=tk.DISABLED)
         self.save_data_automatically()
         # Calculate actual data samples (total - 1 for header, but don't go negative)
-        data_samples = max(0, len(self.data_list) - 1)
+        data_samples = max(0, self.collected_samples() - 1)
         self.status_var.set(f"Collection stopped - saved {data_samples} samples + header")
         
     def is_garbled(self, line):
@@ -387,10 +1263,58 @@ class SerialDataCollector:
             data_to_save = self.data_list[:]
             if data_to_save and self.is_garbled(data_to_save[0]):
                 data_to_save = data_to_save[1:]
+            if self.hold_period_ms:
+                data_to_save = fill_sample_and_hold(data_to_save, self.hold_period_ms)
             with open(filename, 'w', newline='') as csvfile:
                 writer = csv.writer(csvfile)
                 for item in data_to_save:
                     writer.writerow(item.split(','))
+            if self.meta_list:
+                # Metadata goes next to the data, e.g. data_meta.csv, without the leading #
+                name, ext = os.path.splitext(filename)
+                with open(f"{name}_meta{ext}", 'w', newline='') as metafile:
+                    writer = csv.writer(metafile)
+                    for item in self.meta_list:
+                        writer.writerow(item[1:].split(','))
+            if self.offsets_us and not any(m.startswith('#RATE,') for m in self.meta_list):
+                # The same data with every channel shifted back to the time stamp, e.g. data_aligned.csv
+                name, ext = os.path.splitext(filename)
+                with open(f"{name}_aligned{ext}", 'w', newline='') as alignedfile:
+                    writer = csv.writer(alignedfile)
+                    for item in align_channels(data_to_save, self.offsets_us):
+                        writer.writerow(item.split(','))
+            events = event_rows(self.meta_list)
+            if events:
+                # External events with their exact times, e.g. data_events.csv
+                name, ext = os.path.splitext(filename)
+                with open(f"{name}_events{ext}", 'w', newline='') as eventsfile:
+                    writer = csv.writer(eventsfile)
+                    writer.writerow(["Time (ms)", "Edge", "Scan time (ms)", "Offset (us)"])
+                    writer.writerows(events)
+            pulses = sync_rows(self.meta_list)
+            if pulses:
+                # Sync pulses for lining up several boards, e.g. data_sync.csv
+                name, ext = os.path.splitext(filename)
+                with open(f"{name}_sync{ext}", 'w', newline='') as syncfile:
+                    writer = csv.writer(syncfile)
+                    writer.writerow(["Pulse", "Time", "Scan time (ms)", "Offset (us)"])
+                    writer.writerows(pulses)
+            if any(m.startswith('#ETS,') for m in self.meta_list):
+                # One column per equivalent-time record, e.g. data_ets.csv
+                name, ext = os.path.splitext(filename)
+                rows = ets_records(data_to_save)
+                with open(f"{name}_ets{ext}", 'w', newline='') as etsfile:
+                    writer = csv.writer(etsfile)
+                    writer.writerow(["Offset (us)"] + [f"Record {i + 1}" for i in range(len(rows[0]) - 1 if rows else 0)])
+                    writer.writerows(rows)
+            alarms = alarm_rows(self.alarms)
+            if alarms:
+                # Alarms with their latencies, e.g. data_alarms.csv
+                name, ext = os.path.splitext(filename)
+                with open(f"{name}_alarms{ext}", 'w', newline='') as alarmsfile:
+                    writer = csv.writer(alarmsfile)
+                    writer.writerow(["Time", "Channel", "State", "Value", "Board latency (us)", "Display latency (ms)"])
+                    writer.writerows(alarms)
             self.status_var.set(f"Data saved to {filename}")
         except Exception as e:
             self.status_var.set(f"Error saving data: {str(e)}")
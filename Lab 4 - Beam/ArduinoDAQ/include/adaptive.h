@@ -0,0 +1,97 @@
+/*
+ * Activity-adaptive output rate
+ *
+ * The timer always samples at the fast rate, but during quiet stretches only every
+ * quietDivider-th scan is printed. An activity level follows how fast the channels are
+ * changing (the largest change between two scans, on any channel, that slowly decays).
+ * When it rises above enterLevel every scan is printed (the burst rate). It goes back to
+ * the quiet rate only after the activity stayed below exitLevel for holdTime ms, so a
+ * signal that hovers around one threshold doesn't make the rate flicker back and forth.
+ * The hold is a time rather than a number of scans because the sample period can be changed
+ * while the sketch runs ("period" command), and the hold should stay the same length.
+ *
+ * Every change of rate is marked in the stream with "#RATE,time,period" (period in ms),
+ * so the computer knows which parts of the recording are at which rate.
+ */
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdint.h>
+
+template <uint8_t CHANNELS>
+class AdaptiveRate {
+public:
+  // enterLevel, exitLevel: change per scan in raw counts, holdTime: ms of calm before slowing down
+  AdaptiveRate(uint16_t quietDivider, uint16_t enterLevel, uint16_t exitLevel, uint32_t holdTime)
+    : divider_(quietDivider > 0 ? quietDivider : 1), enter_(enterLevel), exit_(exitLevel),
+      hold_(holdTime), activity_(0), calmSince_(0), skip_(0), burst_(false), calm_(false),
+      changed_(true), first_(true) {}
+
+  // Adds one scan, taken at time (ms). Returns true if this scan should be printed.
+  bool add(uint32_t time, const uint16_t *values) {
+    uint16_t change = 0;
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      uint16_t diff = first_ ? 0 : (values[c] > last_[c] ? values[c] - last_[c] : last_[c] - values[c]);
+      if (diff > change) change = diff;
+      last_[c] = values[c];
+    }
+    first_ = false;
+
+    // Peak follower: jumps up with the signal, then decays by 1/8 per scan
+    activity_ = change > activity_ - activity_ / 8 ? change : activity_ - activity_ / 8;
+
+    if (!burst_ && activity_ >= enter_) {
+      burst_ = true;
+      changed_ = true;
+      calm_ = false;
+    } else if (burst_) {
+      if (activity_ >= exit_) {
+        calm_ = false;
+      } else if (!calm_) {
+        calm_ = true;
+        calmSince_ = time;
+      } else if (time - calmSince_ >= hold_) {
+        burst_ = false;
+        changed_ = true;
+        skip_ = 0;
+      }
+    }
+
+    if (burst_) return true;
+    if (skip_ == 0) {
+      skip_ = divider_ - 1;
+      return true;
+    }
+    skip_--;
+    return false;
+  }
+
+  // True once after every change of rate (and for the very first scan)
+  bool rateChanged() {
+    bool changed = changed_;
+    changed_ = false;
+    return changed;
+  }
+
+  // Scans per printed line at the current rate
+  uint16_t divider() const { return burst_ ? 1 : divider_; }
+
+  bool burst() const { return burst_; }
+
+private:
+  uint16_t divider_;
+  uint16_t enter_;
+  uint16_t exit_;
+  uint32_t hold_;
+  uint16_t activity_;
+  uint32_t calmSince_;
+  uint16_t skip_;
+  bool burst_;
+  bool calm_;
+  bool changed_;
+  bool first_;
+  uint16_t last_[CHANNELS];
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Alarm limits
+ *
+ * Part of main.cpp, included after its settings (see ALARM_LOW there). The sample tick checks
+ * the channels it read against their limits, and every change of a channel's state goes into
+ * a small queue that sendAlarms() empties ahead of all the other lines.
+ */
+
+#ifndef ALARMS_H
+#define ALARMS_H
+
+// Alarm state changes, from the timer interrupt to sendAlarms()
+enum AlarmState : uint8_t { ALARM_OK, ALARM_LOW_STATE, ALARM_HIGH_STATE };
+const char *const ALARM_NAMES[] = {"ok", "low", "high"};
+struct Alarm {
+  uint32_t time;       // time stamp of the scan
+  uint32_t detected;   // micros() when it was checked
+  uint16_t value;
+  uint8_t channel;
+  uint8_t state;
+};
+const uint8_t ALARM_QUEUE_LENGTH = 4;   // Must be a power of two
+volatile Alarm alarms[ALARM_QUEUE_LENGTH];
+volatile uint8_t alarmHead = 0;
+volatile uint8_t alarmTail = 0;
+volatile uint8_t alarmState[NUM_CHANNELS];
+uint16_t alarmsSent = 0;
+uint32_t alarmLatencyMax = 0;           // microseconds
+
+// Compares the channels that were read (bit i of read = channel i) with their limits, from
+// the timer interrupt, for the scan with time stamp time. Every change of a channel's state is
+// queued for sendAlarms(). If the queue is full the change is sent with the next one that fits.
+void checkAlarms(uint32_t time, const uint16_t *values, uint32_t read) {
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    if (!(read & ((uint32_t)1 << i))) {
+      continue;
+    }
+    uint16_t value = values[i];
+    uint16_t low = settings.alarmLow[i];
+    uint16_t high = settings.alarmHigh[i];
+    uint8_t state = alarmState[i];
+    uint8_t now = state;
+    if (high < hal::ADC_MAX && value > high) {
+      now = ALARM_HIGH_STATE;
+    } else if (low > 0 && value < low) {
+      now = ALARM_LOW_STATE;
+    } else if ((state == ALARM_HIGH_STATE && value + ALARM_HYSTERESIS <= high) ||
+               (state == ALARM_LOW_STATE && value >= low + ALARM_HYSTERESIS)) {
+      now = ALARM_OK;
+    }
+    uint8_t next = (alarmTail + 1) & (ALARM_QUEUE_LENGTH - 1);
+    if (now == state || next == alarmHead) {
+      continue;
+    }
+    alarmState[i] = now;
+    volatile Alarm &alarm = alarms[alarmTail];
+    alarm.time = time;
+    alarm.detected = hal::micros();
+    alarm.value = value;
+    alarm.channel = i;
+    alarm.state = now;
+    alarmTail = next;
+  }
+}
+
+// Sends the queued alarms as "!ALARM,time,pin,state,value,latency_us" ahead of every other
+// line. Line runs it before each line and while one waits for the link (see setWaiting in
+// setup()). latency_us is from the check in the timer interrupt until the last byte of the
+// alarm has left the board, counting the bytes still ahead of it in the link.
+void sendAlarms() {
+  bool sent = false;
+  for (;;) {
+    Alarm alarm;
+    {
+      hal::IrqGuard guard;
+      if (alarmHead == alarmTail) {
+        break;
+      }
+      const volatile Alarm &queued = alarms[alarmHead];
+      alarm.time = queued.time;
+      alarm.detected = queued.detected;
+      alarm.value = queued.value;
+      alarm.channel = queued.channel;
+      alarm.state = queued.state;
+      alarmHead = (alarmHead + 1) & (ALARM_QUEUE_LENGTH - 1);
+    }
+    Line line;
+    line.text("!ALARM,").number(alarm.time).comma().number(settings.channels[alarm.channel]).comma();
+    line.text(ALARM_NAMES[alarm.state]).comma().number(alarm.value).comma();
+    // The bytes ahead, this line, about 5 digits of latency and the line ending
+    uint32_t bytes = hal::linkQueued() + line.length() + 7;
+    uint32_t latency = hal::micros() - alarm.detected + bytes * 10000000UL / HAL_DEFAULT_BAUD;
+    line.number(latency).sendUrgent();
+    alarmsSent++;
+    if (latency > alarmLatencyMax) {
+      alarmLatencyMax = latency;
+    }
+    sent = true;
+  }
+#if RELIABLE_LINK
+  if (sent) {
+    reliable.flush();  // don't wait for the block to fill up
+  }
+#else
+  (void)sent;
+#endif
+}
+
+// For startStream(), with interrupts off
+void resetAlarms() {
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    alarmState[i] = ALARM_OK;  // a channel still over its limit alarms again
+  }
+}
+
+#endif
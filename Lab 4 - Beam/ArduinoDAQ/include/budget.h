@@ -0,0 +1,94 @@
+/*
+ * Link and CPU budget of a configuration, worked out when the sketch is compiled
+ *
+ * Every sample tick costs serial link bytes (the line it prints) and CPU time (the
+ * conversions in the timer interrupt, then formatting the line in loop()). If SAMPLE_PERIOD
+ * is shorter than either of them the queue fills up and the stream ends in "Missed samples"
+ * warnings. These functions add up the worst case from the configuration:
+ *
+ *   link  the longest line of the mode: a 10 digit time stamp (millis() after 11.5 days),
+ *         every value at full scale, the commas and \r\n. The link carries HAL_DEFAULT_BAUD / 10
+ *         bytes per second (start bit, 8 data bits, stop bit). The native USB boards ignore
+ *         the baud rate and are faster than that, so for them it is on the safe side.
+ *   CPU   HAL_ADC_CONVERSION_US per channel in the interrupt, plus rough cycle counts for the
+ *         rest of the tick and for every character printed (a digit costs a 32 bit division,
+ *         about 600 cycles on the Uno, and the transmit interrupt).
+ *
+ * main.cpp turns them into the shortest period that fits and refuses to compile with a
+ * shorter SAMPLE_PERIOD, see PeriodFits below. Occasional lines (#EVENT, warnings, replies to
+ * commands) aren't counted, that's what the queue is for.
+ */
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdint.h>
+#include "hal.h"
+
+namespace budget {
+
+const uint32_t LINK_BYTES_PER_S = HAL_DEFAULT_BAUD / 10;
+const uint32_t TIME_DIGITS = 10;
+const uint32_t CYCLES_PER_CHARACTER = 500;  // formatting and sending one character
+const uint32_t CYCLES_PER_CHANNEL = 300;    // queueing and processing one value, besides the ADC
+const uint32_t CYCLES_PER_TICK = 400;       // entering and leaving the timer interrupt
+
+constexpr uint32_t digits(uint32_t value) {
+  return value < 10 ? 1 : 1 + digits(value / 10);
+}
+
+constexpr uint32_t divideUp(uint32_t a, uint32_t b) {
+  return (a + b - 1) / b;
+}
+
+constexpr uint32_t largest(uint32_t a, uint32_t b) {
+  return a > b ? a : b;
+}
+
+const uint32_t VALUE_DIGITS = digits(hal::ADC_MAX);
+
+// "time,value,value,...\r\n" with prefix in front (e.g. 5 for "#RAW,")
+constexpr uint32_t scanLineBytes(uint8_t channels, uint32_t prefix = 0) {
+  return prefix + TIME_DIGITS + channels * (1 + VALUE_DIGITS) + 2;
+}
+
+// CPU time of one tick in cycles, printing tickMilliBytes / 1000 characters on average
+constexpr uint32_t tickCycles(uint8_t channels, uint32_t tickMilliBytes) {
+  return CYCLES_PER_TICK
+       + channels * (HAL_ADC_CONVERSION_US * HAL_CPU_MHZ + CYCLES_PER_CHANNEL)
+       + tickMilliBytes * CYCLES_PER_CHARACTER / 1000;
+}
+
+// Shortest period (ms) the link can carry. tickMilliBytes is the output of one tick in
+// thousandths of a byte (some modes only print every few ticks), fixedBytesPerS the output
+// that doesn't depend on the period. Thousandths of a byte per tick over bytes per second
+// comes out in milliseconds.
+constexpr uint32_t linkPeriod(uint32_t tickMilliBytes, uint32_t fixedBytesPerS) {
+  return fixedBytesPerS >= LINK_BYTES_PER_S ? 0xFFFFFFFFUL
+       : divideUp(tickMilliBytes, LINK_BYTES_PER_S - fixedBytesPerS);
+}
+
+// Shortest period (ms) the CPU keeps up with
+constexpr uint32_t cpuPeriod(uint8_t channels, uint32_t tickMilliBytes) {
+  return divideUp(tickCycles(channels, tickMilliBytes), HAL_CPU_MHZ * 1000UL);
+}
+
+// Shortest period (ms) that fits both, at least 1 ms
+constexpr uint32_t shortestPeriod(uint8_t channels, uint32_t tickMilliBytes, uint32_t fixedBytesPerS) {
+  return largest(1, largest(linkPeriod(tickMilliBytes, fixedBytesPerS), cpuPeriod(channels, tickMilliBytes)));
+}
+
+}  // namespace budget
+
+// Fails to compile if PERIOD_MS is shorter than SHORTEST_MS. The compiler names the
+// template in its error, so the numbers show up there, e.g. PeriodFits<3, 333, 2>: the
+// shortest period is 3 ms (333 scans per second) and SAMPLE_PERIOD is 2.
+template <uint32_t SHORTEST_MS, uint32_t MAX_RATE_HZ, uint32_t PERIOD_MS>
+struct PeriodFits {
+  static_assert(PERIOD_MS >= SHORTEST_MS,
+                "SAMPLE_PERIOD is too short for the serial link or the CPU. "
+                "PeriodFits<shortest period in ms, highest rate in Hz, SAMPLE_PERIOD> is in this error");
+  static const bool value = true;
+};
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * Report-by-exception (deadband) output
+ *
+ * Slow signals such as temperatures or position pots repeat the same value for long
+ * stretches. In deadband mode a channel is only sent when it has moved more than its
+ * deadband since the last value we sent, or when it has been quiet for maxSilence
+ * milliseconds (so the computer knows the sensor is still alive).
+ *
+ * Channels that are not sent are left empty in the line, for example "1500,,517," means
+ * only channel 1 changed at 1500 ms. A line with every field empty is never sent. The data
+ * collection GUI fills the gaps back in (sample-and-hold) when it saves the file.
+ */
+
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include <stdint.h>
+
+template <uint8_t CHANNELS>
+class Deadband {
+public:
+  // limits: deadband of each channel in raw counts, maxSilence: milliseconds
+  Deadband(const uint16_t *limits, uint32_t maxSilence) : limits_(limits), maxSilence_(maxSilence) {
+    for (uint8_t c = 0; c < CHANNELS; c++) sent_[c] = false;
+  }
+
+  // Decides which channels of this scan need to be sent. Sets bit c of mask for every
+  // channel to send and returns true if there is anything to send at all.
+  bool check(uint32_t time, const uint16_t *values, uint32_t &mask) {
+    mask = 0;
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      int32_t change = (int32_t)values[c] - (int32_t)last_[c];
+      if (change < 0) change = -change;
+      bool send = !sent_[c] || change > (int32_t)limits_[c] || time - lastTime_[c] >= maxSilence_;
+      if (send) {
+        mask |= (uint32_t)1 << c;
+        last_[c] = values[c];
+        lastTime_[c] = time;
+        sent_[c] = true;
+      }
+    }
+    return mask != 0;
+  }
+
+private:
+  const uint16_t *limits_;
+  uint32_t maxSilence_;
+  uint16_t last_[CHANNELS];
+  uint32_t lastTime_[CHANNELS];
+  bool sent_[CHANNELS];
+};
+
+#endif
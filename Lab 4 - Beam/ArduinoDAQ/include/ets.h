@@ -0,0 +1,95 @@
+/*
+ * Equivalent-time sampling of repetitive signals
+ *
+ * The Uno's ADC needs 104 us per conversion (13 ADC clocks), so a 2 kHz PWM waveform only
+ * gets four or five points per period in real time. If the signal repeats, one point per
+ * period is enough: every point is taken STEP_NS later after the trigger edge than the one
+ * before, and after POINTS periods they make up one period of the waveform at one point
+ * every STEP_NS, like a sampling oscilloscope. With STEP_NS = 500 that is 2 million samples
+ * per second. The trigger edge and the delay are timed by the hardware (see etsBegin in
+ * hal.h), so the loop and the interrupt latency don't matter.
+ *
+ * This class hands out the delays and passes the points from the ADC interrupt to loop().
+ * The signal has to really repeat: a point is from a different period than its neighbours,
+ * so anything that changes from one period to the next (noise, jitter of the trigger edge)
+ * shows up as noise on the record.
+ */
+
+#ifndef ETS_H
+#define ETS_H
+
+#include <stdint.h>
+
+// QUEUE a power of two
+template <uint16_t POINTS, uint8_t QUEUE>
+class EquivalentTime {
+  static_assert((QUEUE & (QUEUE - 1)) == 0, "QUEUE must be a power of two");
+
+public:
+  struct Point {
+    uint16_t index;     // 0 is the first point of a record
+    uint16_t value;
+    uint32_t periodNs;  // the signal's period, 0 if it wasn't known yet
+  };
+
+  explicit EquivalentTime(uint32_t stepNs) : stepNs_(stepNs), record_(0) { restart(); }
+
+  // Starts again with the first point of a new record. Call before the conversions start.
+  void restart() {
+    head_ = tail_ = 0;
+    next_ = 0;
+    armed_ = false;
+  }
+
+  // The delay of the next point, if it isn't armed already and there is room for it in the
+  // queue. Call with interrupts off, or from the ADC interrupt.
+  bool arm(uint32_t &delayNs) {
+    if (armed_ || ((tail_ + 1) & (QUEUE - 1)) == head_) {
+      return false;
+    }
+    delayNs = next_ * stepNs_;
+    armed_ = true;
+    return true;
+  }
+
+  // From the ADC interrupt with the value of the armed point
+  void add(uint16_t value, uint32_t periodNs) {
+    volatile Point &point = queue_[tail_];
+    point.index = next_;
+    point.value = value;
+    point.periodNs = periodNs;
+    tail_ = (uint8_t)((tail_ + 1) & (QUEUE - 1));
+    next_ = (uint16_t)(next_ + 1 == POINTS ? 0 : next_ + 1);
+    armed_ = false;
+  }
+
+  // Takes the oldest point out of the queue. Call with interrupts off.
+  bool take(Point &point) {
+    if (head_ == tail_) {
+      return false;
+    }
+    const volatile Point &queued = queue_[head_];
+    point.index = queued.index;
+    point.value = queued.value;
+    point.periodNs = queued.periodNs;
+    head_ = (uint8_t)((head_ + 1) & (QUEUE - 1));
+    if (point.index == 0) {
+      record_++;
+    }
+    return true;
+  }
+
+  uint32_t stepNs() const { return stepNs_; }
+  uint32_t record() const { return record_; }  // of the last point taken, from 1
+
+private:
+  const uint32_t stepNs_;
+  uint32_t record_;           // only used by loop()
+  volatile Point queue_[QUEUE];
+  volatile uint8_t head_;
+  volatile uint8_t tail_;
+  volatile uint16_t next_;    // point the next conversion is for
+  volatile bool armed_;
+};
+
+#endif
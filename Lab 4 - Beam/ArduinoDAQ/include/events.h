@@ -0,0 +1,72 @@
+/*
+ * Event marker input
+ *
+ * Part of main.cpp, included after sampling.h (see USE_EVENTS there). The capture interrupt
+ * time stamps every edge against the sample tick it came after, loop() prints them.
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+// Edges on the event pin, from the capture interrupt to loop()
+struct Event {
+  uint32_t time;       // time stamp of the scan the edge came after
+  uint32_t offsetNs;   // how long after that scan started
+  bool rising;
+};
+const uint8_t EVENT_QUEUE_LENGTH = 8;   // Must be a power of two
+volatile Event events[EVENT_QUEUE_LENGTH];
+volatile uint8_t eventHead = 0;
+volatile uint8_t eventTail = 0;
+volatile uint16_t missedEvents = 0;
+volatile uint32_t lastEventMicros = 0;
+
+// Runs from the capture interrupt for every edge on the event pin, always after the tick of
+// the sample period the edge fell in
+void eventEdge(uint32_t sinceTickNs, bool rising) {
+  uint32_t now = hal::micros();
+  if (EVENT_HOLDOFF > 0 && now - lastEventMicros < EVENT_HOLDOFF) {
+    return;
+  }
+  lastEventMicros = now;
+  uint8_t next = (eventTail + 1) & (EVENT_QUEUE_LENGTH - 1);
+  if (next == eventHead) {
+    missedEvents++;
+    return;
+  }
+  volatile Event &event = events[eventTail];
+  event.time = tickTime;
+  event.offsetNs = sinceTickNs;
+  event.rising = rising;
+  eventTail = next;
+}
+
+// Prints the events that came in as "#EVENT,time,offset_us,rising|falling"
+void sendEvents() {
+  for (;;) {
+    Event event;
+    {
+      hal::IrqGuard guard;
+      if (eventHead == eventTail) {
+        break;
+      }
+      const volatile Event &queued = events[eventHead];
+      event.time = queued.time;
+      event.offsetNs = queued.offsetNs;
+      event.rising = queued.rising;
+      eventHead = (eventHead + 1) & (EVENT_QUEUE_LENGTH - 1);
+    }
+    Line line;
+    line.text("#EVENT,").number(event.time).comma();
+    addMicroseconds(line, event.offsetNs);
+    line.comma().text(event.rising ? "rising" : "falling").send();
+  }
+}
+
+// For startStream(), with interrupts off
+void resetEvents() {
+  eventHead = eventTail = 0;
+  missedEvents = 0;
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * Hardware Abstraction Layer (HAL) for the data acquisition sketch
+ *
+ * The acquisition code in main.cpp (and its parts in include/) only uses the functions
+ * declared here, never the microcontroller registers directly. Each board has its own small
+ * implementation:
+ *
+ *   src/hal_arduino.cpp  parts that are the same on every Arduino board (ADC, pins, serial)
+ *   src/hal_avr.cpp      sample timer for the Uno and Leonardo (Timer1, Timer2 with the counter)
+ *   src/hal_samd.cpp     sample timer for SAMD21 boards (TC3)
+ *   src/hal_rp2040.cpp   sample timer for the Raspberry Pi Pico (hardware alarm)
+ *   src/hal_native.cpp   a simulated board that runs on your computer
+ *
+ * This way the same sketch runs on the Uno and on faster boards with native USB, and the
+ * native environments in platformio.ini let you run it without any hardware at all.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ----- Board profile -----
+// HAL_BOARD_NAME, HAL_ADC_BITS, HAL_ADC_CHANNELS (analog inputs A0, A1, ...) and
+// HAL_DEFAULT_BAUD describe the board, HAL_CPU_MHZ and HAL_ADC_CONVERSION_US (one
+// conversion, as the HAL sets the ADC up) its speed for budget.h.
+// The native environments set them with build flags so they can pretend to be any of the boards.
+#if defined(HAL_NATIVE)
+  #ifndef HAL_BOARD_NAME
+    #define HAL_BOARD_NAME "native"
+  #endif
+  #ifndef HAL_ADC_BITS
+    #define HAL_ADC_BITS 10
+  #endif
+  #ifndef HAL_ADC_CHANNELS
+    #define HAL_ADC_CHANNELS 6
+  #endif
+  #ifndef HAL_DEFAULT_BAUD
+    #define HAL_DEFAULT_BAUD 115200
+  #endif
+  #ifndef HAL_CAPTURE_PIN
+    #define HAL_CAPTURE_PIN 8
+  #endif
+  #ifndef HAL_COUNTER_PIN
+    #define HAL_COUNTER_PIN 5
+  #endif
+  #ifndef HAL_CPU_MHZ
+    #define HAL_CPU_MHZ 16
+  #endif
+  #ifndef HAL_ADC_CONVERSION_US
+    #define HAL_ADC_CONVERSION_US 104
+  #endif
+#elif defined(ARDUINO_ARCH_AVR)
+  #if defined(__AVR_ATmega32U4__)
+    #define HAL_BOARD_NAME "leonardo"
+    #define HAL_ADC_CHANNELS 12       // A0 - A11 (A6 - A11 share digital pins 4 - 12)
+    #define HAL_DEFAULT_BAUD 1000000  // native USB, the number is ignored
+    #define HAL_CAPTURE_PIN 4         // ICP1
+    #define HAL_COUNTER_PIN 12        // T1
+  #else
+    #define HAL_BOARD_NAME "uno"
+    #define HAL_ADC_CHANNELS 6        // A0 - A5
+    #define HAL_DEFAULT_BAUD 115200   // highest stable rate through the USB-serial bridge
+    #define HAL_CAPTURE_PIN 8         // ICP1
+    #define HAL_COUNTER_PIN 5         // T1
+  #endif
+  #define HAL_ADC_BITS 10
+  #define HAL_CPU_MHZ 16
+  #define HAL_ADC_CONVERSION_US 104
+#elif defined(ARDUINO_ARCH_SAMD)
+  #define HAL_BOARD_NAME "samd21"
+  #define HAL_ADC_BITS 12
+  #define HAL_ADC_CHANNELS 6          // A0 - A5
+  #define HAL_DEFAULT_BAUD 1000000    // native USB, the number is ignored
+  #define HAL_CAPTURE_PIN 2
+  #define HAL_COUNTER_PIN 5
+  #define HAL_CPU_MHZ 48
+  #define HAL_ADC_CONVERSION_US 425
+#elif defined(ARDUINO_ARCH_RP2040)
+  #define HAL_BOARD_NAME "rp2040"
+  #define HAL_ADC_BITS 12
+  #define HAL_ADC_CHANNELS 4          // A0 - A3 (GP26 - GP29)
+  #define HAL_DEFAULT_BAUD 1000000    // native USB, the number is ignored
+  #define HAL_CAPTURE_PIN 2
+  #define HAL_COUNTER_PIN 5           // PWM slice 2, B input
+  #define HAL_CPU_MHZ 133
+  #define HAL_ADC_CONVERSION_US 8
+#else
+  #error "This board is not supported by hal.h yet"
+#endif
+
+namespace hal {
+
+const uint8_t ADC_BITS = HAL_ADC_BITS;
+const uint16_t ADC_MAX = (1U << HAL_ADC_BITS) - 1;
+
+// ----- Time -----
+uint32_t micros();
+uint32_t millis();
+
+// ----- Sample timer -----
+// Calls tick() from an interrupt every period_us microseconds. Keep tick() short.
+// On the Uno and Leonardo tick() runs with the other interrupts on (the serial port, millis()),
+// only the next tick and the event capture wait for it.
+// Returns false if the board can't make that period.
+bool timerStart(uint32_t period_us, void (*tick)());
+void timerStop();
+
+// Makes the sample period that is running now ns nanoseconds longer (shorter if negative),
+// to pull the timer onto another clock. What doesn't fit in whole timer steps, or would end
+// the period before now, is carried over to the next call. Can be called from tick() and
+// the capture handler. On the RP2040 it changes the next period instead, in 1 us steps.
+void timerNudge(int32_t ns);
+
+// ----- Analog inputs -----
+// Channels are numbered from A0, so channel 2 is A2, up to HAL_ADC_CHANNELS - 1. The channels of a scan are converted one
+// after the other; if times isn't 0, adcScan() stores when each conversion started, in
+// microseconds after the call (the same every scan when the sample timer starts the scans).
+// On the Uno and Leonardo the ADC converts them back to back by itself, 104 us apart, so other
+// interrupts don't move the samples.
+void adcBegin();
+uint16_t adcRead(uint8_t channel);
+void adcScan(const uint8_t *channels, uint8_t count, uint16_t *values, uint16_t *times = 0);
+
+// ----- Digital pins -----
+enum Edge : uint8_t { EDGE_RISING, EDGE_FALLING, EDGE_BOTH };
+
+void pinOutput(uint8_t pin);
+void pinInput(uint8_t pin, bool pullup);
+void pinWrite(uint8_t pin, bool high);
+bool pinRead(uint8_t pin);
+
+// Calls handler() from an interrupt when the pin sees the edge.
+// Returns false if the pin can't generate interrupts on this board.
+bool attachEdge(uint8_t pin, Edge edge, void (*handler)());
+void detachEdge(uint8_t pin);
+
+// ----- Event capture -----
+// Time stamps edges on HAL_CAPTURE_PIN against the sample timer. handler() is called from an
+// interrupt with how long after the last tick() the edge came, in nanoseconds, and whether it
+// was a rising edge. It always runs after the tick() of the period the edge fell in, even if
+// that tick was still waiting for its interrupt when the edge came.
+//   Uno, Leonardo   Timer1 input capture: the hardware latches the sample timer's count at
+//                   the edge, so the time is exact to one timer step (62.5 ns at periods up to
+//                   4 ms, 16 us at the longest periods) whatever the interrupt latency
+//   SAMD21, RP2040  a pin interrupt reading micros(): 1 us steps plus the interrupt latency
+// Set the pin up with pinInput() first. Returns false if the board can't capture edges.
+bool captureBegin(Edge edge, void (*handler)(uint32_t sinceTickNs, bool rising));
+void captureStop();
+
+// ----- Equivalent-time sampling -----
+// For repetitive signals faster than the ADC can follow. Once armed, the next edge on
+// HAL_CAPTURE_PIN starts one conversion of the channel, with the input held delayNs after the
+// edge, and done() is called from an interrupt with the value and the signal's period (0 until
+// two edges have been seen). Arm it again for every point, with a different delay each time.
+//   Uno, Leonardo   Timer1 input capture and compare match B start the ADC by hardware, so
+//                   the delay is exact to 62.5 ns. A delay shorter than about 30 us is taken
+//                   one period after the next edge instead. The period must be under 4 ms.
+//   SAMD21, RP2040  not supported, etsBegin() returns false
+// The sample timer and the event capture are stopped, etsStop() ends it.
+bool etsBegin(uint8_t channel, Edge edge, void (*done)(uint16_t value, uint32_t periodNs));
+void etsArm(uint32_t delayNs);
+void etsStop();
+
+// ----- Frequency counter -----
+// Counts the rising edges on HAL_COUNTER_PIN in hardware, so a fast pulse train costs no CPU
+// time per edge (one interrupt every 65536 edges extends the count to 32 bits).
+// counterRead() gives the edges since counterBegin() and can be called from tick().
+//   Uno      Timer1 clocked by its T1 pin, up to about 6 MHz (the pin is sampled at the CPU
+//            clock). The sample timer moves to Timer2, in whole milliseconds only, and the
+//            event capture and equivalent-time sampling (Timer1) are no longer available.
+//            Call counterBegin() before timerStart().
+//   RP2040   a PWM slice counting the edges on its B pin, up to half the system clock
+//   Leonardo, SAMD21  not supported, counterBegin() returns false
+bool counterBegin();
+uint32_t counterRead();
+
+// ----- PWM output -----
+// Starts PWM on the pin with the fastest carrier the board offers, so an RC filter turns it
+// into a smooth analog voltage. pwmWrite() can be called from the sample timer interrupt.
+void pwmBegin(uint8_t pin);
+void pwmWrite(uint8_t pin, uint8_t duty); // 0 = always low, 255 = always high
+
+// Turns interrupts off for as long as the object exists, then restores them
+class IrqGuard {
+public:
+  IrqGuard();
+  ~IrqGuard();
+private:
+  uint32_t state_;
+};
+
+// ----- Power -----
+// For battery loggers. idle() stops the CPU until the next interrupt (the sample timer, the
+// serial port, the board's millis() tick); the timers and the serial port keep running.
+// adcPower(false) switches the ADC off, switch it back on before reading. powerSaveBegin()
+// turns off the peripherals the sketch never uses.
+void idle();
+void adcPower(bool on);
+void powerSaveBegin();
+
+// ----- Non-volatile memory (EEPROM) -----
+// A few hundred bytes that survive a reset, for the settings. Both return false if the board
+// has no EEPROM, then the sketch simply uses its defaults.
+bool nvRead(uint16_t address, void *data, uint16_t length);
+bool nvWrite(uint16_t address, const void *data, uint16_t length);
+
+// ----- Byte transport to the computer -----
+void linkBegin(uint32_t baud);
+size_t linkWrite(const uint8_t *data, size_t length); // never blocks, returns bytes accepted
+size_t linkWritable();                                // bytes that can be written right now
+size_t linkQueued();                                  // bytes written but not sent yet (0 on native USB)
+int linkRead();                                       // next received byte, or -1
+
+} // namespace hal
+
+#endif
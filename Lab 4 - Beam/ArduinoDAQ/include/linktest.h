@@ -0,0 +1,82 @@
+/*
+ * Serial link self-test
+ *
+ * Sends binary test frames as fast as the link takes them, so the computer can measure how
+ * many bytes per second really get through, how many bytes arrive wrong, how many frames
+ * get lost and how long they take. Each frame looks like this (numbers little-endian):
+ *
+ *   A5 5A        start of frame
+ *   length       2 bytes, length of the whole frame
+ *   sequence     4 bytes, counts up by one every frame
+ *   time         4 bytes, micros() when the frame was built
+ *   payload      length - 12 bytes of pseudo-random test pattern
+ *
+ * The payload comes from a 16 bit xorshift generator started from the sequence number, so
+ * the computer can work out exactly what every byte should have been. See the Link Test
+ * button in DataCollectionGUI.py.
+ */
+
+#ifndef LINKTEST_H
+#define LINKTEST_H
+
+#include <stdint.h>
+#include "hal.h"
+
+template <uint8_t FRAME_SIZE>
+class LinkTest {
+public:
+  static const uint8_t HEADER = 12;
+
+  LinkTest() : sequence_(0), sent_(FRAME_SIZE) {}
+
+  // Start value of the test pattern for a frame
+  static uint16_t seed(uint32_t sequence) {
+    uint16_t x = (uint16_t)(sequence ^ (sequence >> 16) ^ 0xACE1);
+    return x != 0 ? x : 1;
+  }
+
+  // Next byte of the test pattern
+  static uint8_t next(uint16_t &x) {
+    x ^= (uint16_t)(x << 7);
+    x ^= (uint16_t)(x >> 9);
+    x ^= (uint16_t)(x << 8);
+    return (uint8_t)x;
+  }
+
+  // Call from loop(): hands the link as much as it will take right now. Stops after a few
+  // frames, because on native USB boards the write waits instead of refusing bytes.
+  void service() {
+    for (uint8_t frames = 0; frames < 4;) {
+      if (sent_ == FRAME_SIZE) {
+        build();
+        frames++;
+      }
+      size_t n = hal::linkWrite(frame_ + sent_, FRAME_SIZE - sent_);
+      if (n == 0) return;
+      sent_ = (uint8_t)(sent_ + n);
+    }
+  }
+
+private:
+  void build() {
+    uint32_t now = hal::micros();
+    frame_[0] = 0xA5;
+    frame_[1] = 0x5A;
+    frame_[2] = FRAME_SIZE;
+    frame_[3] = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+      frame_[4 + i] = (uint8_t)(sequence_ >> (8 * i));
+      frame_[8 + i] = (uint8_t)(now >> (8 * i));
+    }
+    uint16_t x = seed(sequence_);
+    for (uint8_t i = HEADER; i < FRAME_SIZE; i++) frame_[i] = next(x);
+    sequence_++;
+    sent_ = 0;
+  }
+
+  uint8_t frame_[FRAME_SIZE];
+  uint32_t sequence_;
+  uint8_t sent_;
+};
+
+#endif
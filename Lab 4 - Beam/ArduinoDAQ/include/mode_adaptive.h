@@ -0,0 +1,48 @@
+/*
+ * Adaptive mode: sample fast, but only print every scan while the signals are changing
+ *
+ * Part of main.cpp, see mode_raw.h for what a mode header provides.
+ */
+
+#ifndef MODE_ADAPTIVE_H
+#define MODE_ADAPTIVE_H
+
+#include "adaptive.h"
+
+// Adaptive mode settings. SAMPLE_PERIOD is the fast (burst) rate here, e.g. SAMPLE_PERIOD = 4.
+// Set the GUI's period to SAMPLE_PERIOD as well.
+const uint16_t QUIET_DIVIDER = 25;        // While quiet only every 25th scan is printed
+const uint16_t ACTIVITY_ENTER = 30;       // Raw counts per scan that switch to the burst rate
+const uint16_t ACTIVITY_EXIT = 15;        // Activity must fall below this to switch back...
+const unsigned long BURST_HOLD = 500;     // ...and stay there this long (milliseconds)
+
+AdaptiveRate<NUM_CHANNELS> adaptive(QUIET_DIVIDER, ACTIVITY_ENTER, ACTIVITY_EXIT, BURST_HOLD);
+
+// At the burst rate, every scan as a line
+const uint32_t TICK_MILLIBYTES = (budget::scanLineBytes(NUM_CHANNELS) + COUNTER_BYTES) * 1000;
+const uint32_t FIXED_BYTES_PER_S = 0;
+const bool MODE_SAMPLE_TIMER = true;
+
+void modeSetup() {}
+
+void modeStart() {
+  sendHeader();
+  sendOffsets();
+  startSampling(scanTick);
+}
+
+void modeService() {}
+
+void modeScan(const Scan &scan) {
+  bool print = adaptive.add(scan.time, scan.value);
+  if (adaptive.rateChanged()) {
+    // Mark the new output period in the stream
+    Line mark;
+    mark.text("#RATE,").number(scan.time).comma().number(settings.samplePeriod * adaptive.divider()).send();
+  }
+  if (print) {
+    sendScan(scan);
+  }
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Deadband mode: only print channels that changed by more than their DEADBAND
+ *
+ * Part of main.cpp, see mode_raw.h for what a mode header provides.
+ */
+
+#ifndef MODE_DEADBAND_H
+#define MODE_DEADBAND_H
+
+#include "deadband.h"
+
+// Deadband mode settings, one deadband per channel in CHANNELS
+const uint16_t DEADBAND[NUM_CHANNELS] = {4, 4, 4}; // Raw counts a channel must change by before it is sent again
+const unsigned long MAX_SILENCE = 10000;          // Send every channel at least this often (milliseconds)
+
+Deadband<NUM_CHANNELS> deadband(DEADBAND, MAX_SILENCE);
+
+// When every channel changes, every scan as a line
+const uint32_t TICK_MILLIBYTES = (budget::scanLineBytes(NUM_CHANNELS) + COUNTER_BYTES) * 1000;
+const uint32_t FIXED_BYTES_PER_S = 0;
+const bool MODE_SAMPLE_TIMER = true;
+
+void modeSetup() {}
+
+void modeStart() {
+  sendHeader();
+  sendOffsets();
+  // Tells the GUI to fill in the empty fields at this sample period
+  Line info;
+  info.text("#DEADBAND,").number(settings.samplePeriod).comma().number(MAX_SILENCE).send();
+  startSampling(scanTick);
+}
+
+void modeService() {}
+
+// Prints the channels that changed, the others' fields stay empty
+void modeScan(const Scan &scan) {
+  uint32_t changed;
+  if (deadband.check(scan.time, scan.value, changed)) {
+    Line line;
+    line.number(scan.time);
+    for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+      line.comma();
+      if (changed & ((uint32_t)1 << i)) {
+        line.number(scan.value[i]);
+      }
+    }
+    line.send();
+  }
+}
+
+#endif
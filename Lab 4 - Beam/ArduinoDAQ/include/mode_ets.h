@@ -0,0 +1,90 @@
+/*
+ * Equivalent-time mode: build one period of a fast repetitive signal from many periods
+ *
+ * Part of main.cpp, see mode_raw.h for what a mode header provides.
+ */
+
+#ifndef MODE_ETS_H
+#define MODE_ETS_H
+
+#include "ets.h"
+
+// Equivalent-time mode settings, for signals that repeat faster than the ADC can follow (a
+// PWM driven actuator, a periodic excitation). Feed the signal, or a trigger that comes with
+// every period, to the capture pin (HAL_CAPTURE_PIN in hal.h) as well as to the first
+// channel in CHANNELS. Every ETS_EDGE starts one conversion, ETS_STEP_NS later than the one
+// before, so ETS_POINTS periods make a record of ETS_POINTS * ETS_STEP_NS at one point every
+// ETS_STEP_NS. The record must fit in 4 ms (one lap of Timer1) and the period be under 4 ms.
+// The points are printed as "offset_us,value" after a "#ETS,record,step_ns,points,period_ns"
+// line. The sample period isn't used. The GUI counts every point as a sample, so with its
+// period at 1 ms a collection time of 10 s collects 10000 points (ten records).
+const uint32_t ETS_STEP_NS = 500;   // 2 MS/s, in 62.5 ns steps on the Uno
+const uint16_t ETS_POINTS = 1000;   // a 500 us record
+const hal::Edge ETS_EDGE = hal::EDGE_RISING;
+static_assert(ETS_POINTS * ETS_STEP_NS < 4000000UL, "an equivalent-time record must fit in 4 ms");
+static_assert(SYNC_ROLE == SYNC_OFF, "the sync pulses and equivalent-time sampling both need the capture pin");
+
+EquivalentTime<ETS_POINTS, 8> ets(ETS_STEP_NS);
+
+const uint32_t TICK_MILLIBYTES = 0;  // no sample timer, the points go out as fast as the link takes them
+const uint32_t FIXED_BYTES_PER_S = 0;
+const bool MODE_SAMPLE_TIMER = false;
+
+// Runs from the ADC interrupt with every point, and arms the next one if there is room for it
+void etsPoint(uint16_t value, uint32_t periodNs) {
+  ets.add(value, periodNs);
+  uint32_t delay;
+  if (ets.arm(delay)) {
+    hal::etsArm(delay);
+  }
+}
+
+// Prints the points that came in, each record after a "#ETS,record,step_ns,points,period_ns"
+// line, and arms the next point once there is room for it again
+void sendPoints() {
+  EquivalentTime<ETS_POINTS, 8>::Point point;
+  for (;;) {
+    {
+      hal::IrqGuard guard;
+      if (!ets.take(point)) {
+        break;
+      }
+    }
+    if (point.index == 0) {
+      Line info;
+      info.text("#ETS,").number(ets.record()).comma().number(ETS_STEP_NS).comma();
+      info.number(ETS_POINTS).comma().number(point.periodNs).send();
+    }
+    Line line;
+    addMicroseconds(line, point.index * ETS_STEP_NS);
+    line.comma().number(point.value).send();
+  }
+  hal::IrqGuard guard;
+  uint32_t delay;
+  if (ets.arm(delay)) {
+    hal::etsArm(delay);
+  }
+}
+
+void modeSetup() {
+  hal::pinInput(HAL_CAPTURE_PIN, false);  // the trigger, see ETS_EDGE
+}
+
+void modeStart() {
+  hal::etsStop();
+  ets.restart();
+  Line header;
+  header.text("Offset (us),Sensor ").number(settings.channels[0]).text(" (raw)").send();
+  if (!hal::etsBegin(settings.channels[0], ETS_EDGE, etsPoint)) {
+    Line error;
+    error.text("#ERROR,this board can't do equivalent-time sampling").send();
+  }
+}
+
+void modeService() {
+  sendPoints();
+}
+
+void modeScan(const Scan &) {}
+
+#endif
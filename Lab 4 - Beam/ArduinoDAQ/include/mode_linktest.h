@@ -0,0 +1,38 @@
+/*
+ * Link test mode: no sampling, send test frames as fast as possible to measure the serial link
+ *
+ * Part of main.cpp, see mode_raw.h for what a mode header provides.
+ */
+
+#ifndef MODE_LINKTEST_H
+#define MODE_LINKTEST_H
+
+#include "linktest.h"
+
+// Link test settings. Pick the baud rate with HAL_DEFAULT_BAUD (in hal.h) and use the same one
+// in the GUI, then press its Link Test button. Bigger frames have less overhead.
+const uint8_t LINKTEST_FRAME = 64;  // Bytes per frame, 13 - 255
+
+LinkTest<LINKTEST_FRAME> linkTest;
+
+const uint32_t TICK_MILLIBYTES = 0;  // no sampling, the test frames use the whole link
+const uint32_t FIXED_BYTES_PER_S = 0;
+const bool MODE_SAMPLE_TIMER = false;
+
+void modeSetup() {
+  Line::setWaiting(0, 0);  // no alarms without scans, and the frames may fill the link
+}
+
+void modeStart() {
+  // No CSV header: the frames that follow are binary. Tells the GUI the baud rate and frame size.
+  Line info;
+  info.text("#LINKTEST,").number(HAL_DEFAULT_BAUD).comma().number(LINKTEST_FRAME).send();
+}
+
+void modeService() {
+  linkTest.service();
+}
+
+void modeScan(const Scan &) {}
+
+#endif
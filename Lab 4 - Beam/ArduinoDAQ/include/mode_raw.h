@@ -0,0 +1,39 @@
+/*
+ * Raw mode: print every scan
+ *
+ * Part of main.cpp, like every mode_*.h: main.cpp includes the one DAQ_MODE picks, after
+ * sampling.h and events.h. A mode header has the mode's settings at the top, and provides
+ *   TICK_MILLIBYTES, FIXED_BYTES_PER_S  its worst-case output (see budget.h): thousandths of a
+ *                      byte per sample tick, and bytes per second that don't depend on the
+ *                      sample period
+ *   MODE_SAMPLE_TIMER  false if the mode doesn't run the sample timer (no scans, events or sync)
+ *   modeSetup()        from setup(), once the board is set up
+ *   modeStart()        from startStream(), with the queues empty: prints the header and starts
+ *                      sampling
+ *   modeService()      from loop(), before the scans
+ *   modeScan()         from loop(), for every scan out of the queue
+ */
+
+#ifndef MODE_RAW_H
+#define MODE_RAW_H
+
+// Every scan as a line
+const uint32_t TICK_MILLIBYTES = (budget::scanLineBytes(NUM_CHANNELS) + COUNTER_BYTES) * 1000;
+const uint32_t FIXED_BYTES_PER_S = 0;
+const bool MODE_SAMPLE_TIMER = true;
+
+void modeSetup() {}
+
+void modeStart() {
+  sendHeader();
+  sendOffsets();
+  startSampling(scanTick);
+}
+
+void modeService() {}
+
+void modeScan(const Scan &scan) {
+  sendScan(scan);
+}
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Multi-rate sampling schedule
+ *
+ * Fast sensors (vibration pickups, microphones) and slow ones (temperatures, position pots)
+ * often share one board. Sampling every channel at the fast rate wastes ADC time inside the
+ * timer interrupt and bytes on the serial link that the fast channels need. In multi-rate
+ * mode every channel has a divider: channel c is only read on every dividers[c]-th tick of
+ * the sample timer, so a divider of 1 is the full rate and 10 is a tenth of it.
+ *
+ * The ticks each channel is read on are planned once, when the stream starts, so that the
+ * slow channels don't all land on the same tick: with dividers {1, 4, 4, 4} each tick reads
+ * A0 and one of the others instead of every fourth tick reading all four. That keeps the
+ * time spent in the interrupt (and the length of the lines) nearly the same on every tick.
+ *
+ * Channels that are not read on a tick are left empty in the line, like in deadband mode,
+ * for example "1500,517,," means only channel 0 was read at 1500 ms.
+ */
+
+#ifndef MULTIRATE_H
+#define MULTIRATE_H
+
+#include <stdint.h>
+
+template <uint8_t CHANNELS>
+class MultiRate {
+public:
+  // Ticks the planner looks at to spread the channels, 120 is a multiple of most dividers
+  static const uint8_t WINDOW = 120;
+
+  // dividers: read channel c on every dividers[c]-th tick (0 counts as 1)
+  explicit MultiRate(const uint8_t *dividers) : dividers_(dividers), busiest_(0) {
+    plan();
+  }
+
+  // Plans the schedule again and starts it from tick 0. Call before the timer starts.
+  void plan() {
+    uint8_t load[WINDOW] = {0};
+    bool placed[CHANNELS] = {false};
+    // Place the fastest channels first, they have the fewest choices
+    for (uint8_t n = 0; n < CHANNELS; n++) {
+      uint8_t c = 0;
+      for (uint8_t i = 0; i < CHANNELS; i++) {
+        if (!placed[i] && (placed[c] || divider(i) < divider(c))) c = i;
+      }
+      placed[c] = true;
+
+      // Pick the first tick (phase) whose ticks have the fewest conversions on them so far
+      uint8_t best = 0;
+      uint16_t bestPeak = 0xFFFF;
+      uint16_t bestTotal = 0xFFFF;
+      for (uint8_t phase = 0; phase < divider(c); phase++) {
+        uint16_t peak = 0, total = 0;
+        for (uint16_t t = phase; t < WINDOW; t += divider(c)) {
+          if (load[t] > peak) peak = load[t];
+          total += load[t];
+        }
+        if (peak < bestPeak || (peak == bestPeak && total < bestTotal)) {
+          best = phase;
+          bestPeak = peak;
+          bestTotal = total;
+        }
+      }
+      for (uint16_t t = best; t < WINDOW; t += divider(c)) load[t]++;
+      countdown_[c] = best;
+    }
+
+    busiest_ = 0;
+    for (uint8_t t = 0; t < WINDOW; t++) {
+      if (load[t] > busiest_) busiest_ = load[t];
+    }
+  }
+
+  // Call once per tick (from the timer interrupt). Returns the channels to read on this
+  // tick, bit c set for channel c.
+  uint32_t next() {
+    uint32_t due = 0;
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      if (countdown_[c] == 0) {
+        due |= (uint32_t)1 << c;
+        countdown_[c] = divider(c) - 1;
+      } else {
+        countdown_[c]--;
+      }
+    }
+    return due;
+  }
+
+  uint8_t divider(uint8_t c) const { return dividers_[c] > 0 ? dividers_[c] : 1; }
+
+  // Most channels read on one tick, what the sample period has to leave room for
+  uint8_t busiest() const { return busiest_; }
+
+private:
+  const uint8_t *dividers_;
+  uint8_t countdown_[CHANNELS];  // ticks until the channel is read next
+  uint8_t busiest_;
+};
+
+#endif
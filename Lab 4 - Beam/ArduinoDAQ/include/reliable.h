@@ -0,0 +1,140 @@
+/*
+ * Reliable link: the text output in numbered blocks that the computer can ask for again
+ *
+ * At high baud rates the USB-serial bridge now and then garbles a byte, and a garbled sample
+ * looks just like a real one. With the reliable link the lines (see Line::setOutput) are
+ * packed into blocks with a sequence number and a CRC, numbers little-endian:
+ *
+ *   A5 5A        start of block
+ *   type         'D' data, 'G' gap (block sequence is gone for good, no payload),
+ *                'S' start (sent once before block 0 after a reset, no payload)
+ *   sequence     2 bytes, counts up by one every data block
+ *   length       1 byte, payload length
+ *   payload      the next bytes of the text stream, lines may continue in the next block
+ *   CRC          2 bytes, CRC-16/CCITT of type to the end of the payload
+ *
+ * The last WINDOW - 1 blocks are kept (the last slot holds the block being filled). When
+ * the computer gets a block with a bad CRC or sees a sequence number missing it sends
+ * "nack N" and the block is sent again; once a block has left the window the answer is a
+ * gap block, so the computer never waits longer than the window lasts. A half-full block
+ * goes out after FLUSH_MS, so slow streams aren't held up. The start block tells the computer
+ * that the sequence numbers begin again at 0, because the board was reset.
+ *
+ * The computer puts the blocks back in order and gets the same text as without the reliable
+ * link, except for a #GAP line where a block couldn't be recovered. See ReliableReceiver in
+ * DataCollectionGUI.py.
+ */
+
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "hal.h"
+#include "settings.h"
+
+// PAYLOAD up to 247 bytes, WINDOW a power of two
+template <uint8_t PAYLOAD, uint8_t WINDOW>
+class ReliableLink {
+  static_assert((WINDOW & (WINDOW - 1)) == 0, "WINDOW must be a power of two");
+
+public:
+  static const uint8_t OVERHEAD = 8;     // start, type, sequence, length, CRC
+  static const uint8_t FLUSH_MS = 20;
+
+  ReliableLink() : next_(0), filled_(0), openedAt_(0), started_(false) {}
+
+  // Adds bytes of the text stream, sends every block that gets full
+  void add(const char *data, uint8_t length) {
+    while (length > 0) {
+      if (filled_ == 0) {
+        openedAt_ = hal::millis();
+      }
+      uint8_t n = (uint8_t)(PAYLOAD - filled_) < length ? (uint8_t)(PAYLOAD - filled_) : length;
+      memcpy(&slot(next_)[6 + filled_], data, n);
+      filled_ = (uint8_t)(filled_ + n);
+      data += n;
+      length = (uint8_t)(length - n);
+      if (filled_ == PAYLOAD) {
+        close();
+      }
+    }
+  }
+
+  // Call from loop(): sends a half-full block once it has waited FLUSH_MS
+  void service() {
+    if (filled_ > 0 && hal::millis() - openedAt_ >= FLUSH_MS) {
+      close();
+    }
+  }
+
+  // Sends the block being filled now, for lines that mustn't wait FLUSH_MS
+  void flush() {
+    if (filled_ > 0) {
+      close();
+    }
+  }
+
+  // The computer asks for a block again
+  void resend(uint16_t sequence) {
+    uint16_t age = (uint16_t)(next_ - sequence);
+    if (age == 0 || age >= 0x8000) {
+      return;  // not sent yet, the request must be garbled
+    }
+    if (age < WINDOW) {
+      uint8_t *block = slot(sequence);
+      write(block, (uint8_t)(OVERHEAD + block[5]));
+    } else {
+      uint8_t gap[OVERHEAD];
+      frame(gap, 'G', sequence, 0);
+      write(gap, OVERHEAD);
+    }
+  }
+
+private:
+  uint8_t *slot(uint16_t sequence) { return blocks_[sequence % WINDOW]; }
+
+  // Header and CRC around the payload that is already in place
+  static void frame(uint8_t *block, char type, uint16_t sequence, uint8_t length) {
+    block[0] = 0xA5;
+    block[1] = 0x5A;
+    block[2] = (uint8_t)type;
+    block[3] = (uint8_t)sequence;
+    block[4] = (uint8_t)(sequence >> 8);
+    block[5] = length;
+    uint16_t crc = crc16(&block[2], (uint16_t)(4 + length));
+    block[6 + length] = (uint8_t)crc;
+    block[7 + length] = (uint8_t)(crc >> 8);
+  }
+
+  void close() {
+    if (!started_) {
+      uint8_t start[OVERHEAD];
+      frame(start, 'S', 0, 0);
+      write(start, OVERHEAD);
+      started_ = true;
+    }
+    uint8_t *block = slot(next_);
+    frame(block, 'D', next_, filled_);
+    next_++;
+    filled_ = 0;
+    write(block, (uint8_t)(OVERHEAD + block[5]));
+  }
+
+  // Waits for room in the transmit buffer, like Line::send()
+  static void write(const uint8_t *data, uint8_t length) {
+    while (length > 0) {
+      size_t sent = hal::linkWrite(data, length);
+      data += sent;
+      length = (uint8_t)(length - sent);
+    }
+  }
+
+  uint8_t blocks_[WINDOW][PAYLOAD + OVERHEAD];
+  uint16_t next_;           // sequence number of the block being filled
+  uint8_t filled_;          // payload bytes in it
+  unsigned long openedAt_;  // millis() when its first byte came
+  bool started_;            // the start block has gone out
+};
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * Sampling: the scan queue between the timer interrupt and loop()
+ *
+ * Part of main.cpp, included after its settings and alarms.h. The sample timer runs a tick
+ * once every sample period: scanTick() reads every channel, the modes that need more build
+ * their own tick from tickBegin(), readChannels() and queueSlot(). loop() takes the scans
+ * out again with nextScan(). Also the lines most modes share: the header, #OFFSETS and the
+ * scan as comma separated values.
+ */
+
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+// One scan of all the channels
+struct Scan {
+  uint32_t time;                  // millis() when the scan started
+  uint16_t value[NUM_CHANNELS];
+#if DAQ_MODE == MODE_LOCKIN
+  uint8_t step;                   // step of the reference wave
+#elif DAQ_MODE == MODE_MULTIRATE
+  uint32_t due;                   // bit i set if channel i was read in this scan
+#endif
+#if USE_COUNTER
+  uint32_t edges;                 // on the counter pin during the gate
+  uint8_t gate;                   // sample periods, COUNTER_GATE once the stream has run that long
+#endif
+};
+
+// Queue between the timer interrupt (which adds scans) and loop() (which prints them)
+const uint8_t QUEUE_LENGTH = 8;   // Must be a power of two
+volatile Scan queue[QUEUE_LENGTH];
+volatile uint8_t queueHead = 0;   // next scan to print
+volatile uint8_t queueTail = 0;   // next free slot
+volatile uint16_t missedSamples = 0;
+volatile uint32_t tickTime = 0;   // millis() at the last timer tick, the time stamp of its scan
+
+// The counter field: a comma, up to 7 digits of Hz (6 MHz), a point and 2 decimals
+const uint32_t COUNTER_BYTES = USE_COUNTER ? 11 : 0;
+
+#if USE_COUNTER
+// Counter readings of the last COUNTER_GATE ticks, counterNext is the oldest
+uint32_t counterHistory[COUNTER_GATE];
+uint8_t counterNext = 0;
+uint8_t counterTicks = 0;         // since the stream started, up to COUNTER_GATE
+uint32_t counterEdges = 0;        // during the gate that ended with the last tick
+#endif
+
+#if SYNC_ROLE != SYNC_OFF
+void syncTick();  // see sync.h
+#endif
+
+// Reads all the channels. If times isn't 0 it gets when each channel was sampled (see adcScan).
+void readChannels(uint16_t *values, uint16_t *times) {
+  if (LOW_POWER) {
+    hal::adcPower(true);
+  }
+  hal::adcScan(settings.channels, NUM_CHANNELS, values, times);
+  if (LOW_POWER) {
+    hal::adcPower(false);
+  }
+}
+
+// Starts every tick, also the ones that don't read anything
+void tickBegin() {
+  tickTime = hal::millis();  // also when the scan is skipped, events still refer to this tick
+#if USE_COUNTER
+  // First, so the gate is as exact as the sample timer
+  uint32_t count = hal::counterRead();
+  counterEdges = count - counterHistory[counterNext];
+  counterHistory[counterNext] = count;
+  counterNext = (uint8_t)(counterNext + 1 == COUNTER_GATE ? 0 : counterNext + 1);
+  if (counterTicks < COUNTER_GATE) {
+    counterTicks++;
+  }
+#endif
+#if SYNC_ROLE != SYNC_OFF
+  syncTick();
+#endif
+}
+
+// The free slot at the end of the queue, with the time stamp, the values and the counter
+// filled in. Returns 0 if the queue is full. queuePush() adds the slot to the queue.
+volatile Scan *queueSlot(const uint16_t *values) {
+  uint8_t next = (queueTail + 1) & (QUEUE_LENGTH - 1);
+  if (next == queueHead) {
+    missedSamples++;  // loop() is behind, the serial port can't keep up with this sample rate
+    return 0;
+  }
+  volatile Scan &scan = queue[queueTail];
+  scan.time = tickTime;
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    scan.value[i] = values[i];
+  }
+#if USE_COUNTER
+  scan.edges = counterEdges;
+  scan.gate = counterTicks;
+#endif
+  return &scan;
+}
+
+void queuePush() {
+  queueTail = (queueTail + 1) & (QUEUE_LENGTH - 1);
+}
+
+// Runs from the timer interrupt once every sample period, in the modes that read every
+// channel on every tick
+void scanTick() {
+  tickBegin();
+  // Read and check the channels even if the scan can't be queued, the alarms still count
+  uint16_t values[NUM_CHANNELS];
+  readChannels(values, 0);
+  checkAlarms(tickTime, values, 0xFFFFFFFFUL);
+  if (queueSlot(values)) {
+    queuePush();
+  }
+}
+
+// Starts the sample timer with tick. The timer must be stopped.
+void startSampling(void (*tick)()) {
+#if USE_COUNTER
+  // The first gates start here and grow to COUNTER_GATE periods
+  uint32_t count = hal::counterRead();
+  for (uint8_t i = 0; i < COUNTER_GATE; i++) {
+    counterHistory[i] = count;
+  }
+  counterNext = 0;
+  counterTicks = 0;
+#endif
+  hal::timerStart(settings.samplePeriod * 1000UL, tick);
+}
+
+// For startStream(), with interrupts off
+void resetScans() {
+  queueHead = queueTail = 0;
+  missedSamples = 0;
+  tickTime = hal::millis();
+}
+
+// Takes the oldest scan out of the queue. Returns false if the queue is empty.
+bool nextScan(Scan &scan) {
+  if (queueHead == queueTail) {
+    return false;
+  }
+  const volatile Scan &queued = queue[queueHead];
+  scan.time = queued.time;
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    scan.value[i] = queued.value[i];
+  }
+#if DAQ_MODE == MODE_LOCKIN
+  scan.step = queued.step;
+#elif DAQ_MODE == MODE_MULTIRATE
+  scan.due = queued.due;
+#endif
+#if USE_COUNTER
+  scan.edges = queued.edges;
+  scan.gate = queued.gate;
+#endif
+  queueHead = (queueHead + 1) & (QUEUE_LENGTH - 1);
+  return true;
+}
+
+// Microseconds with three decimals, from the nanoseconds (a float would round them)
+void addMicroseconds(Line &line, uint32_t ns) {
+  uint32_t fraction = ns % 1000;
+  line.number(ns / 1000).character('.');
+  line.character((char)('0' + fraction / 100)).character((char)('0' + fraction / 10 % 10));
+  line.character((char)('0' + fraction % 10));
+}
+
+#if USE_COUNTER
+// The counter field of a scan: Hz with two decimals, rounded
+void addCounter(Line &line, const Scan &scan) {
+  uint32_t gateMs = (uint32_t)scan.gate * settings.samplePeriod;
+  uint64_t centiHz = gateMs == 0 ? 0 : ((uint64_t)scan.edges * 100000UL + gateMs / 2) / gateMs;
+  uint8_t fraction = (uint8_t)(centiHz % 100);
+  line.comma().number((uint32_t)(centiHz / 100)).character('.');
+  line.character((char)('0' + fraction / 10)).character((char)('0' + fraction % 10));
+}
+#endif
+
+// Prints "Time (ms),Sensor 0 (raw),..." for the scans as sendScan() prints them
+void sendHeader() {
+  Line header;
+  header.text("Time (ms)");
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    header.text(",Sensor ").number(settings.channels[i]).text(" (raw)");
+  }
+#if USE_COUNTER
+  header.text(",Counter (Hz)");
+#endif
+  header.send(); // Print header for data
+}
+
+// Prints one scan as a line of comma separated values
+void sendScan(const Scan &scan) {
+  Line line;
+  line.number(scan.time);
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    line.comma().number(scan.value[i]);
+  }
+#if USE_COUNTER
+  addCounter(line, scan);
+#endif
+  line.send();
+}
+
+// The channels of a scan are read one after the other, so each one is sampled a little later
+// than the time stamp. Prints "#OFFSETS,us,us,..." with the average delay of every channel over
+// a few scans, so the computer can shift the channels back to the same instant.
+void sendOffsets() {
+  const uint8_t SCANS = 8;
+  uint32_t sum[NUM_CHANNELS] = {0};
+  uint16_t values[NUM_CHANNELS];
+  uint16_t times[NUM_CHANNELS];
+  readChannels(values, times);  // the first conversion after power-on takes longer, skip it
+  for (uint8_t n = 0; n < SCANS; n++) {
+    {
+      hal::IrqGuard guard;  // so an interrupt can't stretch the boards that time the scan with micros()
+      readChannels(values, times);
+    }
+    for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+      sum[i] += times[i];
+    }
+  }
+  Line line;
+  line.text("#OFFSETS");
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    line.comma().number((sum[i] + SCANS / 2) / SCANS);
+  }
+  line.send();
+}
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * Summary statistics for long-term monitoring
+ *
+ * Instead of printing every scan, SummaryWindow collects the scans of one window (for
+ * example 1 second) and prints a single line with the number of samples and the minimum,
+ * maximum, mean and RMS of each channel. Everything is added up in integers, so it is
+ * fast and exact even on the Uno; the only division happens once per window.
+ *
+ * It can also keep a short raw recording (a "burst") around anything unusual: when a
+ * sample is more than a threshold away from the previous window's mean, the raw scans
+ * from just before until just after that moment are printed after the summary line as
+ * "#RAW,time,value,value,..." lines. The burst is sent a line at a time from service()
+ * whenever the serial port has room, so it never holds up sampling.
+ */
+
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <stdint.h>
+#include "line.h"
+
+// Integer square root of a 64 bit number (rounded down)
+inline uint32_t isqrt64(uint64_t n) {
+  uint64_t root = 0;
+  uint64_t bit = (uint64_t)1 << 62;
+  while (bit > n) bit >>= 2;
+  while (bit != 0) {
+    if (n >= root + bit) {
+      n -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)root;
+}
+
+template <uint8_t CHANNELS, uint8_t BURST_LENGTH>
+class SummaryWindow {
+public:
+  // threshold: raw counts away from the last mean that start a burst (0 = never)
+  // preSamples: how many of the BURST_LENGTH scans come from before the trigger
+  SummaryWindow(uint16_t threshold, uint8_t preSamples)
+    : threshold_(threshold), pre_(preSamples < BURST_LENGTH ? preSamples : BURST_LENGTH - 1),
+      haveReference_(false) {
+    clear();
+  }
+
+  // Adds one scan, taken at time (ms)
+  void add(uint32_t time, const uint16_t *values) {
+    if (count_ == 0) start_ = time;
+    count_++;
+
+    bool trigger = false;
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      uint16_t v = values[c];
+      if (v < min_[c]) min_[c] = v;
+      if (v > max_[c]) max_[c] = v;
+      sum_[c] += v;
+      sumSquares_[c] += (uint32_t)v * v;
+      if (threshold_ > 0 && haveReference_) {
+        int32_t diff = (int32_t)v - (int32_t)reference_[c];
+        if (diff > (int32_t)threshold_ || diff < -(int32_t)threshold_) trigger = true;
+      }
+    }
+    record(time, values, trigger);
+  }
+
+  uint32_t count() const { return count_; }
+
+  // Prints the summary line (and a burst if one was captured), then starts a new window
+  void emit() {
+    if (count_ == 0) return;
+
+    Line line;
+    line.number(start_).comma().number(count_);
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      // mean and RMS with two decimals, calculated as integers x100
+      uint32_t mean100 = (uint32_t)(((uint64_t)sum_[c] * 100 + count_ / 2) / count_);
+      uint32_t rms100 = isqrt64(sumSquares_[c] * 10000 / count_);
+      line.comma().number(min_[c]).comma().number(max_[c]);
+      line.comma().number(mean100 / 100).character('.').number((mean100 % 100) / 10).number(mean100 % 10);
+      line.comma().number(rms100 / 100).character('.').number((rms100 % 100) / 10).number(rms100 % 10);
+      reference_[c] = (uint16_t)(mean100 / 100);
+    }
+    line.send();
+    haveReference_ = true;
+
+    if (frozen_) {
+      sending_ = true;
+      sendIndex_ = (uint8_t)((burstNext_ + BURST_LENGTH - burstFilled_) % BURST_LENGTH);
+    }
+    clear();
+  }
+
+  // Call from loop(): sends the next lines of a captured burst if the link has room
+  void service() {
+    while (sending_) {
+      if (burstFilled_ == 0) {
+        sending_ = false;
+        triggered_ = false;
+        frozen_ = false;
+        return;
+      }
+      Line line;
+      line.text("#RAW,").number(burstTime_[sendIndex_]);
+      for (uint8_t c = 0; c < CHANNELS; c++) line.comma().number(burst_[sendIndex_][c]);
+      if (hal::linkWritable() < (size_t)line.length() + 2) return; // try again next loop
+      line.send();
+      sendIndex_ = (uint8_t)((sendIndex_ + 1) % BURST_LENGTH);
+      burstFilled_--;
+    }
+  }
+
+  // Header for the summary columns, e.g. "Time (ms),Samples,S0 min,S0 max,S0 mean,S0 rms,..."
+  static void sendHeader(const uint8_t *channelPins) {
+    Line header;
+    header.text("Time (ms),Samples");
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      header.text(",S").number(channelPins[c]).text(" min");
+      header.text(",S").number(channelPins[c]).text(" max");
+      header.text(",S").number(channelPins[c]).text(" mean");
+      header.text(",S").number(channelPins[c]).text(" rms");
+    }
+    header.send();
+  }
+
+private:
+  // The burst buffer is a ring that always holds the latest scans. After a trigger it keeps
+  // recording until the scans after the trigger fill the rest of it, then it freezes.
+  void record(uint32_t time, const uint16_t *values, bool trigger) {
+    if (threshold_ == 0 || frozen_) return;
+    for (uint8_t c = 0; c < CHANNELS; c++) burst_[burstNext_][c] = values[c];
+    burstTime_[burstNext_] = time;
+    burstNext_ = (uint8_t)((burstNext_ + 1) % BURST_LENGTH);
+    if (burstFilled_ < BURST_LENGTH) burstFilled_++;
+
+    if (!triggered_ && trigger) {
+      triggered_ = true;
+      postLeft_ = (uint8_t)(BURST_LENGTH - pre_ - 1);
+    } else if (triggered_ && postLeft_ > 0) {
+      postLeft_--;
+    }
+    if (triggered_ && postLeft_ == 0) frozen_ = true;
+  }
+
+  void clear() {
+    count_ = 0;
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+      min_[c] = 0xFFFF;
+      max_[c] = 0;
+      sum_[c] = 0;
+      sumSquares_[c] = 0;
+    }
+    // A burst that is still recording carries on into the next window, and a finished one
+    // stays frozen until service() has sent it. Otherwise only the newest scans are kept,
+    // as the history for the next trigger.
+    if (!triggered_ && burstFilled_ > pre_) {
+      burstFilled_ = pre_;
+    }
+  }
+
+  uint16_t threshold_;
+  uint8_t pre_;
+  uint32_t start_;
+  uint32_t count_;
+  uint16_t min_[CHANNELS];
+  uint16_t max_[CHANNELS];
+  uint32_t sum_[CHANNELS];
+  uint64_t sumSquares_[CHANNELS];
+  uint16_t reference_[CHANNELS];
+  bool haveReference_;
+
+  uint16_t burst_[BURST_LENGTH][CHANNELS];
+  uint32_t burstTime_[BURST_LENGTH];
+  uint8_t burstNext_ = 0;
+  uint8_t burstFilled_ = 0;
+  uint8_t postLeft_ = 0;
+  uint8_t sendIndex_ = 0;
+  bool triggered_ = false;
+  bool frozen_ = false;
+  bool sending_ = false;
+};
+
+#endif
@@ -0,0 +1,466 @@
+// Sample timer for AVR boards (Uno = ATmega328P, Leonardo = ATmega32U4).
+// Both chips have the same 16 bit Timer1, which we run in CTC mode so the hardware
+// restarts the count by itself and the sample period never drifts.
+// Its input capture unit latches the count when the ICP1 pin changes, which gives the event
+// capture the sample timer's own time base.
+// For equivalent-time sampling Timer1 counts freely instead: the capture of the trigger edge
+// sets compare match B a chosen delay later, and the match starts the ADC by itself.
+// With the frequency counter on the Uno, Timer1 counts the edges on its T1 pin instead and the
+// sample timer moves to the 8 bit Timer2: CTC at 1 kHz, and every few interrupts are a tick.
+//
+// The tick runs with interrupts on. Three conversions take over 300 us, and with interrupts
+// off that long the serial port loses received bytes at 115200 baud (the Uno only buffers two).
+// The scan is timed by the ADC itself (free running mode), so interrupts that come in between
+// don't move the samples.
+
+#if defined(ARDUINO_ARCH_AVR) && !defined(HAL_NATIVE)
+
+#include <Arduino.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include "hal.h"
+
+namespace hal {
+
+static void (*volatile tickHandler)() = 0;
+static void (*volatile captureHandler)(uint32_t, bool) = 0;
+static volatile Edge captureEdge = EDGE_RISING;
+static volatile uint16_t timerPrescaler = 1;
+static uint16_t timerTop = 0;        // OCR1A of a period without nudges
+static int32_t nudgeHalfNs = 0;      // nudges that haven't become timer steps yet, in 0.5 ns
+
+// Equivalent-time sampling, one timer step is one CPU clock
+static void (*volatile etsHandler)(uint16_t, uint32_t) = 0;
+static volatile uint16_t etsDelay = 0;       // clocks from the edge to holding the input
+static volatile bool etsArmed = false;
+static volatile bool etsSeen = false;        // etsLastEdge is valid
+static volatile uint16_t etsLastEdge = 0;
+static volatile uint16_t etsPeriod = 0;      // clocks between the last two edges, 0 = not known yet
+static uint8_t etsAdcsra = 0;                // ADCSRA before etsBegin()
+
+// Frequency counter, Timer1 counts the edges and its overflows the upper 16 bits
+static bool counterOn = false;
+static volatile uint16_t counterHigh = 0;
+#if !defined(__AVR_ATmega32U4__)
+static volatile uint16_t tickMillis = 1;     // Timer2 interrupts per sample tick
+static volatile uint16_t tickCount = 0;
+#endif
+
+static bool adcFresh = true;  // the next conversion is the first since the ADC was switched on
+
+// Runs the tick with the other interrupts on. The sample timer's and the capture's own
+// interrupts wait until it's done, so ticks and captures still run one at a time and in order.
+// Call from their interrupts (interrupts off).
+static void runTick() {
+  uint8_t timer1 = (uint8_t)(TIMSK1 & (_BV(OCIE1A) | _BV(ICIE1)));
+  TIMSK1 &= (uint8_t)~timer1;
+#if !defined(__AVR_ATmega32U4__)
+  uint8_t timer2 = (uint8_t)(TIMSK2 & _BV(OCIE2A));
+  TIMSK2 &= (uint8_t)~timer2;
+#endif
+  sei();
+  if (tickHandler) {
+    tickHandler();
+  }
+  cli();
+  TIMSK1 |= timer1;
+#if !defined(__AVR_ATmega32U4__)
+  TIMSK2 |= timer2;
+#endif
+}
+
+// ADCSRA's prescaler in CPU clocks per ADC clock
+static uint8_t adcPrescaler() {
+  uint8_t bits = ADCSRA & (_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0));
+  return (uint8_t)(bits == 0 ? 2 : 1 << bits);
+}
+
+// Selects the channel for the next conversion, the same mapping as analogRead()
+static void adcSelect(uint8_t channel) {
+#if defined(analogPinToChannel)
+  uint8_t mux = analogPinToChannel(channel);
+#else
+  uint8_t mux = channel;
+#endif
+#if defined(MUX5)
+  ADCSRB = (uint8_t)((ADCSRB & ~_BV(MUX5)) | (mux & 0x08 ? _BV(MUX5) : 0));
+#endif
+  ADMUX = (uint8_t)(_BV(REFS0) | (mux & 0x07));
+}
+
+// The conversions follow each other in free running mode: each one starts the moment the one
+// before is done, 13 ADC clocks (104 us at 16 MHz) apart whatever else the CPU is doing. The
+// ADC takes the channel over when a conversion starts, so the next one is selected while the
+// current one runs (at least one ADC clock in, and the loop has about 100 us for it).
+void adcScan(const uint8_t *channels, uint8_t count, uint16_t *values, uint16_t *times) {
+  if (count == 0) {
+    return;
+  }
+  const uint8_t prescaler = adcPrescaler();
+  const uint8_t clockUs = (uint8_t)(prescaler / (F_CPU / 1000000UL) + 1);
+  const uint8_t first = adcFresh ? 25 : 13;  // ADC clocks of the first conversion
+  adcFresh = false;
+
+  adcSelect(channels[0]);
+  ADCSRB &= (uint8_t)~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));  // free running
+  ADCSRA = (uint8_t)((ADCSRA & ~_BV(ADIE)) | _BV(ADIF) | _BV(ADSC) | (count > 1 ? _BV(ADATE) : 0));
+  for (uint8_t i = 0; i < count; i++) {
+    if (times) {
+      uint32_t clocks = i == 0 ? 0 : first + 13UL * (i - 1);
+      times[i] = (uint16_t)(clocks * prescaler / (F_CPU / 1000000UL));
+    }
+    delayMicroseconds(clockUs);  // into conversion i, its channel is locked
+    if (i + 1 < count) {
+      adcSelect(channels[i + 1]);
+    } else {
+      ADCSRA &= (uint8_t)~(_BV(ADATE) | _BV(ADIF));  // this is the last one
+    }
+    while (!(ADCSRA & _BV(ADIF))) {
+    }
+    ADCSRA |= _BV(ADIF);  // conversion i+1 has started by itself
+    values[i] = ADC;
+  }
+}
+
+// An auto-triggered conversion resets the ADC prescaler and holds the input two ADC clocks
+// (256 CPU clocks at /128) after the trigger, and the noise canceler delays the capture by 4
+// clocks. Both come off the delay. The match must also still be ETS_LEAD clocks ahead when
+// the capture interrupt sets it up.
+static const uint16_t ETS_LATENCY = 256 + 4;
+static const uint16_t ETS_LEAD = 64;
+
+// Capture bits of TCCR1B: the noise canceler (the edge must be stable for 4 clocks, which
+// adds a fixed 250 ns) and the edge to catch next
+static uint8_t captureBits() {
+  if (!captureHandler) return 0;
+  // For both edges start with the one the pin can make from where it is now
+  bool falling = captureEdge == EDGE_FALLING || (captureEdge == EDGE_BOTH && digitalRead(HAL_CAPTURE_PIN));
+  return (uint8_t)(_BV(ICNC1) | (falling ? 0 : _BV(ICES1)));
+}
+
+static uint8_t timerInterrupts() {
+  return (uint8_t)(_BV(OCIE1A) | (captureHandler ? _BV(ICIE1) : 0));
+}
+
+#if !defined(__AVR_ATmega32U4__)
+// Timer2 only has 8 bits, so it interrupts every millisecond (16 MHz / 64 / 250) and every
+// tickMillis-th interrupt is a tick. Timer1 is busy counting.
+static bool timer2Start(uint32_t period_us, void (*tick)()) {
+  if (period_us == 0 || period_us % 1000 != 0 || period_us / 1000 > 65535UL) {
+    return false;
+  }
+  timerStop();
+  tickHandler = tick;
+  tickMillis = (uint16_t)(period_us / 1000);
+  tickCount = 0;
+  TCCR2A = _BV(WGM21);  // CTC mode
+  TCCR2B = 0;
+  TCNT2 = 0;
+  OCR2A = (uint8_t)(F_CPU / 64 / 1000 - 1);
+  TIFR2 = _BV(OCF2A);
+  TIMSK2 = _BV(OCIE2A);
+  TCCR2B = _BV(CS22);   // clock / 64, start counting
+  return true;
+}
+#endif
+
+bool timerStart(uint32_t period_us, void (*tick)()) {
+#if !defined(__AVR_ATmega32U4__)
+  if (counterOn) {
+    return timer2Start(period_us, tick);
+  }
+#endif
+  static const uint16_t PRESCALERS[] = {1, 8, 64, 256, 1024};
+  static const uint8_t CLOCK_SELECT[] = {
+    _BV(CS10), _BV(CS11), _BV(CS11) | _BV(CS10), _BV(CS12), _BV(CS12) | _BV(CS10)};
+
+  // Use the smallest prescaler that divides the period exactly and still fits in 16 bits,
+  // otherwise the smallest one that fits (the period is then rounded to the nearest tick).
+  uint32_t cycles = (F_CPU / 1000000UL) * period_us;
+  int8_t choice = -1;
+  for (uint8_t i = 0; i < sizeof(PRESCALERS) / sizeof(PRESCALERS[0]); i++) {
+    uint32_t ticks = cycles / PRESCALERS[i];
+    if (ticks < 1 || ticks > 65536UL) continue;
+    if (cycles % PRESCALERS[i] == 0) { choice = i; break; }
+    if (choice < 0) choice = i;
+  }
+  if (choice < 0) {
+    return false; // longer than about 4.19 s at 16 MHz
+  }
+
+  timerStop();
+  tickHandler = tick;
+  timerPrescaler = PRESCALERS[choice];
+  uint32_t ticks = (cycles + PRESCALERS[choice] / 2) / PRESCALERS[choice];
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  timerTop = (uint16_t)(ticks - 1);
+  nudgeHalfNs = 0;
+  OCR1A = timerTop;
+  TIFR1 = _BV(OCF1A) | _BV(ICF1);
+  TIMSK1 = timerInterrupts();
+  TCCR1B = _BV(WGM12) | captureBits() | CLOCK_SELECT[choice]; // CTC mode, start counting
+  return true;
+}
+
+void timerStop() {
+#if !defined(__AVR_ATmega32U4__)
+  TCCR2B = 0;
+  TIMSK2 &= ~_BV(OCIE2A);
+#endif
+  if (counterOn) {
+    return;  // Timer1 keeps counting
+  }
+  TCCR1B = 0;
+  TIMSK1 &= ~(_BV(OCIE1A) | _BV(ICIE1));
+}
+
+// In CTC mode OCR1A isn't buffered, so moving it changes the period that is running. The
+// tick interrupt puts it back to timerTop for the next one.
+void timerNudge(int32_t ns) {
+  if (counterOn) {
+    return;  // Timer2's millisecond steps are too coarse, and a follower needs the capture anyway
+  }
+  IrqGuard guard;
+  const int32_t HALF_NS_PER_CYCLE = 2000000000L / F_CPU;  // 125 at 16 MHz
+  int32_t step = (int32_t)timerPrescaler * HALF_NS_PER_CYCLE;
+  nudgeHalfNs += ns * 2;  // up to 1 s per call
+  int32_t top = (int32_t)OCR1A + nudgeHalfNs / step;
+  int32_t earliest = (int32_t)TCNT1 + 8;  // the match must still be ahead of the count
+  if (top < earliest) top = earliest;
+  if (top > 65535) top = 65535;
+  nudgeHalfNs -= (top - (int32_t)OCR1A) * step;
+  OCR1A = (uint16_t)top;
+}
+
+bool captureBegin(Edge edge, void (*handler)(uint32_t, bool)) {
+  if (counterOn) {
+    return false;  // Timer1 counts the edges of the counter pin
+  }
+  IrqGuard guard;
+  captureEdge = edge;
+  captureHandler = handler;
+  TCCR1B = (uint8_t)((TCCR1B & ~(_BV(ICNC1) | _BV(ICES1))) | captureBits());
+  TIFR1 = _BV(ICF1);  // changing the edge can set the flag
+  if (TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10))) {
+    TIMSK1 = timerInterrupts();  // only while the timer runs, timerStart() switches it on otherwise
+  }
+  return true;
+}
+
+void captureStop() {
+  IrqGuard guard;
+  TIMSK1 &= ~_BV(ICIE1);
+  captureHandler = 0;
+}
+
+bool etsBegin(uint8_t channel, Edge edge, void (*done)(uint16_t, uint32_t)) {
+  if (edge == EDGE_BOTH || counterOn) {
+    return false;  // one trigger per period, and Timer1 must be free
+  }
+  timerStop();
+  captureStop();
+  IrqGuard guard;
+  etsHandler = done;
+  etsArmed = false;
+  etsSeen = false;
+  etsPeriod = 0;
+
+  // The same channel setup as analogRead(), with Timer1 compare match B as the trigger
+#if defined(analogPinToChannel)
+  uint8_t mux = analogPinToChannel(channel);
+#else
+  uint8_t mux = channel;
+#endif
+#if defined(MUX5)
+  ADCSRB = (uint8_t)((mux & 0x08 ? _BV(MUX5) : 0) | _BV(ADTS2) | _BV(ADTS0));
+#else
+  ADCSRB = _BV(ADTS2) | _BV(ADTS0);
+#endif
+  ADMUX = (uint8_t)(_BV(REFS0) | (mux & 0x07));
+  etsAdcsra = ADCSRA;
+  // Auto triggering (ADATE) is only switched on while a conversion is armed, otherwise every
+  // lap of the timer past OCR1B would start one
+  ADCSRA = _BV(ADEN) | _BV(ADIF) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  TIFR1 = _BV(ICF1) | _BV(OCF1B);
+  TIMSK1 = _BV(ICIE1);
+  TCCR1B = (uint8_t)(_BV(ICNC1) | (edge == EDGE_RISING ? _BV(ICES1) : 0) | _BV(CS10)); // normal mode, clock / 1
+  return true;
+}
+
+void etsArm(uint32_t delayNs) {
+  uint32_t clocks = (delayNs * (F_CPU / 1000000UL) + 500) / 1000;
+  IrqGuard guard;
+  etsDelay = (uint16_t)(clocks > 65535 ? 65535 : clocks);
+  etsArmed = true;
+}
+
+void etsStop() {
+  IrqGuard guard;
+  TCCR1B = 0;
+  TIMSK1 &= ~_BV(ICIE1);
+  ADCSRA = etsAdcsra;  // analogRead() polls, without the interrupt or auto triggering
+  ADCSRB = 0;
+  etsHandler = 0;
+}
+
+// From the capture interrupt: measures the period, and sets up the armed conversion
+static void etsEdge(uint16_t edge) {
+  if (etsSeen) {
+    etsPeriod = (uint16_t)(edge - etsLastEdge);
+  }
+  etsSeen = true;
+  etsLastEdge = edge;
+  if (!etsArmed) {
+    return;
+  }
+  uint16_t at = (uint16_t)(edge + etsDelay - ETS_LATENCY);
+  int32_t ahead = (int32_t)etsDelay - ETS_LATENCY - (uint16_t)(TCNT1 - edge);
+  if (ahead < ETS_LEAD) {
+    // Too soon after this edge: hold the input the same time after the next one
+    if (etsPeriod == 0 || (uint32_t)etsDelay + etsPeriod > 65535UL - ETS_LATENCY) {
+      return;  // stays armed for the next edge
+    }
+    at = (uint16_t)(at + etsPeriod);
+    ahead += etsPeriod;
+    if (ahead < ETS_LEAD) {
+      return;
+    }
+  }
+  OCR1B = at;
+  TIFR1 = _BV(OCF1B);
+  ADCSRA |= _BV(ADATE);
+  etsArmed = false;
+}
+
+bool counterBegin() {
+#if defined(__AVR_ATmega32U4__)
+  return false;  // Timer3 could take over the sample timer, but nobody has needed it yet
+#else
+  timerStop();
+  captureStop();
+  IrqGuard guard;
+  pinMode(HAL_COUNTER_PIN, INPUT);
+  TIMSK1 = 0;
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  counterHigh = 0;
+  TIFR1 = _BV(TOV1) | _BV(OCF1A) | _BV(ICF1);
+  TIMSK1 = _BV(TOIE1);
+  TCCR1B = _BV(CS12) | _BV(CS11) | _BV(CS10);  // normal mode, clocked by rising edges on T1
+  counterOn = true;
+  return true;
+#endif
+}
+
+uint32_t counterRead() {
+  IrqGuard guard;
+  uint16_t low = TCNT1;
+  uint16_t high = counterHigh;
+  // An overflow that hasn't had its interrupt yet (we may be in another interrupt) belongs to
+  // this count if the counter has just wrapped
+  if ((TIFR1 & _BV(TOV1)) && low < 0x8000) {
+    high++;
+  }
+  return ((uint32_t)high << 16) | low;
+}
+
+// Idle sleep stops only the CPU clock, so Timer1, the ADC and the serial port keep working.
+// Timer0 (millis) still wakes us up every 1.024 ms.
+void idle() {
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sleep_cpu();
+  sleep_disable();
+}
+
+void adcPower(bool on) {
+  if (on) {
+    power_adc_enable();
+    ADCSRA |= _BV(ADEN); // the first conversion after this takes 25 instead of 13 ADC clocks
+    adcFresh = true;
+  } else {
+    ADCSRA &= ~_BV(ADEN);
+    power_adc_disable();
+  }
+}
+
+void powerSaveBegin() {
+  power_spi_disable();
+  power_twi_disable();
+  ACSR |= _BV(ACD); // analog comparator off
+  DIDR0 = 0x3F;     // digital input buffers on A0 - A5 off, they only waste power on analog signals
+}
+
+IrqGuard::IrqGuard() : state_(SREG) { cli(); }
+IrqGuard::~IrqGuard() { SREG = (uint8_t)state_; }
+
+} // namespace hal
+
+ISR(TIMER1_COMPA_vect) {
+  OCR1A = hal::timerTop;
+  hal::runTick();
+}
+
+ISR(TIMER1_CAPT_vect) {
+  uint16_t count = ICR1;
+  if (hal::etsHandler) {
+    hal::etsEdge(count);
+    return;
+  }
+  bool rising = TCCR1B & _BV(ICES1);
+  if (hal::captureEdge == hal::EDGE_BOTH) {
+    TCCR1B ^= _BV(ICES1);  // catch the opposite edge next
+    TIFR1 = _BV(ICF1);
+  }
+  // The capture interrupt goes first when both are waiting. If the count restarted before the
+  // edge, the edge belongs to the next period: run its tick now so the order stays right.
+  if ((TIFR1 & _BV(OCF1A)) && count < OCR1A / 2) {
+    TIFR1 = _BV(OCF1A);
+    OCR1A = hal::timerTop;
+    hal::runTick();
+  }
+  // Timer steps to nanoseconds without overflowing 32 bits (125 ns per 2 cycles at 16 MHz)
+  uint32_t cycles = (uint32_t)count * hal::timerPrescaler;
+  const uint32_t NS_PER_2_CYCLES = 2000000000UL / F_CPU;
+  uint32_t ns = (cycles >> 1) * NS_PER_2_CYCLES + (cycles & 1) * NS_PER_2_CYCLES / 2;
+  if (hal::captureHandler) {
+    hal::captureHandler(ns, rising);
+  }
+}
+
+ISR(TIMER1_OVF_vect) {
+  hal::counterHigh++;
+}
+
+#if !defined(__AVR_ATmega32U4__)
+// The tone() function uses Timer2 as well, so the sketch can't call it
+ISR(TIMER2_COMPA_vect) {
+  if (++hal::tickCount < hal::tickMillis) {
+    return;
+  }
+  hal::tickCount = 0;
+  hal::runTick();
+}
+#endif
+
+// An equivalent-time conversion is done
+ISR(ADC_vect) {
+  uint16_t value = ADC;
+  ADCSRA &= ~_BV(ADATE);
+  TIFR1 = _BV(OCF1B);  // the trigger only fires again once the flag is cleared
+  uint32_t clocks = hal::etsPeriod;
+  const uint32_t NS_PER_2_CLOCKS = 2000000000UL / F_CPU;
+  uint32_t periodNs = (clocks >> 1) * NS_PER_2_CLOCKS + (clocks & 1) * NS_PER_2_CLOCKS / 2;
+  if (hal::etsHandler) {
+    hal::etsHandler(value, periodNs);
+  }
+}
+
+#endif
@@ -0,0 +1,503 @@
+// Simulated board for the native environments: the sketch runs on your computer.
+//
+// Time is simulated, so a 10 second run finishes in a fraction of a second and gives the
+// same output every time. The analog inputs produce test signals, the serial link is your
+// terminal (output goes to stdout, commands can be typed or piped into stdin). The capture pin
+// sees a rising edge at the start of every impact on A0 and a falling edge 5 ms later, like
+// a contact switch, so the event capture can be checked against the signal. The link sends
+// at the baud rate given to linkBegin() from a 64 byte transmit buffer, like the Uno's, so a
+// sketch that prints more than the link can carry falls behind just like on the real board.
+// Build with -D HAL_NATIVE_LINK_ERRORS=N to garble one byte in N on the way out, like a noisy
+// USB-serial bridge, to try the reliable link. With -D HAL_NATIVE_SYNC_PPM=N the capture pin
+// gets the sync pulses of a leader board whose clock is N ppm off instead, to try a follower.
+// While equivalent-time sampling runs, the capture pin sees the rising edges of the 2 kHz
+// signal on A3 instead. The counter pin sees a motor spinning up to 50 kHz (a tachometer wheel
+// with many teeth) with a time constant of 2 s.
+//
+// Run with: pio run -e native_uno -t exec
+// The simulated run time in seconds can be passed as the first argument (default 2 s).
+// The unit tests in test/ run on it too (pio test -e native_uno), they drive the simulated
+// time themselves with native::runUntil() and read the link output from native::linkOutput.
+//
+// At the end it prints a power report to stderr: how much of the time the CPU was awake and
+// the ADC switched on, and the average current that works out to with the board's typical
+// datasheet currents (the chip only, not the regulator, USB chip or LEDs on the board).
+// Try it with different sample periods to see the current budget of a battery logger:
+//   echo "set period 100" | .pio/build/native_uno/program 60
+
+#if defined(HAL_NATIVE)
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(_WIN32)
+  #include <poll.h>
+  #include <unistd.h>
+#endif
+
+#include "hal.h"
+
+// How long one pass through loop() takes when there is nothing to do, in microseconds
+#ifndef HAL_NATIVE_LOOP_US
+  #define HAL_NATIVE_LOOP_US 10
+#endif
+
+// One byte in this many gets a bit flipped on the link (0 = never)
+#ifndef HAL_NATIVE_LINK_ERRORS
+  #define HAL_NATIVE_LINK_ERRORS 0
+#endif
+
+// How often the board's millis() tick wakes the CPU from idle(), in microseconds (0 = never)
+#ifndef HAL_NATIVE_WAKE_US
+  #define HAL_NATIVE_WAKE_US 1024
+#endif
+
+// Typical supply current of the chip in mA: running, in idle sleep, and extra for the ADC
+#ifndef HAL_ACTIVE_MA
+  #define HAL_ACTIVE_MA 9.0
+#endif
+#ifndef HAL_IDLE_MA
+  #define HAL_IDLE_MA 2.7
+#endif
+#ifndef HAL_ADC_MA
+  #define HAL_ADC_MA 0.3
+#endif
+
+void setup();
+void loop();
+
+namespace hal {
+namespace native {
+
+uint64_t nowUs = 0;
+
+static void (*tickHandler)() = 0;
+static uint32_t tickPeriodUs = 0;
+static uint64_t nextTickUs = 0;
+static uint64_t lastTickUs = 0;
+static int32_t nudgeNs = 0;         // nudges that haven't become whole microseconds yet
+
+static void (*captureHandler)(uint32_t, bool) = 0;
+static Edge captureEdge = EDGE_RISING;
+
+static void (*etsHandler)(uint16_t, uint32_t) = 0;
+static uint8_t etsChannel = 0;
+static bool etsArmed = false;
+static uint64_t etsDoneUs = 0;      // when the armed conversion is finished
+static uint16_t etsValue = 0;
+
+static uint64_t counterStartUs = 0;
+
+static const uint8_t MAX_PINS = 32;
+static bool pinLevel[MAX_PINS];
+static void (*edgeHandler[MAX_PINS])();
+static Edge edgeKind[MAX_PINS];
+static uint8_t pwmDuty[MAX_PINS];
+
+// Serial link model: bytes leave the transmit buffer at baud / 10 per second
+static const uint16_t LINK_BUFFER = 64;
+static uint32_t linkBaud = HAL_DEFAULT_BAUD;
+static double linkQueued = 0;       // bytes still in the transmit buffer
+#if HAL_NATIVE_LINK_ERRORS > 0
+static uint32_t linkNoise = 2463534242UL;  // xorshift state for the link errors, same every run
+#endif
+static uint64_t linkUpdatedUs = 0;
+FILE *linkOutput = 0;               // where the link's bytes go, 0 = stdout
+
+static void linkDrain() {
+  linkQueued -= (nowUs - linkUpdatedUs) * (linkBaud / 10.0) / 1e6;
+  if (linkQueued < 0) linkQueued = 0;
+  linkUpdatedUs = nowUs;
+}
+
+// Power accounting
+static uint64_t idleUs = 0;       // time spent in idle()
+static uint64_t adcOnUs = 0;      // time the ADC was switched on, up to adcChangedUs
+static uint64_t adcChangedUs = 0;
+static bool adcOn = false;
+static bool adcWaking = false;    // the first conversion after switching on takes longer
+
+// 1 KB of simulated EEPROM, erased (all 0xFF) at the start of every run like a new board
+static const uint16_t NV_SIZE = 1024;
+static uint8_t nvMemory[NV_SIZE];
+
+static uint8_t *nvBytes() {
+  static bool erased = false;
+  if (!erased) {
+    memset(nvMemory, 0xFF, NV_SIZE);
+    erased = true;
+  }
+  return nvMemory;
+}
+
+// A1 also picks up a tiny 4 mV response to the PWM output on this pin, smaller than one
+// ADC step, so the lock-in mode has something to find under the 50 Hz pickup.
+static const uint8_t RESPONSE_PIN = 3;
+
+// Test signals in volts (0 - 5 V) for each analog channel:
+//   A0  a slow 2 Hz sine with a short decaying 40 Hz "impact" every 3 seconds
+//   A1  a 50 Hz sine, like mains pickup (plus the response to the PWM on RESPONSE_PIN)
+//   A2  a slow ramp that steps every second, like a temperature
+//   A3  a 2 kHz square wave through an RC filter (40 us), like a PWM driven actuator. Its
+//       rising edges are 0.3 us past whole microseconds, so equivalent-time steps finer than
+//       the simulated clock still show.
+//   A4+ constant mid-scale
+static const double PWM_PERIOD_US = 500.0;
+static const double PWM_FIRST_US = 0.3;
+static const double PWM_TAU_US = 40.0;
+
+static double signalVolts(uint8_t channel, double t) {
+  const double PI = 3.14159265358979;
+  switch (channel) {
+    case 0: {
+      double v = 2.5 + 1.0 * sin(2 * PI * 2.0 * t);
+      double since = fmod(t, 3.0) - 1.0;
+      if (since >= 0) v += 2.0 * exp(-since * 8.0) * sin(2 * PI * 40.0 * since);
+      return v;
+    }
+    case 1:
+      return 2.5 + 0.5 * sin(2 * PI * 50.0 * t) + 0.004 * (pwmDuty[RESPONSE_PIN] - 127.5) / 127.5;
+    case 2:
+      return 1.0 + 0.05 * floor(t);
+    case 3: {
+      double phase = fmod(t * 1e6 - PWM_FIRST_US + PWM_PERIOD_US, PWM_PERIOD_US);
+      double half = PWM_PERIOD_US / 2;
+      return phase < half ? 5.0 * (1 - exp(-phase / PWM_TAU_US)) : 5.0 * exp(-(phase - half) / PWM_TAU_US);
+    }
+    default:
+      return 2.5;
+  }
+}
+
+// Edges on the capture pin: the impacts on A0 start at 1 s and come every 3 s, the
+// simulated switch stays closed for 5 ms
+static const uint64_t IMPACT_FIRST_US = 1000000;
+static const uint64_t IMPACT_EVERY_US = 3000000;
+static const uint64_t CONTACT_US = 5000;
+
+#if defined(HAL_NATIVE_SYNC_PPM)
+// Sync pulses from a leader board instead: 1 ms wide, every HAL_NATIVE_SYNC_MS on a clock
+// that runs HAL_NATIVE_SYNC_PPM parts per million fast (negative: slow) against ours
+#ifndef HAL_NATIVE_SYNC_MS
+  #define HAL_NATIVE_SYNC_MS 1000
+#endif
+static const uint64_t SYNC_FIRST_US = 700300;
+static const uint64_t SYNC_WIDTH_US = 1000;
+
+static uint64_t nextEdgeUs(uint64_t after, bool &rising) {
+  const double every = HAL_NATIVE_SYNC_MS * 1000.0 / (1.0 + HAL_NATIVE_SYNC_PPM * 1e-6);
+  uint64_t n = after < SYNC_FIRST_US ? 0 : (uint64_t)((after - SYNC_FIRST_US) / every);
+  for (;; n++) {
+    uint64_t pulse = SYNC_FIRST_US + (uint64_t)(n * every + 0.5);
+    if (pulse > after) { rising = true; return pulse; }
+    if (pulse + SYNC_WIDTH_US > after) { rising = false; return pulse + SYNC_WIDTH_US; }
+  }
+}
+#else
+static uint64_t nextEdgeUs(uint64_t after, bool &rising) {
+  uint64_t n = after < IMPACT_FIRST_US ? 0 : (after - IMPACT_FIRST_US) / IMPACT_EVERY_US;
+  for (;; n++) {
+    uint64_t impact = IMPACT_FIRST_US + n * IMPACT_EVERY_US;
+    if (impact > after) { rising = true; return impact; }
+    if (impact + CONTACT_US > after) { rising = false; return impact + CONTACT_US; }
+  }
+}
+#endif
+
+// Advances simulated time and fires any interrupts that came due
+void runUntil(uint64_t t) {
+  static uint64_t edgesDoneUs = 0;  // edges up to here have been handled
+  for (;;) {
+    bool rising = false;
+    uint64_t edge = captureHandler ? nextEdgeUs(edgesDoneUs, rising) : UINT64_MAX;
+    uint64_t tick = tickHandler ? nextTickUs : UINT64_MAX;
+    uint64_t ets = etsArmed ? etsDoneUs : UINT64_MAX;
+    if (edge > t && tick > t && ets > t) break;
+    uint64_t saved = nowUs;
+    if (ets <= tick && ets <= edge) {
+      if (saved < ets) saved = ets;
+      nowUs = ets;
+      etsArmed = false;
+      etsHandler(etsValue, (uint32_t)(PWM_PERIOD_US * 1000));
+    } else if (tick <= edge) {
+      if (saved < tick) saved = tick;
+      nowUs = tick;
+      lastTickUs = tick;
+      nextTickUs += tickPeriodUs;
+      tickHandler();
+    } else {
+      if (saved < edge) saved = edge;
+      nowUs = edge;
+      edgesDoneUs = edge;
+      if (captureEdge == EDGE_BOTH || (captureEdge == EDGE_RISING) == rising) {
+        captureHandler((uint32_t)((edge - lastTickUs) * 1000), rising);
+      }
+    }
+    if (nowUs < saved) nowUs = saved;
+  }
+  if (!captureHandler) edgesDoneUs = t;
+  if (nowUs < t) nowUs = t;
+}
+
+// Lets simulation code drive a digital input, which fires attached edge handlers
+void setPin(uint8_t pin, bool high) {
+  if (pin >= MAX_PINS || pinLevel[pin] == high) return;
+  pinLevel[pin] = high;
+  if (!edgeHandler[pin]) return;
+  if (edgeKind[pin] == EDGE_BOTH || (edgeKind[pin] == EDGE_RISING) == high) {
+    edgeHandler[pin]();
+  }
+}
+
+} // namespace native
+
+uint32_t micros() { return (uint32_t)native::nowUs; }
+uint32_t millis() { return (uint32_t)(native::nowUs / 1000); }
+
+bool timerStart(uint32_t period_us, void (*tick)()) {
+  if (period_us == 0) return false;
+  native::tickPeriodUs = period_us;
+  native::nextTickUs = native::nowUs + period_us;
+  native::lastTickUs = native::nowUs;
+  native::tickHandler = tick;
+  native::nudgeNs = 0;
+  return true;
+}
+
+void timerStop() { native::tickHandler = 0; }
+
+// Simulated time runs in microseconds, so that is the step here
+void timerNudge(int32_t ns) {
+  native::nudgeNs += ns;
+  int64_t us = native::nudgeNs / 1000;
+  int64_t earliest = (int64_t)native::nowUs + 1 - (int64_t)native::nextTickUs;
+  if (us < earliest) us = earliest;
+  native::nudgeNs -= (int32_t)(us * 1000);
+  native::nextTickUs = (uint64_t)((int64_t)native::nextTickUs + us);
+}
+
+bool captureBegin(Edge edge, void (*handler)(uint32_t, bool)) {
+  native::captureEdge = edge;
+  native::captureHandler = handler;
+  return true;
+}
+
+void captureStop() { native::captureHandler = 0; }
+
+void adcBegin() { adcPower(true); }
+
+static uint16_t adcCounts(double volts) {
+  double counts = volts / 5.0 * (ADC_MAX + 1);
+  if (counts < 0) counts = 0;
+  if (counts > ADC_MAX) counts = ADC_MAX;
+  return (uint16_t)counts;
+}
+
+uint16_t adcRead(uint8_t channel) {
+  if (!native::adcOn) {
+    fprintf(stderr, "adcRead() while the ADC is switched off\n");
+    return 0;
+  }
+  if (native::adcWaking) {
+    native::nowUs += HAL_ADC_CONVERSION_US;
+    native::adcWaking = false;
+  }
+  // The input is sampled when the conversion starts, like the real ADC's sample-and-hold
+  double volts = native::signalVolts(channel, native::nowUs * 1e-6);
+  native::nowUs += HAL_ADC_CONVERSION_US;
+  return adcCounts(volts);
+}
+
+void adcScan(const uint8_t *channels, uint8_t count, uint16_t *values, uint16_t *times) {
+  uint64_t start = native::nowUs;
+  for (uint8_t i = 0; i < count; i++) {
+    if (times) times[i] = (uint16_t)(native::nowUs - start);
+    values[i] = adcRead(channels[i]);
+  }
+}
+
+// The A3 signal's edges, the conversion is worked out when it is armed
+bool etsBegin(uint8_t channel, Edge edge, void (*done)(uint16_t, uint32_t)) {
+  if (edge != EDGE_RISING) return false;
+  timerStop();
+  captureStop();
+  native::etsChannel = channel;
+  native::etsHandler = done;
+  native::etsArmed = false;
+  return true;
+}
+
+void etsArm(uint32_t delayNs) {
+  using namespace native;
+  double edge = PWM_FIRST_US + (floor((nowUs - PWM_FIRST_US) / PWM_PERIOD_US) + 1) * PWM_PERIOD_US;
+  double held = edge + delayNs * 1e-3;
+  etsValue = adcCounts(signalVolts(etsChannel, held * 1e-6));
+  etsDoneUs = (uint64_t)ceil(held + HAL_ADC_CONVERSION_US);
+  etsArmed = true;
+}
+
+void etsStop() {
+  native::etsHandler = 0;
+  native::etsArmed = false;
+}
+
+// The edges so far are the integral of f(t) = TACH_HZ * (1 - exp(-t / TACH_TAU))
+bool counterBegin() {
+  native::counterStartUs = native::nowUs;
+  return true;
+}
+
+uint32_t counterRead() {
+  const double TACH_HZ = 50000, TACH_TAU = 2.0;
+  double t = native::nowUs * 1e-6;
+  double start = native::counterStartUs * 1e-6;
+  double edges = TACH_HZ * (t - start + TACH_TAU * (exp(-t / TACH_TAU) - exp(-start / TACH_TAU)));
+  return (uint32_t)(uint64_t)edges;
+}
+
+void pinOutput(uint8_t) {}
+void pinInput(uint8_t pin, bool pullup) {
+  if (pin < native::MAX_PINS) native::pinLevel[pin] = pullup;
+}
+void pinWrite(uint8_t pin, bool high) {
+  if (pin < native::MAX_PINS) native::pinLevel[pin] = high;
+}
+bool pinRead(uint8_t pin) { return pin < native::MAX_PINS && native::pinLevel[pin]; }
+
+void pwmBegin(uint8_t pin) { pwmWrite(pin, 128); }
+void pwmWrite(uint8_t pin, uint8_t duty) {
+  if (pin < native::MAX_PINS) native::pwmDuty[pin] = duty;
+}
+
+void idle() {
+  uint64_t wake = native::tickHandler ? native::nextTickUs : native::nowUs + HAL_NATIVE_LOOP_US;
+#if HAL_NATIVE_WAKE_US > 0
+  uint64_t tick = (native::nowUs / HAL_NATIVE_WAKE_US + 1) * HAL_NATIVE_WAKE_US;
+  if (tick < wake) wake = tick;
+#endif
+  if (wake > native::nowUs) {
+    native::idleUs += wake - native::nowUs;
+    native::runUntil(wake);
+  }
+}
+
+void adcPower(bool on) {
+  if (on == native::adcOn) return;
+  if (native::adcOn) native::adcOnUs += native::nowUs - native::adcChangedUs;
+  native::adcChangedUs = native::nowUs;
+  native::adcOn = on;
+  native::adcWaking = on;
+}
+
+void powerSaveBegin() {}
+
+bool attachEdge(uint8_t pin, Edge edge, void (*handler)()) {
+  if (pin >= native::MAX_PINS) return false;
+  native::edgeKind[pin] = edge;
+  native::edgeHandler[pin] = handler;
+  return true;
+}
+
+void detachEdge(uint8_t pin) {
+  if (pin < native::MAX_PINS) native::edgeHandler[pin] = 0;
+}
+
+bool nvRead(uint16_t address, void *data, uint16_t length) {
+  if (address + length > native::NV_SIZE) return false;
+  memcpy(data, native::nvBytes() + address, length);
+  return true;
+}
+
+bool nvWrite(uint16_t address, const void *data, uint16_t length) {
+  if (address + length > native::NV_SIZE) return false;
+  memcpy(native::nvBytes() + address, data, length);
+  return true;
+}
+
+IrqGuard::IrqGuard() : state_(0) {}
+IrqGuard::~IrqGuard() {}
+
+void linkBegin(uint32_t baud) {
+  native::linkDrain();
+  native::linkBaud = baud > 0 ? baud : HAL_DEFAULT_BAUD;
+}
+
+size_t linkWritable() {
+  native::linkDrain();
+  return (size_t)(native::LINK_BUFFER - native::linkQueued);
+}
+
+// Polling it while bytes are queued lets a byte time pass, like linkWrite() on a full buffer,
+// so a loop waiting for the buffer to drain gets there
+size_t linkQueued() {
+  native::linkDrain();
+  if (native::linkQueued > 0) {
+    native::runUntil(native::nowUs + 10000000ULL / native::linkBaud + 1);
+    native::linkDrain();
+  }
+  return (size_t)ceil(native::linkQueued);
+}
+
+size_t linkWrite(const uint8_t *data, size_t length) {
+  size_t room = linkWritable();
+  if (room == 0) {
+    // Someone is waiting for the buffer, let one byte time pass
+    native::runUntil(native::nowUs + 10000000ULL / native::linkBaud + 1);
+    return 0;
+  }
+  if (length > room) length = room;
+  native::linkQueued += length;
+#if HAL_NATIVE_LINK_ERRORS > 0
+  uint8_t garbled[native::LINK_BUFFER];
+  for (size_t i = 0; i < length; i++) {
+    uint32_t &x = native::linkNoise;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    garbled[i] = x % HAL_NATIVE_LINK_ERRORS == 0 ? (uint8_t)(data[i] ^ (1 << (x >> 29))) : data[i];
+  }
+  data = garbled;
+#endif
+  return fwrite(data, 1, length, native::linkOutput ? native::linkOutput : stdout);
+}
+
+int linkRead() {
+#if defined(_WIN32)
+  return -1;
+#else
+  struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+  if (poll(&input, 1, 0) <= 0 || !(input.revents & POLLIN)) return -1;
+  unsigned char c;
+  return read(STDIN_FILENO, &c, 1) == 1 ? c : -1;
+#endif
+}
+
+} // namespace hal
+
+// The unit tests bring their own main()
+#if !defined(PIO_UNIT_TESTING)
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  uint64_t endUs = (uint64_t)(seconds * 1e6);
+
+  setup();
+  while (hal::native::nowUs < endUs) {
+    loop();
+    hal::native::runUntil(hal::native::nowUs + HAL_NATIVE_LOOP_US);
+  }
+  fflush(stdout);
+
+  // Power report
+  hal::adcPower(false);
+  double total = (double)hal::native::nowUs;
+  double active = 1.0 - hal::native::idleUs / total;
+  double adc = hal::native::adcOnUs / total;
+  double mA = active * HAL_ACTIVE_MA + (1.0 - active) * HAL_IDLE_MA + adc * HAL_ADC_MA;
+  fprintf(stderr, "# power: %.1f s on %s, CPU awake %.2f %%, ADC on %.2f %%, about %.2f mA (chip only)\n",
+          total * 1e-6, HAL_BOARD_NAME, active * 100, adc * 100, mA);
+  return 0;
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+// Sample timer for RP2040 boards (Raspberry Pi Pico) using the Earle Philhower core.
+// The Pico SDK's repeating timer schedules every tick from the previous target time,
+// not from when the callback ran, so the period never drifts.
+// The frequency counter uses a PWM slice as an edge counter, which costs no CPU per edge.
+
+#if defined(ARDUINO_ARCH_RP2040) && !defined(HAL_NATIVE)
+
+#include <Arduino.h>
+#include <pico/time.h>
+#include <hardware/sync.h>
+#include <hardware/pwm.h>
+#include <hardware/irq.h>
+#include "hal.h"
+
+namespace hal {
+
+static void (*volatile tickHandler)() = 0;
+static repeating_timer_t sampleTimer;
+static bool timerRunning = false;
+volatile uint32_t lastTickMicros = 0;  // for the event capture in hal_arduino.cpp
+static int64_t timerPeriodUs = 0;
+static volatile int32_t nudgeNs = 0;    // nudges for the next period
+
+static bool onTimer(repeating_timer_t *timer) {
+  lastTickMicros = micros();
+  if (tickHandler) {
+    tickHandler();
+  }
+  // The alarm for this period is already set, so nudges go into the next one, in whole
+  // microseconds (the rest stays for later). The SDK reads delay_us after the callback.
+  int32_t us = nudgeNs / 1000;
+  if (us < -timerPeriodUs / 2) us = (int32_t)(-timerPeriodUs / 2);
+  nudgeNs -= us * 1000;
+  timer->delay_us = -(timerPeriodUs + us);
+  return true; // keep repeating
+}
+
+bool timerStart(uint32_t period_us, void (*tick)()) {
+  if (period_us == 0) {
+    return false;
+  }
+  timerStop();
+  tickHandler = tick;
+  timerPeriodUs = period_us;
+  nudgeNs = 0;
+  // A negative delay means "period between starts" rather than "gap after the callback"
+  timerRunning = add_repeating_timer_us(-(int64_t)period_us, onTimer, 0, &sampleTimer);
+  return timerRunning;
+}
+
+void timerStop() {
+  if (timerRunning) {
+    cancel_repeating_timer(&sampleTimer);
+    timerRunning = false;
+  }
+}
+
+void timerNudge(int32_t ns) {
+  IrqGuard guard;
+  nudgeNs += ns;
+}
+
+// The counter's PWM slice counts the rising edges on its B pin, and the wrap interrupt every
+// 65536 edges extends the count
+static const uint counterSlice = pwm_gpio_to_slice_num(HAL_COUNTER_PIN);
+static volatile uint16_t counterHigh = 0;
+
+static void onCounterWrap() {
+  if (pwm_get_irq_status_mask() & (1u << counterSlice)) {
+    pwm_clear_irq(counterSlice);
+    counterHigh++;
+  }
+}
+
+bool counterBegin() {
+  gpio_set_function(HAL_COUNTER_PIN, GPIO_FUNC_PWM);
+  pwm_config config = pwm_get_default_config();
+  pwm_config_set_clkdiv_mode(&config, PWM_DIV_B_RISING);
+  pwm_config_set_clkdiv_int(&config, 1);
+  pwm_config_set_wrap(&config, 0xFFFF);
+  pwm_init(counterSlice, &config, false);
+  pwm_set_counter(counterSlice, 0);
+  counterHigh = 0;
+  pwm_clear_irq(counterSlice);
+  pwm_set_irq_enabled(counterSlice, true);
+  irq_add_shared_handler(PWM_IRQ_WRAP, onCounterWrap, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(PWM_IRQ_WRAP, true);
+  pwm_set_enabled(counterSlice, true);
+  return true;
+}
+
+uint32_t counterRead() {
+  IrqGuard guard;
+  uint16_t low = (uint16_t)pwm_get_counter(counterSlice);
+  uint16_t high = counterHigh;
+  // A wrap whose interrupt hasn't run yet belongs to this count if the counter has just wrapped
+  if ((pwm_get_irq_status_mask() & (1u << counterSlice)) && low < 0x8000) {
+    high++;
+  }
+  return ((uint32_t)high << 16) | low;
+}
+
+void idle() { __wfi(); }
+
+// The ADC only draws a few hundred uA, much less than the rest of the chip, so we leave it on
+void adcPower(bool) {}
+void powerSaveBegin() {}
+
+IrqGuard::IrqGuard() : state_(save_and_disable_interrupts()) {}
+IrqGuard::~IrqGuard() { restore_interrupts(state_); }
+
+} // namespace hal
+
+#endif
@@ -0,0 +1,117 @@
+// Sample timer for SAMD21 boards (Arduino Zero, MKR, Adafruit Feather M0).
+// TC3 counts the 48 MHz clock in 16 bit match-frequency mode, so like Timer1 on the Uno
+// the hardware restarts the count by itself and the period never drifts.
+
+#if defined(ARDUINO_ARCH_SAMD) && !defined(HAL_NATIVE)
+
+#include <Arduino.h>
+#include "hal.h"
+
+namespace hal {
+
+static void (*volatile tickHandler)() = 0;
+volatile uint32_t lastTickMicros = 0;  // for the event capture in hal_arduino.cpp
+static uint16_t timerTop = 0;           // CC0 of a period without nudges
+static uint16_t timerPrescaler = 1;
+static int32_t nudgeNs = 0;             // nudges that haven't become timer steps yet
+
+static void waitForSync() {
+  while (TC3->COUNT16.STATUS.bit.SYNCBUSY) {
+  }
+}
+
+bool timerStart(uint32_t period_us, void (*tick)()) {
+  static const uint16_t PRESCALERS[] = {1, 2, 4, 8, 16, 64, 256, 1024};
+  static const uint32_t PRESCALER_BITS[] = {
+    TC_CTRLA_PRESCALER_DIV1,  TC_CTRLA_PRESCALER_DIV2,   TC_CTRLA_PRESCALER_DIV4,
+    TC_CTRLA_PRESCALER_DIV8,  TC_CTRLA_PRESCALER_DIV16,  TC_CTRLA_PRESCALER_DIV64,
+    TC_CTRLA_PRESCALER_DIV256, TC_CTRLA_PRESCALER_DIV1024};
+
+  uint64_t cycles = (uint64_t)(SystemCoreClock / 1000000UL) * period_us;
+  int8_t choice = -1;
+  for (uint8_t i = 0; i < sizeof(PRESCALERS) / sizeof(PRESCALERS[0]); i++) {
+    uint64_t ticks = cycles / PRESCALERS[i];
+    if (ticks < 1 || ticks > 65536UL) continue;
+    if (cycles % PRESCALERS[i] == 0) { choice = i; break; }
+    if (choice < 0) choice = i;
+  }
+  if (choice < 0) {
+    return false; // longer than about 1.4 s at 48 MHz
+  }
+
+  timerStop();
+  tickHandler = tick;
+
+  // Feed TC3 from the 48 MHz generic clock 0
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_ID(GCM_TCC2_TC3);
+  while (GCLK->STATUS.bit.SYNCBUSY) {
+  }
+
+  TC3->COUNT16.CTRLA.reg = TC_CTRLA_SWRST;
+  while (TC3->COUNT16.CTRLA.bit.SWRST) {
+  }
+  uint32_t ticks = (uint32_t)((cycles + PRESCALERS[choice] / 2) / PRESCALERS[choice]);
+  TC3->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ | PRESCALER_BITS[choice];
+  waitForSync();
+  timerTop = (uint16_t)(ticks - 1);
+  timerPrescaler = PRESCALERS[choice];
+  nudgeNs = 0;
+  TC3->COUNT16.CC[0].reg = timerTop;
+  waitForSync();
+  TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+  TC3->COUNT16.INTENSET.reg = TC_INTENSET_MC0;
+  NVIC_SetPriority(TC3_IRQn, 0);
+  NVIC_EnableIRQ(TC3_IRQn);
+  TC3->COUNT16.CTRLA.bit.ENABLE = 1;
+  waitForSync();
+  return true;
+}
+
+// Sleep mode 0 (IDLE) stops the CPU only. SysTick (millis) wakes us up every millisecond.
+void idle() { __WFI(); }
+
+// The SAMD core already switches the ADC on and off around every analogRead()
+void adcPower(bool) {}
+void powerSaveBegin() {}
+
+void timerStop() {
+  TC3->COUNT16.CTRLA.bit.ENABLE = 0;
+  waitForSync();
+  TC3->COUNT16.INTENCLR.reg = TC_INTENCLR_MC0;
+}
+
+// Like on the Uno: CC0 isn't buffered in match-frequency mode, so moving it changes the
+// period that is running, and the tick interrupt puts it back
+void timerNudge(int32_t ns) {
+  IrqGuard guard;
+  nudgeNs += ns;
+  // Timer steps are 20.8 ns at 48 MHz, so work in 64 bits rather than round them
+  int32_t steps = (int32_t)((int64_t)nudgeNs * SystemCoreClock / 1000000000LL / timerPrescaler);
+  int32_t top = (int32_t)TC3->COUNT16.CC[0].reg + steps;
+  TC3->COUNT16.READREQ.reg = TC_READREQ_RREQ | TC_READREQ_ADDR(TC_COUNT16_COUNT_OFFSET);
+  waitForSync();
+  int32_t earliest = (int32_t)TC3->COUNT16.COUNT.reg + 8;  // the match must still be ahead of the count
+  if (top < earliest) top = earliest;
+  if (top > 65535) top = 65535;
+  steps = top - (int32_t)TC3->COUNT16.CC[0].reg;
+  nudgeNs -= (int32_t)((int64_t)steps * timerPrescaler * 1000000000LL / SystemCoreClock);
+  TC3->COUNT16.CC[0].reg = (uint16_t)top;
+  waitForSync();
+}
+
+// TC4 could count the pin's edges through the event system, but nobody has needed it yet
+bool counterBegin() { return false; }
+uint32_t counterRead() { return 0; }
+
+} // namespace hal
+
+void TC3_Handler() {
+  TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+  TC3->COUNT16.CC[0].reg = hal::timerTop;
+  hal::lastTickMicros = micros();
+  if (hal::tickHandler) {
+    hal::tickHandler();
+  }
+}
+
+#endif
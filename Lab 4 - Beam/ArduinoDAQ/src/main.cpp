@@ -1,58 +1,423 @@
 // This is a data acquisition script for the Arduino.
-// It uses non-blocking code to sample the analog pins at a consistent rate.
+// A hardware timer starts every scan of the analog pins, so the samples are evenly spaced
+// even while the serial port is busy. The scans wait in a small queue until loop() prints them.
 // You should test the script with your hardware to determine the smallest stable sample interval.
+//
+// The script only talks to the hardware through hal.h, so it also runs on faster boards with
+// native USB (see platformio.ini) and on your computer with the native environments.
+//
+// The sample period and the analog pins can be changed over the serial port and saved in
+// EEPROM, so you don't have to upload the sketch again. Type ? in the serial monitor to see
+// the settings (see settings.h for the other commands).
+//
+// Edges on the event pin (a release switch, a light gate, an impact contact) are time stamped
+// by the sample timer itself and sent as "#EVENT,time,offset_us,edge": the edge came
+// offset_us after the scan with that time stamp started. So events line up with the samples
+// to within a microsecond on the Uno, without looking for them in the signal afterwards.
+//
+// The data collection GUI sends "hb" every quarter second while it collects. If that heartbeat
+// stops (a loose USB cable, a laptop going to sleep) the sketch keeps its lines in RAM instead
+// of printing them into the void. When the heartbeat comes back it sends
+// "#RECONNECT,lost_ms,back_ms,lines,divider" and then the kept lines as "#BACKLOG,seq,line"
+// as fast as the link takes them, and the GUI merges them back into the data. Without a
+// heartbeat (e.g. in the serial monitor) nothing changes.
+//
+// With RELIABLE_LINK the output goes out in numbered blocks with a CRC, and the GUI asks for
+// the ones that arrive damaged again (see reliable.h), for captures at baud rates where the
+// odd garbled byte would otherwise slip into the data.
+//
+// Every channel can have a low and a high alarm limit, checked on every scan. A channel that
+// crosses one (or comes back) is sent as "!ALARM,time,pin,state,value,latency_us" ahead of
+// the lines still waiting to be printed, within a few milliseconds (see ALARM_LOW below).
+//
+// Boards recording the same test can share one sample clock over a wire, with #SYNC lines in
+// every stream to line the files up (see SYNC_ROLE below).
+//
+// A shaft speed or any other pulse train can be recorded next to the analog channels as one
+// more field, counted by a hardware timer (see USE_COUNTER below).
+//
+// This file has the settings, the commands, setup() and loop(). The rest of the sketch is in
+// headers next to the helpers they use: sampling.h (the scan queue and the sample tick),
+// alarms.h, events.h, sync.h, host.h (store-and-forward) and one mode_*.h per output mode,
+// with that mode's settings, its tick and how it prints (see mode_raw.h).
 
 // Author: Prof. Gordon Hoople
 
-#include <Arduino.h>
+#include "hal.h"
+#include "budget.h"
+#include "line.h"
+#include "settings.h"
+
+// Output modes
+#define MODE_RAW 0      // print every scan (the normal mode)
+#define MODE_SUMMARY 1  // print min, max, mean and RMS of each channel once per SUMMARY_WINDOW
+#define MODE_DEADBAND 2 // only print channels that changed by more than their DEADBAND
+#define MODE_ADAPTIVE 3 // sample fast, but only print every scan while the signals are changing
+#define MODE_LOCKIN 4   // drive a reference sine on a PWM pin and print each channel's response to it
+#define MODE_LINKTEST 5 // no sampling, send test frames as fast as possible to measure the serial link
+#define MODE_MULTIRATE 6 // read slow channels less often than fast ones (see DIVIDER)
+#define MODE_ETS 7       // build one period of a fast repetitive signal from many periods (see ETS_STEP_NS)
+
+#define DAQ_MODE MODE_RAW  // Pick the output mode here, its settings are in its mode_*.h
 
 const unsigned long SAMPLE_PERIOD = 500;  // Sample period in milliseconds, you can adjust this value.
+                                          // The sketch won't compile if the serial link or the CPU
+                                          // can't keep up with it (see the budget below).
+
+// Low power mode for battery loggers: the CPU sleeps between samples and the ADC is only
+// switched on for the scans. Not worth it on USB power, and serial replies can be up to
+// a millisecond later.
+const bool LOW_POWER = false;
+
+// Analog pins to read: 0 = A0, 1 = A1, ...
+// You might want to adapt this list depending on the number of sensors you have.
+const uint8_t CHANNELS[] = {0, 1, 2};
+const uint8_t NUM_CHANNELS = sizeof(CHANNELS);
+
+// Event marker input. The pin is fixed by the board's capture hardware: 8 on the Uno, 4 on the
+// Leonardo (HAL_CAPTURE_PIN in hal.h). It has a pull-up, so a switch to ground works as is.
+// Edges closer together than EVENT_HOLDOFF are ignored, to skip the bounce of a mechanical
+// contact (0 = keep every edge).
+const bool USE_EVENTS = true;
+const hal::Edge EVENT_EDGE = hal::EDGE_BOTH;
+const uint32_t EVENT_HOLDOFF = 0;  // microseconds
+
+// Frequency counter channel, 1 = on, for a tachometer or any other pulse train on the counter
+// pin (HAL_COUNTER_PIN in hal.h: 5 on the Uno and the Pico). A hardware timer counts the edges,
+// so even MHz signals cost no CPU time, and every line gets a "Counter (Hz)" field after the
+// analog channels: the edges of the last COUNTER_GATE sample periods over their length. A
+// longer gate resolves slow signals better (one edge is 1000 / (COUNTER_GATE * period in ms)
+// Hz) but follows changes more slowly. For rpm multiply by 60 and divide by the pulses per
+// turn. On the Uno the counter takes Timer1, so the event input is no longer available.
+// Raw, adaptive and multi-rate mode only.
+#define USE_COUNTER 0
+const uint8_t COUNTER_GATE = 10;  // sample periods
+
+// Alarm limits in raw counts, checked on every scan in the timer interrupt. These are the
+// defaults, "set low0 100" and "set high0 900" change them for the first channel and so on
+// (0 and ADC_MAX switch a limit off). A channel must come back ALARM_HYSTERESIS inside the
+// limit before it counts as ok again. Ordinary lines only go out while the serial link holds
+// at most ALARM_QUEUE_LIMIT bytes, so an alarm never waits behind more than that and one
+// line: about 6 ms from the scan to the last byte of the alarm on the Uno at 115200 baud.
+const uint16_t ALARM_LOW[NUM_CHANNELS] = {0, 0, 0};
+const uint16_t ALARM_HIGH[NUM_CHANNELS] = {hal::ADC_MAX, hal::ADC_MAX, hal::ADC_MAX};
+const uint16_t ALARM_HYSTERESIS = 8;
+const uint8_t ALARM_QUEUE_LIMIT = 16;  // bytes
+
+// Sample clock sync, for several boards recording the same test. The leader drives a pulse on
+// SYNC_PIN, one sample period wide, every SYNC_INTERVAL. Followers get it on the capture pin
+// (which is then no longer the event input) and pull their sample timer onto it, so their
+// scans start within a few microseconds of the leader's instead of drifting apart with the
+// boards' clocks (the Uno's resonator can be 0.5 % off). Every board marks the pulses in its
+// stream as "#SYNC,index,time,offset_us", like the events, so the files can be lined up by
+// pulse index afterwards. Wire the leader's SYNC_PIN to every follower's capture pin, and
+// connect the grounds. Start the followers first: they number the pulses from the first one
+// they see, and start again at 0 when the pulses stop for two intervals (leader reset).
+// SYNC_INTERVAL must be at least two sample periods and a multiple of every board's period.
+#define SYNC_OFF 0
+#define SYNC_LEADER 1
+#define SYNC_FOLLOWER 2
+#define SYNC_ROLE SYNC_OFF
+const uint8_t SYNC_PIN = 7;                 // leader output
+const unsigned long SYNC_INTERVAL = 1000;   // milliseconds
+
+// Store-and-forward: how long without a heartbeat counts as the computer being gone, and how
+// much RAM keeps the lines meanwhile. The Uno only has 2 KB; on the other boards 16384 is fine.
+const unsigned long HOST_TIMEOUT = 1000;  // milliseconds
+const uint16_t BACKLOG_BYTES = 512;
+
+// Reliable link, 1 = on. Costs about 450 bytes of RAM with the sizes below, and 8 bytes per
+// block on the link. The link test mode always sends its own frames.
+#ifndef RELIABLE_LINK
+  #define RELIABLE_LINK 0
+#endif
+#if DAQ_MODE == MODE_LINKTEST
+  #undef RELIABLE_LINK
+  #define RELIABLE_LINK 0
+#endif
+const uint8_t RELIABLE_PAYLOAD = 48;  // payload bytes per block
+const uint8_t RELIABLE_WINDOW = 8;    // blocks kept for sending again, a power of two
+
+// The settings that are saved in EEPROM. SAMPLE_PERIOD and CHANNELS above are the defaults.
+// Change SETTINGS_VERSION whenever you change this struct, so old saved settings are ignored.
+struct Settings {
+  uint16_t samplePeriod;            // milliseconds
+  uint8_t channels[NUM_CHANNELS];   // analog pins
+  uint16_t alarmLow[NUM_CHANNELS];  // raw counts
+  uint16_t alarmHigh[NUM_CHANNELS];
+};
+const uint8_t SETTINGS_VERSION = 2;
+Settings settings;
+CommandReader commands;
+
+#if RELIABLE_LINK
+#include "reliable.h"
+
+ReliableLink<RELIABLE_PAYLOAD, RELIABLE_WINDOW> reliable;
+
+// Line output: every line goes into the blocks
+void reliableOutput(const char *line, uint8_t length) {
+  reliable.add(line, length);
+}
+#endif
+
+#include "alarms.h"
+#include "sampling.h"
+#if SYNC_ROLE != SYNC_OFF
+#include "sync.h"
+#endif
+#include "events.h"
+#if DAQ_MODE == MODE_SUMMARY
+#include "mode_summary.h"
+#elif DAQ_MODE == MODE_DEADBAND
+#include "mode_deadband.h"
+#elif DAQ_MODE == MODE_ADAPTIVE
+#include "mode_adaptive.h"
+#elif DAQ_MODE == MODE_LOCKIN
+#include "mode_lockin.h"
+#elif DAQ_MODE == MODE_LINKTEST
+#include "mode_linktest.h"
+#elif DAQ_MODE == MODE_MULTIRATE
+#include "mode_multirate.h"
+#elif DAQ_MODE == MODE_ETS
+#include "mode_ets.h"
+#else
+#include "mode_raw.h"
+#endif
+#include "host.h"
+
+// The reliable link adds a header and CRC (8 bytes) to every RELIABLE_PAYLOAD bytes
+constexpr uint32_t framed(uint32_t bytes) {
+  return RELIABLE_LINK ? budget::divideUp(bytes * (RELIABLE_PAYLOAD + 8), RELIABLE_PAYLOAD) : bytes;
+}
+
+// Shortest sample period this configuration keeps up with, also the lower limit of "set period"
+const uint32_t SHORTEST_PERIOD = budget::shortestPeriod(NUM_CHANNELS, framed(TICK_MILLIBYTES),
+                                                        framed(FIXED_BYTES_PER_S));
+const uint32_t TICK_CYCLES = budget::tickCycles(NUM_CHANNELS, TICK_MILLIBYTES);
+// The modes without the sample timer don't use SAMPLE_PERIOD
+static_assert((PeriodFits<SHORTEST_PERIOD, 1000 / SHORTEST_PERIOD,
+                          MODE_SAMPLE_TIMER ? SAMPLE_PERIOD : SHORTEST_PERIOD>::value), "");
+#if USE_COUNTER
+static_assert(DAQ_MODE == MODE_RAW || DAQ_MODE == MODE_ADAPTIVE || DAQ_MODE == MODE_MULTIRATE,
+              "the counter field is only printed in raw, adaptive and multi-rate mode");
+#endif
+
+// Prints the header and starts the sample timer. Runs at power-on and after every settings change.
+void startStream() {
+  hal::timerStop();
+  {
+    hal::IrqGuard guard;
+    resetScans();
+    resetEvents();
+    resetAlarms();
+#if SYNC_ROLE != SYNC_OFF
+    resetSync();
+#endif
+  }
+  modeStart();
+}
+
+void defaultSettings() {
+  settings.samplePeriod = SAMPLE_PERIOD;
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    settings.channels[i] = CHANNELS[i];
+    settings.alarmLow[i] = ALARM_LOW[i];
+    settings.alarmHigh[i] = ALARM_HIGH[i];
+  }
+}
+
+// Prints the settings as "#SETTINGS,period=500,pin0=0,pin1=1,...", the alarm limits as
+// "#LIMITS,low0=0,high0=1023,...", the budget as "#BUDGET,shortest_period=3,tick_bytes=27,
+// tick_cycles=20176" (worst case per sample tick) and "#ALARMS,count=2,max_latency_us=3120"
+void showSettings() {
+  Line line;
+  line.text("#SETTINGS,period=").number(settings.samplePeriod);
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    line.text(",pin").number(i).character('=').number(settings.channels[i]);
+  }
+  line.send();
+  Line alarmLimits;
+  alarmLimits.text("#LIMITS");
+  for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+    alarmLimits.text(",low").number(i).character('=').number(settings.alarmLow[i]);
+    alarmLimits.text(",high").number(i).character('=').number(settings.alarmHigh[i]);
+  }
+  alarmLimits.send();
+  Line limits;
+  limits.text("#BUDGET,shortest_period=").number(SHORTEST_PERIOD);
+  limits.text(",tick_bytes=").number(budget::divideUp(TICK_MILLIBYTES, 1000));
+  limits.text(",tick_cycles=").number(TICK_CYCLES).send();
+  Line alarmCount;
+  alarmCount.text("#ALARMS,count=").number(alarmsSent);
+  alarmCount.text(",max_latency_us=").number(alarmLatencyMax).send();
+}
+
+void reply(const char *message) {
+  Line line;
+  line.text(message).send();
+}
 
-unsigned long previousMillis = 0;  // Stores the last sampling time
-bool firstSample = true;          // Flag for first sample
+// Runs one command typed into the serial port (see settings.h)
+void handleCommand(const char *command) {
+  long value;
+  if (strcmp(command, "hb") == 0) {
+    heartbeat();
+#if RELIABLE_LINK
+  } else if (strncmp(command, "nack ", 5) == 0) {
+    reliable.resend((uint16_t)strtol(command + 5, 0, 10));
+#endif
+  } else if (strcmp(command, "?") == 0) {
+    showSettings();
+  } else if (strcmp(command, "save") == 0) {
+    reply(settingsSave(settings, SETTINGS_VERSION) ? "#OK" : "#ERROR,this board has no EEPROM");
+  } else if (strcmp(command, "defaults") == 0) {
+    defaultSettings();
+    reply("#OK");
+    startStream();
+  } else if (commandSet(command, "period", value)) {
+    if (value < (long)SHORTEST_PERIOD || value > 4000) {
+      Line error;
+      error.text("#ERROR,period must be ").number(SHORTEST_PERIOD).text(" - 4000 ms").send();
+      return;
+    }
+    settings.samplePeriod = (uint16_t)value;
+    reply("#OK");
+    startStream();
+  } else {
+    for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+      char name[] = "pin0";
+      name[3] = (char)('0' + i);
+      if (commandSet(command, name, value)) {
+        if (value < 0 || value >= HAL_ADC_CHANNELS) {
+          Line error;
+          error.text("#ERROR,pin must be 0 - ").number(HAL_ADC_CHANNELS - 1).send();
+          return;
+        }
+        settings.channels[i] = (uint8_t)value;
+        reply("#OK");
+        startStream();
+        return;
+      }
+      char low[] = "low0";
+      char high[] = "high0";
+      low[3] = (char)('0' + i);
+      high[4] = (char)('0' + i);
+      bool isLow = commandSet(command, low, value);
+      if (isLow || commandSet(command, high, value)) {
+        if (value < 0 || value > (long)hal::ADC_MAX) {
+          Line error;
+          error.text("#ERROR,limit must be 0 - ").number(hal::ADC_MAX).send();
+          return;
+        }
+        {
+          hal::IrqGuard guard;  // the timer interrupt reads them
+          (isLow ? settings.alarmLow : settings.alarmHigh)[i] = (uint16_t)value;
+        }
+        reply("#OK");
+        return;
+      }
+    }
+    reply("#ERROR,unknown command");
+  }
+}
 
 void setup(){
   //Serial Setup
-  Serial.begin(115200); // Note the highest recommended serial baud rate for stability is 115200. 
-  Serial.println("Time (ms),Sensor 0 (raw),Sensor 1 (raw),Sensor 2 (raw)"); // Print header for data
+  hal::linkBegin(HAL_DEFAULT_BAUD); // Note the highest recommended serial baud rate for the Uno is 115200.
+#if RELIABLE_LINK
+  Line::setOutput(reliableOutput);
+#endif
+
+  // Use the saved settings if there are any. This is quick, so the first sample follows right away.
+  defaultSettings();
+  settingsLoad(settings, SETTINGS_VERSION);
+  Line::setWaiting(sendAlarms, ALARM_QUEUE_LIMIT);
+
+  hal::adcBegin();
+  if (LOW_POWER) {
+    hal::powerSaveBegin();
+    hal::adcPower(false);
+  }
+#if USE_COUNTER
+  // Before the capture, which it takes Timer1 from on the Uno
+  if (!hal::counterBegin()) {
+    reply("#WARNING,this board has no frequency counter");
+  }
+#endif
+#if SYNC_ROLE == SYNC_FOLLOWER
+  if (MODE_SAMPLE_TIMER) {
+    hal::pinInput(HAL_CAPTURE_PIN, false);
+    if (!hal::captureBegin(hal::EDGE_RISING, syncEdge)) {
+      reply("#WARNING,this board can't capture the sync pulses");
+    }
+  }
+#else
+  if (MODE_SAMPLE_TIMER && USE_EVENTS) {
+    hal::pinInput(HAL_CAPTURE_PIN, true);
+    if (!hal::captureBegin(EVENT_EDGE, eventEdge)) {
+      reply("#WARNING,this board can't capture events");
+    }
+  }
+#endif
+#if SYNC_ROLE == SYNC_LEADER
+  hal::pinOutput(SYNC_PIN);
+  hal::pinWrite(SYNC_PIN, false);
+#endif
+  modeSetup();
+  startStream();
 }
 
 void loop() {
-  unsigned long currentMillis = millis();
-  unsigned long elapsedTime = currentMillis - previousMillis;
-  
-  // Check if it's time to take a sample
-  if (elapsedTime >= SAMPLE_PERIOD) {
-    // Calculate missed samples (only after first sample)
-    if (!firstSample) {
-      float missedSamples = (float)elapsedTime / (float)SAMPLE_PERIOD - 1.0; // Must use float division or else it rounds down
-      if (missedSamples > 0) {
-        Serial.print("WARNING: Missed ");
-        Serial.print(missedSamples);
-        Serial.println(" samples!");
-      }
-    } else {
-      firstSample = false;
-    }
-    
-    // Save the time of this sample
-    previousMillis = currentMillis;
-    
-    // Read the input on analog pins. 
-    // You might want to adapt this part of the code depending on the number of sensors you have.
-    int sensorValue0 = analogRead(A0);
-    int sensorValue1 = analogRead(A1);
-    int sensorValue2 = analogRead(A2);
-
-    // Print out the data
-    Serial.print(currentMillis);
-    Serial.print(",");
-    Serial.print(sensorValue0);
-    Serial.print(",");
-    Serial.print(sensorValue1);
-    Serial.print(",");
-    Serial.println(sensorValue2);
+  sendAlarms();
+
+  // Report samples the timer had to skip because the queue was full
+  uint16_t missed;
+  uint16_t missedEdges;
+  {
+    hal::IrqGuard guard;
+    missed = missedSamples;
+    missedSamples = 0;
+    missedEdges = missedEvents;
+    missedEvents = 0;
+  }
+  if (missed > 0) {
+    Line warning;
+    warning.text("WARNING: Missed ").number(missed).text(" samples!").send();
+  }
+  if (missedEdges > 0) {
+    Line warning;
+    warning.text("#WARNING,missed ").number(missedEdges).text(" events").send();
+  }
 
+  const char *command = commands.poll();
+  if (command) {
+    handleCommand(command);
   }
 
+  serviceBacklog();
+#if RELIABLE_LINK
+  reliable.service();
+#endif
+  modeService();
+
+  // Print out the data. At most one queue full per pass, so that if the timer fills the
+  // queue as fast as we print, the warnings and commands above still get their turn.
+  Scan scan;
+  for (uint8_t n = 0; n < QUEUE_LENGTH && nextScan(scan); n++) {
+    modeScan(scan);
+  }
+
+  // After the scans, so an event normally follows the line of its scan (the time stamp says
+  // which one it belongs to either way)
+  sendEvents();
+#if SYNC_ROLE != SYNC_OFF
+  sendSync();
+#endif
+
+  // Sleep until the next interrupt. If a scan arrives just before we fall asleep it waits
+  // for the next wake-up (at most one sample period, or a millisecond on most boards).
+  if (LOW_POWER) {
+    hal::idle();
+  }
 }
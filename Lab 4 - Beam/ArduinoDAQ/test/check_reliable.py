@@ -0,0 +1,153 @@
+"""
+Checks ReliableReceiver in DataCollectionGUI.py against the simulated noisy link
+
+Runs the sketch on the computer twice with the reliable link on: once on a clean link, and
+once with one byte in HAL_NATIVE_LINK_ERRORS garbled on the way out. The simulation is the
+same every run, so both send the same blocks, and the clean run shows what each block should
+have been. The noisy bytes go through the receiver as if they arrived at 115200 baud, and its
+nacks are answered like reliable.h does: with the block again while it is in the sketch's
+window, with a gap block once it has left. The answers cross the noisy link too, so some of
+them arrive damaged as well and are asked for again.
+
+It checks that damaged blocks are dropped and asked for again, that the ones that can't be
+recovered turn into #GAP lines, and that every line that comes out is a line of the clean run,
+in order: the line a gap cut in half is left out. Lines away from the gaps must all be there.
+
+Build the programs and run it from the ArduinoDAQ folder:
+    pio run -e native_reliable -e native_noisy
+    python test/check_reliable.py
+or give the two programs (clean first): python test/check_reliable.py CLEAN NOISY
+"""
+
+import binascii
+import os
+import struct
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..'))
+from DataCollectionGUI import ReliableReceiver, RELIABLE_HEADER, RELIABLE_SYNC  # noqa: E402
+
+BYTES_PER_S = 115200 / 10  # the native_uno link
+WINDOW = 8                 # RELIABLE_WINDOW in main.cpp
+LINK_ERRORS = 200          # HAL_NATIVE_LINK_ERRORS of native_noisy
+SECONDS = 10
+COMMANDS = b"set period 3\n"  # enough lines to keep the link busy
+
+
+def run(program):
+    result = subprocess.run([program, str(SECONDS)], input=COMMANDS, stdout=subprocess.PIPE,
+                            stderr=subprocess.DEVNULL, check=True)
+    return result.stdout
+
+
+def split_blocks(stream):
+    """The clean stream as (type, sequence, payload, start, end), in the order they were sent"""
+    blocks = []
+    offset = 0
+    while offset < len(stream):
+        assert stream[offset:offset + 2] == RELIABLE_SYNC, f"no block at byte {offset}"
+        kind, sequence, length = struct.unpack_from('<cHB', stream, offset + 2)
+        end = offset + RELIABLE_HEADER + length + 2
+        blocks.append((kind, sequence, stream[offset + RELIABLE_HEADER:end - 2], offset, end))
+        offset = end
+    return blocks
+
+
+class Noise:
+    """Garbles one byte in LINK_ERRORS, like hal_native.cpp (a different sequence of them)"""
+
+    def __init__(self):
+        self.x = 88172645
+
+    def __call__(self, data):
+        out = bytearray(data)
+        for i in range(len(out)):
+            x = self.x
+            x ^= (x << 13) & 0xFFFFFFFF
+            x ^= x >> 17
+            x ^= (x << 5) & 0xFFFFFFFF
+            self.x = x
+            if x % LINK_ERRORS == 0:
+                out[i] ^= 1 << (x >> 29)
+        return bytes(out)
+
+
+def answer(sequence, newest, sent, noise):
+    """What reliable.h sends for "nack sequence" when newest is the last block it finished"""
+    age = (newest + 1 - sequence) & 0xFFFF
+    if age == 0 or age >= 0x8000:
+        return b''
+    if age < WINDOW:
+        return noise(sent[sequence])
+    header = struct.pack('<cHB', b'G', sequence, 0)
+    return noise(RELIABLE_SYNC + header + struct.pack('<H', binascii.crc_hqx(header, 0xFFFF)))
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    build = os.path.join(here, '..', '.pio', 'build')
+    clean_program = sys.argv[1] if len(sys.argv) > 2 else os.path.join(build, 'native_reliable', 'program')
+    noisy_program = sys.argv[2] if len(sys.argv) > 2 else os.path.join(build, 'native_noisy', 'program')
+    clean = run(clean_program)
+    noisy = run(noisy_program)
+    assert len(clean) == len(noisy), "the two runs sent different amounts"
+    assert clean != noisy, "nothing was garbled, was native_noisy built with HAL_NATIVE_LINK_ERRORS?"
+
+    blocks = split_blocks(clean)
+    sent = {sequence: clean[start:end] for kind, sequence, payload, start, end in blocks if kind == b'D'}
+
+    # The noisy stream a block at a time, with the answers to the nacks in between
+    receiver = ReliableReceiver()
+    noise = Noise()
+    lines = []
+    for kind, sequence, payload, start, end in blocks:
+        now = end / BYTES_PER_S
+        lines += receiver.feed(noisy[start:end], now)
+        newest = sequence if kind == b'D' else None
+        for asked in receiver.requests(now):
+            if newest is not None:
+                lines += receiver.feed(answer(asked, newest, sent, noise), now)
+    # Long enough after the end for everything missing to be given up
+    for step in range(1, 200):
+        receiver.requests(len(clean) / BYTES_PER_S + step * 0.01)
+        lines += receiver.lines()
+
+    print(f"{len(blocks)} blocks, {receiver.crc_errors} CRC errors, {receiver.nacks} nacks, "
+          f"{receiver.gaps} gaps")
+    assert receiver.crc_errors > 0 and receiver.nacks > 0 and receiver.gaps > 0
+
+    # The clean run's lines, and for each the blocks its bytes came in
+    text = bytearray()
+    owner = []
+    for kind, sequence, payload, start, end in blocks:
+        text += payload
+        owner += [sequence] * len(payload)
+    expected = []
+    line_start = 0
+    for i, byte in enumerate(text):
+        if byte == ord('\n'):
+            expected.append((text[line_start:i].decode().strip(), set(owner[line_start:i + 1])))
+            line_start = i + 1
+
+    gapped = [int(line.split(',')[1]) for line in lines if line.startswith('#GAP,')]
+    assert len(gapped) == receiver.gaps
+    assert not any(line.startswith('#RESTART') for line in lines)
+    # A gap can take the line after it along, if the gap ended right at a line end
+    touched = set(gapped) | {(s + 1) & 0xFFFF for s in gapped}
+
+    data = [line for line in lines if not line.startswith('#GAP,')]
+    position = 0
+    for line in data:
+        while position < len(expected) and expected[position][0] != line:
+            line_blocks = expected[position][1]
+            assert line_blocks & touched, f"lost a line away from the gaps: {expected[position][0]}"
+            position += 1
+        assert position < len(expected), f"a line that wasn't sent: {line}"
+        position += 1
+    assert all(line_blocks & touched for _, line_blocks in expected[position:])
+    print(f"{len(data)} of {len(expected)} lines, all of them as sent")
+
+
+if __name__ == '__main__':
+    main()
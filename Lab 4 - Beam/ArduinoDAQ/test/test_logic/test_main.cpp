@@ -0,0 +1,473 @@
+// Checks the helpers in include/ that don't touch the hardware.
+// Run with: pio test -e native_uno
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "adaptive.h"
+#include "backlog.h"
+#include "budget.h"
+#include "deadband.h"
+#include "ets.h"
+#include "linktest.h"
+#include "lockin.h"
+#include "multirate.h"
+#include "reliable.h"
+#include "summary.h"
+
+namespace hal {
+namespace native {
+extern uint64_t nowUs;
+extern FILE *linkOutput;
+void runUntil(uint64_t t);
+}
+}
+
+// Lines sent through Line while a test collects them, one after the other
+static char lines[512];
+static size_t linesLength = 0;
+
+static void collectLine(const char *line, uint8_t length) {
+  if (linesLength + length < sizeof(lines)) {
+    memcpy(lines + linesLength, line, length);
+    linesLength += length;
+    lines[linesLength] = 0;
+  }
+}
+
+void setUp() {
+  linesLength = 0;
+  lines[0] = 0;
+}
+
+void tearDown() {
+  hal::native::linkOutput = 0;
+  Line::setOutput(0);
+}
+
+// ----- backlog.h -----
+
+void test_backlog_keeps_lines_in_order() {
+  Backlog<64> backlog;
+  backlog.add("1,10", 4);
+  backlog.add("#EVENT", 6);
+  backlog.add("2,20", 4);
+  TEST_ASSERT_EQUAL_UINT16(3, backlog.count());
+  const char *expected[] = {"1,10", "#EVENT", "2,20"};
+  for (uint32_t i = 0; i < 3; i++) {
+    TEST_ASSERT_FALSE(backlog.empty());
+    TEST_ASSERT_EQUAL_UINT32(i, backlog.sequence());
+    TEST_ASSERT_EQUAL(strlen(expected[i]), backlog.length());
+    TEST_ASSERT_EQUAL_MEMORY(expected[i], backlog.line(), backlog.length());
+    backlog.pop();
+  }
+  TEST_ASSERT_TRUE(backlog.empty());
+}
+
+// When it is full it keeps every other data line, and every metadata line
+void test_backlog_thins_data_not_metadata() {
+  Backlog<128> backlog;
+  backlog.add("#START", 6);
+  char line[8];
+  for (uint8_t i = 0; i < 40; i++) {
+    int length = snprintf(line, sizeof(line), "%u,%u", i, i);
+    backlog.add(line, (uint8_t)length);
+  }
+  TEST_ASSERT_TRUE(backlog.divider() > 1);
+  TEST_ASSERT_EQUAL_MEMORY("#START", backlog.line(), 6);
+
+  // Sequence numbers only grow, and the data lines left are evenly spaced at the end
+  uint32_t last = backlog.sequence();
+  backlog.pop();
+  while (!backlog.empty()) {
+    TEST_ASSERT_TRUE(backlog.sequence() > last);
+    last = backlog.sequence();
+    backlog.pop();
+  }
+  TEST_ASSERT_TRUE(last + backlog.divider() >= 40);
+}
+
+// ----- deadband.h -----
+
+void test_deadband() {
+  const uint16_t limits[2] = {5, 5};
+  Deadband<2> deadband(limits, 1000);
+  uint32_t mask;
+  uint16_t values[2] = {100, 200};
+  TEST_ASSERT_TRUE(deadband.check(0, values, mask));  // everything is new
+  TEST_ASSERT_EQUAL_HEX32(0x3, mask);
+
+  values[0] = 105;  // not more than the deadband
+  TEST_ASSERT_FALSE(deadband.check(10, values, mask));
+
+  values[1] = 206;
+  TEST_ASSERT_TRUE(deadband.check(20, values, mask));
+  TEST_ASSERT_EQUAL_HEX32(0x2, mask);
+
+  TEST_ASSERT_TRUE(deadband.check(1000, values, mask));  // channel 0 has been quiet too long
+  TEST_ASSERT_EQUAL_HEX32(0x1, mask);
+}
+
+// ----- budget.h -----
+
+void test_budget_line_bytes() {
+  TEST_ASSERT_EQUAL_UINT32(1, budget::digits(0));
+  TEST_ASSERT_EQUAL_UINT32(4, budget::digits(1023));
+  TEST_ASSERT_EQUAL_UINT32(10, budget::digits(4294967295UL));
+  // "4294967295,1023,1023\r\n" or the same with 4095
+  TEST_ASSERT_EQUAL_UINT32(10 + 2 * 5 + 2, budget::scanLineBytes(2));
+  TEST_ASSERT_EQUAL_UINT32(5 + 10 + 2 * 5 + 2, budget::scanLineBytes(2, 5));
+}
+
+// A line of the link's bytes per second every second fits exactly, anything more doesn't
+void test_budget_link_period() {
+  const uint32_t perS = budget::LINK_BYTES_PER_S;
+  TEST_ASSERT_EQUAL_UINT32(1000, budget::linkPeriod(perS * 1000, 0));
+  TEST_ASSERT_EQUAL_UINT32(1001, budget::linkPeriod(perS * 1000 + 1, 0));
+  TEST_ASSERT_EQUAL_UINT32(2000, budget::linkPeriod(perS * 1000, perS / 2));
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFFUL, budget::linkPeriod(1, perS));
+}
+
+void test_budget_shortest_period() {
+  // A tick printing nothing still needs the conversions, but never less than 1 ms
+  TEST_ASSERT_EQUAL_UINT32(1, budget::shortestPeriod(1, 0, 0));
+  // Every character printed costs the same, a channel at least its conversion
+  TEST_ASSERT_EQUAL_UINT32(budget::CYCLES_PER_CHARACTER, budget::tickCycles(1, 1000) - budget::tickCycles(1, 0));
+  TEST_ASSERT_TRUE(budget::tickCycles(2, 0) - budget::tickCycles(1, 0) >= HAL_ADC_CONVERSION_US * HAL_CPU_MHZ);
+  // A big tick is limited by whichever of the link and the CPU is slower
+  const uint32_t milliBytes = budget::scanLineBytes(6) * 1000;
+  uint32_t shortest = budget::shortestPeriod(6, milliBytes, 0);
+  TEST_ASSERT_EQUAL_UINT32(budget::largest(budget::linkPeriod(milliBytes, 0), budget::cpuPeriod(6, milliBytes)), shortest);
+  TEST_ASSERT_TRUE((PeriodFits<1, 1000, 1>::value));
+}
+
+// ----- ets.h -----
+
+// Each point comes one step later after the trigger, and the record starts again after POINTS
+void test_ets_delays() {
+  EquivalentTime<3, 4> ets(500);
+  uint32_t delayNs = 1;
+  EquivalentTime<3, 4>::Point point;
+  for (uint16_t n = 0; n < 7; n++) {
+    TEST_ASSERT_TRUE(ets.arm(delayNs));
+    TEST_ASSERT_EQUAL_UINT32((n % 3) * 500, delayNs);
+    TEST_ASSERT_FALSE(ets.arm(delayNs));  // already armed
+    ets.add((uint16_t)(100 + n), 20000);
+    TEST_ASSERT_TRUE(ets.take(point));
+    TEST_ASSERT_EQUAL_UINT16(n % 3, point.index);
+    TEST_ASSERT_EQUAL_UINT16(100 + n, point.value);
+    TEST_ASSERT_EQUAL_UINT32(20000, point.periodNs);
+    TEST_ASSERT_EQUAL_UINT32(n / 3 + 1, ets.record());
+  }
+  TEST_ASSERT_FALSE(ets.take(point));
+}
+
+// Nothing is armed while the queue is full, so no point is lost, and restart() begins a
+// new record at the first point
+void test_ets_full_queue() {
+  EquivalentTime<100, 4> ets(250);
+  uint32_t delayNs;
+  for (uint16_t n = 0; n < 3; n++) {
+    TEST_ASSERT_TRUE(ets.arm(delayNs));
+    ets.add(n, 0);
+  }
+  TEST_ASSERT_FALSE(ets.arm(delayNs));
+  EquivalentTime<100, 4>::Point point;
+  TEST_ASSERT_TRUE(ets.take(point));
+  TEST_ASSERT_EQUAL_UINT16(0, point.index);
+  TEST_ASSERT_TRUE(ets.arm(delayNs));
+  TEST_ASSERT_EQUAL_UINT32(3 * 250, delayNs);
+
+  ets.restart();
+  TEST_ASSERT_FALSE(ets.take(point));
+  TEST_ASSERT_TRUE(ets.arm(delayNs));
+  TEST_ASSERT_EQUAL_UINT32(0, delayNs);
+}
+
+// ----- lockin.h -----
+
+// Channel 0 follows the reference, channel 1 leads it by 90 degrees with a fifth of the
+// amplitude, channel 2 is only a DC level
+static void lockinScan(uint8_t step, uint16_t *values) {
+  float angle = 2.0f * 3.14159265f * step / LOCKIN_STEPS;
+  values[0] = (uint16_t)lroundf(512.0f + 100.0f * sinf(angle));
+  values[1] = (uint16_t)lroundf(300.0f + 20.0f * cosf(angle));
+  values[2] = 1000;
+}
+
+void test_lockin_amplitude_and_phase() {
+  LockIn<3> lockin(2);
+  uint16_t values[3];
+  for (uint16_t period = 0; period < 100; period++) {
+    for (uint8_t step = 0; step < LOCKIN_STEPS; step++) {
+      lockinScan(step, values);
+      lockin.add(step, values);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(100, lockin.periods());
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 100.0f, lockin.amplitude(0));
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 0.0f, lockin.phase(0));
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 20.0f, lockin.amplitude(1));
+  TEST_ASSERT_FLOAT_WITHIN(1.0f, 90.0f, lockin.phase(1));
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 0.0f, lockin.amplitude(2));
+}
+
+// A period that didn't start at step 0 isn't used, its DC level wouldn't cancel out
+void test_lockin_skips_part_periods() {
+  LockIn<3> lockin(0);
+  uint16_t values[3];
+  for (uint8_t step = 5; step < LOCKIN_STEPS; step++) {
+    lockinScan(step, values);
+    lockin.add(step, values);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, lockin.periods());
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, lockin.amplitude(2));
+
+  for (uint8_t step = 0; step < LOCKIN_STEPS; step++) {
+    lockinScan(step, values);
+    lockin.add(step, values);
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, lockin.periods());
+  // Without filtering (shift 0) the second stage has the period's result straight away
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 100.0f, lockin.amplitude(0));
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 0.0f, lockin.amplitude(2));
+}
+
+// A full scale 12 bit square wave that flips to the opposite phase: the filter swings from
+// the largest sum to the smallest without overflowing
+static void lockinSquare(LockIn<1> &lockin, uint16_t periods, bool inverted) {
+  for (uint16_t period = 0; period < periods; period++) {
+    for (uint8_t step = 0; step < LOCKIN_STEPS; step++) {
+      uint16_t value = (LOCKIN_SINE[step] >= 0) != inverted ? 4095 : 0;
+      lockin.add(step, &value);
+    }
+  }
+}
+
+void test_lockin_full_scale() {
+  LockIn<1> lockin(2);
+  lockinSquare(lockin, 100, false);
+  // The fundamental of a square wave is 4/pi times its half height (2598.7 with this table)
+  TEST_ASSERT_FLOAT_WITHIN(1.0f, 2598.7f, lockin.amplitude(0));
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 0.0f, lockin.phase(0));
+  lockinSquare(lockin, 100, true);
+  TEST_ASSERT_FLOAT_WITHIN(1.0f, 2598.7f, lockin.amplitude(0));
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 180.0f, fabsf(lockin.phase(0)));
+}
+
+// ----- multirate.h -----
+
+// Every fourth tick only reads A0, the others A0 and one slow channel, never all four
+void test_multirate_spreads_the_slow_channels() {
+  const uint8_t dividers[4] = {1, 4, 4, 4};
+  MultiRate<4> schedule(dividers);
+  TEST_ASSERT_EQUAL_UINT8(2, schedule.busiest());
+  uint8_t reads[4] = {0};
+  for (uint8_t t = 0; t < 120; t++) {
+    uint32_t due = schedule.next();
+    TEST_ASSERT_TRUE(due & 1);
+    uint8_t count = 0;
+    for (uint8_t c = 0; c < 4; c++) {
+      if (due & (1UL << c)) {
+        reads[c]++;
+        count++;
+      }
+    }
+    TEST_ASSERT_TRUE(count <= schedule.busiest());
+  }
+  TEST_ASSERT_EQUAL_UINT8(120, reads[0]);
+  for (uint8_t c = 1; c < 4; c++) {
+    TEST_ASSERT_EQUAL_UINT8(30, reads[c]);
+  }
+}
+
+// ----- adaptive.h -----
+
+void test_adaptive_holds_for_a_time() {
+  AdaptiveRate<1> adaptive(4, 50, 10, 500);
+  uint16_t value = 0;
+  uint8_t printed = 0;
+  for (uint8_t i = 0; i < 8; i++) {
+    printed += adaptive.add(i * 10, &value);
+  }
+  TEST_ASSERT_EQUAL_UINT8(2, printed);  // quiet: every 4th scan
+  TEST_ASSERT_EQUAL_UINT16(4, adaptive.divider());
+
+  value = 200;
+  TEST_ASSERT_TRUE(adaptive.add(100, &value));
+  TEST_ASSERT_TRUE(adaptive.burst());
+
+  // The activity decays below exitLevel within 30 scans
+  uint32_t time = 100;
+  for (uint8_t i = 0; i < 30; i++) {
+    adaptive.add(++time, &value);
+  }
+  // Hundreds of calm scans later it is still a burst, only 500 ms count
+  uint32_t calm = time;
+  while (time < calm + 400) {
+    adaptive.add(++time, &value);
+  }
+  TEST_ASSERT_TRUE(adaptive.burst());
+  while (time < calm + 600) {
+    adaptive.add(++time, &value);
+  }
+  TEST_ASSERT_FALSE(adaptive.burst());
+}
+
+// ----- reliable.h -----
+
+static ReliableLink<8, 4> reliable;
+
+// Runs send() with the link going to a file, returns the bytes that came out
+static size_t capture(uint8_t *out, size_t size, void (*send)()) {
+  FILE *file = tmpfile();
+  hal::native::linkOutput = file;
+  send();
+  hal::native::linkOutput = 0;
+  rewind(file);
+  size_t length = fread(out, 1, size, file);
+  fclose(file);
+  return length;
+}
+
+static void sendTwoBlocks() { reliable.add("0123456789abcdef", 16); }
+static void resendFirst() { reliable.resend(0); }
+static void sendMore() { reliable.add("ghijklmnopqrstuvwxyz012345678901", 32); }
+
+void test_reliable_blocks() {
+  uint8_t out[128];
+  // The start block goes first, then the full blocks with their CRC
+  size_t length = capture(out, sizeof(out), sendTwoBlocks);
+  TEST_ASSERT_EQUAL(3 * 8 + 16, length);
+  TEST_ASSERT_EQUAL_UINT8('S', out[2]);
+  const uint8_t *block = out + 8;
+  TEST_ASSERT_EQUAL_UINT8(0xA5, block[0]);
+  TEST_ASSERT_EQUAL_UINT8('D', block[2]);
+  TEST_ASSERT_EQUAL_UINT8(0, block[3]);
+  TEST_ASSERT_EQUAL_UINT8(8, block[5]);
+  TEST_ASSERT_EQUAL_MEMORY("01234567", block + 6, 8);
+  uint16_t crc = crc16(block + 2, 4 + 8);
+  TEST_ASSERT_EQUAL_UINT8((uint8_t)crc, block[14]);
+  TEST_ASSERT_EQUAL_UINT8((uint8_t)(crc >> 8), block[15]);
+
+  // A block still in the window comes again unchanged
+  uint8_t again[32];
+  TEST_ASSERT_EQUAL(16, capture(again, sizeof(again), resendFirst));
+  TEST_ASSERT_EQUAL_MEMORY(block, again, 16);
+
+  // Once it has left the window the answer is a gap block
+  capture(out, sizeof(out), sendMore);
+  TEST_ASSERT_EQUAL(8, capture(again, sizeof(again), resendFirst));
+  TEST_ASSERT_EQUAL_UINT8('G', again[2]);
+  TEST_ASSERT_EQUAL_UINT8(0, again[3]);
+  TEST_ASSERT_EQUAL_UINT8(0, again[5]);
+}
+
+// ----- linktest.h -----
+
+static LinkTest<24> linkTest;
+static void serviceLinkTest() { linkTest.service(); }
+
+// The frames only take the room the link has, and every byte is what the computer expects
+void test_linktest_frames() {
+  hal::native::runUntil(hal::native::nowUs + 100000);  // let the link drain
+  uint8_t out[256];
+  size_t room = hal::linkWritable();
+  size_t length = capture(out, sizeof(out), serviceLinkTest);
+  TEST_ASSERT_EQUAL(room, length);
+  TEST_ASSERT_TRUE(length >= 2 * 24);
+
+  for (uint32_t sequence = 0; sequence < 2; sequence++) {
+    const uint8_t *frame = out + 24 * sequence;
+    TEST_ASSERT_EQUAL_UINT8(0xA5, frame[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x5A, frame[1]);
+    TEST_ASSERT_EQUAL_UINT16(24, frame[2] | (frame[3] << 8));
+    TEST_ASSERT_EQUAL_UINT32(sequence, frame[4] | (frame[5] << 8) | ((uint32_t)frame[6] << 16) |
+                                       ((uint32_t)frame[7] << 24));
+    uint16_t x = LinkTest<24>::seed(sequence);
+    for (uint8_t i = LinkTest<24>::HEADER; i < 24; i++) {
+      TEST_ASSERT_EQUAL_UINT8(LinkTest<24>::next(x), frame[i]);
+    }
+  }
+
+  // The rest of the frame that didn't fit goes first once there is room again
+  hal::native::runUntil(hal::native::nowUs + 100000);
+  uint8_t more[256];
+  size_t moreLength = capture(more, sizeof(more), serviceLinkTest);
+  size_t split = length % 24;
+  TEST_ASSERT_TRUE(moreLength >= 24 - split + 12);
+  const uint8_t *next = more + (split == 0 ? 0 : 24 - split);
+  TEST_ASSERT_EQUAL_UINT8(0xA5, next[0]);
+  TEST_ASSERT_EQUAL_UINT8(length / 24 + (split == 0 ? 0 : 1), next[4]);
+}
+
+// ----- summary.h -----
+
+void test_summary_line() {
+  Line::setOutput(collectLine);
+  SummaryWindow<2, 4> summary(0, 2);
+  const uint16_t scans[4][2] = {{10, 100}, {20, 100}, {30, 100}, {40, 100}};
+  for (uint8_t i = 0; i < 4; i++) {
+    summary.add(1000 + 10 * i, scans[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(4, summary.count());
+  summary.emit();
+  // RMS of 10, 20, 30, 40 is sqrt(750) = 27.386
+  TEST_ASSERT_EQUAL_STRING("1000,4,10,40,25.00,27.38,100,100,100.00,100.00\r\n", lines);
+  TEST_ASSERT_EQUAL_UINT32(0, summary.count());
+
+  linesLength = 0;
+  summary.emit();  // nothing in the window, nothing sent
+  TEST_ASSERT_EQUAL(0, linesLength);
+}
+
+// A sample far from the last mean keeps the scans around it, 2 before and 1 after
+void test_summary_burst() {
+  Line::setOutput(collectLine);
+  hal::native::runUntil(hal::native::nowUs + 100000);  // service() waits for room on the link
+  SummaryWindow<1, 4> summary(50, 2);
+  uint16_t value = 100;
+  for (uint32_t t = 1; t <= 3; t++) summary.add(t, &value);
+  summary.emit();
+  summary.service();
+  TEST_ASSERT_EQUAL_STRING("1,3,100,100,100.00,100.00\r\n", lines);
+
+  linesLength = 0;
+  const uint16_t values[5] = {100, 100, 200, 100, 100};
+  for (uint8_t i = 0; i < 5; i++) summary.add(10 * (i + 1), &values[i]);
+  summary.emit();
+  summary.service();
+  TEST_ASSERT_EQUAL_STRING("10,5,100,200,120.00,126.49\r\n"
+                           "#RAW,10,100\r\n#RAW,20,100\r\n#RAW,30,200\r\n#RAW,40,100\r\n", lines);
+
+  // Once it has been sent a quiet window has no burst
+  linesLength = 0;
+  summary.add(60, &value);
+  summary.emit();
+  summary.service();
+  TEST_ASSERT_EQUAL_STRING("60,1,100,100,100.00,100.00\r\n", lines);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_backlog_keeps_lines_in_order);
+  RUN_TEST(test_backlog_thins_data_not_metadata);
+  RUN_TEST(test_deadband);
+  RUN_TEST(test_budget_line_bytes);
+  RUN_TEST(test_budget_link_period);
+  RUN_TEST(test_budget_shortest_period);
+  RUN_TEST(test_ets_delays);
+  RUN_TEST(test_ets_full_queue);
+  RUN_TEST(test_lockin_amplitude_and_phase);
+  RUN_TEST(test_lockin_skips_part_periods);
+  RUN_TEST(test_lockin_full_scale);
+  RUN_TEST(test_multirate_spreads_the_slow_channels);
+  RUN_TEST(test_adaptive_holds_for_a_time);
+  RUN_TEST(test_reliable_blocks);
+  RUN_TEST(test_linktest_frames);
+  RUN_TEST(test_summary_line);
+  RUN_TEST(test_summary_burst);
+  return UNITY_END();
+}
@@ -0,0 +1,62 @@
+/*
+ * Alarm lines that the computer shows as soon as they arrive
+ *
+ * An alarm is printed as "!ALARM,time,channel,state,value,latency_us" right when the sketch
+ * notices it, not with the next data line. The data collection GUI puts lines starting with !
+ * in front of the operator straight away (see DataCollectionGUI.py).
+ *
+ * latency_us is from the moment the fault was detected until the last byte of the alarm has
+ * left the Arduino: the time it has taken so far plus the bytes still waiting in the serial
+ * transmit buffer, at ALARM_BAUD. A line printed just before can hold it up by at most the
+ * 64 byte buffer, about 5.6 ms at 115200 baud.
+ */
+
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <Arduino.h>
+
+const unsigned long ALARM_BAUD = 115200;  // as in Serial.begin()
+
+inline uint16_t &alarmCount() {
+  static uint16_t count = 0;
+  return count;
+}
+
+// Longest latency_us so far
+inline uint32_t &alarmMaxLatency() {
+  static uint32_t latency = 0;
+  return latency;
+}
+
+// detected is micros() when the fault was seen
+template <typename T>
+void sendAlarm(unsigned long time, const char *channel, const char *state, T value, uint32_t detected) {
+  Serial.print("!ALARM,");
+  Serial.print(time);
+  Serial.print(",");
+  Serial.print(channel);
+  Serial.print(",");
+  Serial.print(state);
+  Serial.print(",");
+  Serial.print(value);
+  Serial.print(",");
+  // What is still queued, about 5 digits of latency and the line ending
+  uint32_t queued = (uint32_t)(SERIAL_TX_BUFFER_SIZE - 1 - Serial.availableForWrite()) + 7;
+  uint32_t latency = micros() - detected + queued * 10000000UL / ALARM_BAUD;
+  Serial.println(latency);
+  alarmCount()++;
+  if (latency > alarmMaxLatency()) {
+    alarmMaxLatency() = latency;
+  }
+}
+
+// Prints "#ALARMS,count=2,max_latency_us=3120"
+inline void showAlarms() {
+  Serial.print("#ALARMS,count=");
+  Serial.print(alarmCount());
+  Serial.print(",max_latency_us=");
+  Serial.println(alarmMaxLatency());
+}
+
+#endif
@@ -22,21 +22,87 @@
  * 
  * Make sure the switch on you HX711 is set to H (80 SPS) to get the maximum data acquisition rate.
  * 
+ * With USE_SYNC the sketch time stamps the sync pulses of an ArduinoDAQ leader (SYNC_ROLE in
+ * its main.cpp) on pin 8 and prints them as "#SYNC,index,time_us", time_us in the same micros()
+ * as the samples. The HX711 converts on its own clock, so unlike the DAQ the samples can't be
+ * pulled onto the pulses; the computer maps the times onto the leader's with them instead.
+ * 
+ * With USE_ALARMS a strain or A0 reading outside its limits, and an HX711 that stops sending
+ * data, are printed as "!ALARM,time_us,channel,state,value,latency_us" before the data line, and
+ * the data collection GUI shows them right away (see alarm.h).
+ * 
+ * The sample period, pins and HX711 gain are saved in EEPROM and can be changed over the serial
+ * port without uploading the sketch again. Type ? in the serial monitor to see them (see
+ * settings.h for the other commands).
+ * 
  * Author: Prof. Gordon Hoople
  */
 
 #include <Arduino.h>
+#include <avr/sleep.h>
 #include <Adafruit_HX711.h>
 
+#include "settings.h" // Settings saved in EEPROM and serial commands
+#include "alarm.h" // Alarm lines that jump ahead of the data
+
 // Define the pins for the HX711 communication
 const uint8_t DATA_PIN = 2;  // Must be a pin that can handle interrupts!
 const uint8_t CLOCK_PIN = 3; 
-Adafruit_HX711 hx711(DATA_PIN, CLOCK_PIN);
+Adafruit_HX711 *hx711 = 0;   // Created in startHX711() once we know the pins
 
 // Define Sample Period in microseconds
 const unsigned long SAMPLE_PERIOD = 12500; // Target 12.5ms = 80 Hz based on data sheet. 
 // When set to 12500, actual period observed to be either exactly 12.5 ms or 12.5ms +4uS 
 
+// HX711 gain: 128 or 64 read channel A, 32 reads channel B
+const uint8_t GAIN = 128;
+
+// Low power mode for a battery powered monitor: the Arduino sleeps between samples (the
+// HX711's data ready interrupt and the micros() timer wake it up). With sample periods of
+// HX711_SLEEP_PERIOD or more the HX711 is also powered down between samples, and woken up
+// HX711_SETTLE before the next one so its filter has settled (4 conversions at 80 SPS).
+const bool LOW_POWER = false;
+const unsigned long HX711_SLEEP_PERIOD = 500000; // microseconds
+const unsigned long HX711_SETTLE = 60000;        // microseconds
+bool hx711Sleeping = false;
+
+// Sync input from a leader board. Pin 8 is the Uno's input capture pin: Timer1 latches its
+// count at the edge, so the interrupt latency doesn't matter, only micros()' 4 us steps do.
+// The pulses are numbered from the first one, and from 0 again after a pause of two intervals.
+const bool USE_SYNC = false;
+const uint8_t SYNC_PIN = 8;
+const unsigned long SYNC_INTERVAL = 1000000; // microseconds, as set on the leader
+
+// Alarm limits, in raw counts. A reading above HIGH or below LOW sends an alarm, and once it is
+// back HYSTERESIS inside the limit an "ok". The defaults are the ends of each ADC's range, so
+// nothing alarms until you set them. The HX711 counts as stalled when its data ready line
+// hasn't come for HX711_TIMEOUT past the sample period (a loose wire, no power).
+const bool USE_ALARMS = true;
+const int32_t STRAIN_LOW = -8388608;
+const int32_t STRAIN_HIGH = 8388607;
+const int32_t STRAIN_HYSTERESIS = 1000;
+const int ANALOG_LOW = 0;
+const int ANALOG_HIGH = 1023;
+const int ANALOG_HYSTERESIS = 8;
+const unsigned long HX711_TIMEOUT = 100000; // microseconds
+
+enum AlarmState : uint8_t { ALARM_OK, ALARM_LOW, ALARM_HIGH, ALARM_STALLED };
+const char *const ALARM_NAMES[] = {"ok", "low", "high", "stalled"};
+uint8_t strainAlarm = ALARM_OK;
+uint8_t analogAlarm = ALARM_OK;
+
+// The settings that are saved in EEPROM. The values above are the defaults.
+// Change SETTINGS_VERSION whenever you change this struct, so old saved settings are ignored.
+struct Settings {
+  uint32_t samplePeriod;  // microseconds
+  uint8_t dataPin;
+  uint8_t clockPin;
+  uint8_t gain;
+};
+const uint8_t SETTINGS_VERSION = 1;
+Settings settings;
+CommandReader commands;
+
 // Setup timing variables with microsecond precision
 unsigned long previousMicros = 0;  // Stores the last sampling time in microseconds
 unsigned long currentMicros = 0;   // Current time in microseconds
@@ -44,28 +110,198 @@ unsigned long intervalMicros = 0;  // Interval between readings in microseconds
 
 // Interrupt flags
 volatile boolean newDataReady = false;
+uint8_t hx711DataPin = 0;  // Pin the data ready interrupt is attached to
 
 // Interrupt routine: Sets flag when HX711 has new data available
 void dataReadyISR() {
     newDataReady = true;
 }
 
+// Sync pulses, from the capture interrupt to loop()
+volatile unsigned long syncMicros = 0;  // micros() at the last pulse
+volatile uint32_t syncIndex = 0;
+volatile bool syncSeen = false;
+volatile bool syncWaiting = false;
+
+// Timer1 counts freely in 0.5 us steps and captures the rising edges on pin 8
+void startSync() {
+  pinMode(SYNC_PIN, INPUT);
+  TCCR1A = 0;
+  TCCR1B = _BV(ICNC1) | _BV(ICES1) | _BV(CS11); // noise canceler, rising edge, clock / 8
+  TIFR1 = _BV(ICF1);
+  TIMSK1 = _BV(ICIE1);
+}
+
+ISR(TIMER1_CAPT_vect) {
+  uint16_t captured = ICR1;
+  uint16_t count = TCNT1;
+  unsigned long now = micros();
+  // micros() was read (count - captured) half microseconds after the edge, right after count
+  unsigned long edge = now - (uint16_t)(count - captured) / 2;
+  if (syncSeen && edge - syncMicros <= 2 * SYNC_INTERVAL) {
+    syncIndex++;
+  } else {
+    syncIndex = 0;  // the first pulse, or the leader started again
+  }
+  syncSeen = true;
+  syncMicros = edge;
+  syncWaiting = true;
+}
+
+// Prints the last sync pulse as "#SYNC,index,time_us"
+void sendSync() {
+  noInterrupts();
+  bool waiting = syncWaiting;
+  uint32_t index = syncIndex;
+  unsigned long time = syncMicros;
+  syncWaiting = false;
+  interrupts();
+  if (waiting) {
+    Serial.print("#SYNC,");
+    Serial.print(index);
+    Serial.print(",");
+    Serial.println(time);
+  }
+}
+
+void defaultSettings() {
+  settings.samplePeriod = SAMPLE_PERIOD;
+  settings.dataPin = DATA_PIN;
+  settings.clockPin = CLOCK_PIN;
+  settings.gain = GAIN;
+}
+
+// The HX711 library's name for the gain setting
+hx711_chanGain_t gainChannel() {
+  if (settings.gain == 64) return CHAN_A_GAIN_64;
+  if (settings.gain == 32) return CHAN_B_GAIN_32;
+  return CHAN_A_GAIN_128;
+}
+
+// Sets up the HX711 on the pins in the settings
+void startHX711() {
+  if (hx711) {
+    detachInterrupt(digitalPinToInterrupt(hx711DataPin));
+    delete hx711;
+  }
+  hx711DataPin = settings.dataPin;
+  hx711 = new Adafruit_HX711(settings.dataPin, settings.clockPin);
+  hx711->begin();
+  hx711Sleeping = false;
+
+  // Attach interrupt for HX711 data ready (DOUT goes LOW)
+  attachInterrupt(digitalPinToInterrupt(settings.dataPin), dataReadyISR, FALLING);
+}
+
+// Powers the HX711 up again after a low power sleep
+void wakeHX711() {
+  if (hx711Sleeping) {
+    hx711->powerDown(false);
+    hx711Sleeping = false;
+    newDataReady = false; // Wait for a conversion made after waking up
+  }
+}
+
+// New state of a channel's limit alarm after a reading
+uint8_t checkLimits(uint8_t state, int32_t value, int32_t low, int32_t high, int32_t hysteresis) {
+  if (value > high) return ALARM_HIGH;
+  if (value < low) return ALARM_LOW;
+  if (state == ALARM_STALLED || (state == ALARM_HIGH && value <= high - hysteresis) ||
+      (state == ALARM_LOW && value >= low + hysteresis)) {
+    return ALARM_OK;
+  }
+  return state;
+}
+
+// Sends an alarm if the channel's state changed
+void updateAlarm(uint8_t &state, uint8_t now, const char *channel, unsigned long time, long value,
+                 unsigned long detected) {
+  if (now != state) {
+    state = now;
+    sendAlarm(time, channel, ALARM_NAMES[now], value, detected);
+  }
+}
+
+// Prints the settings as "#SETTINGS,period=12500,datapin=2,..." and the alarms sent so far
+// as "#ALARMS,count=1,max_latency_us=2900"
+void showSettings() {
+  Serial.print("#SETTINGS,period=");
+  Serial.print(settings.samplePeriod);
+  Serial.print(",datapin=");
+  Serial.print(settings.dataPin);
+  Serial.print(",clockpin=");
+  Serial.print(settings.clockPin);
+  Serial.print(",gain=");
+  Serial.println(settings.gain);
+  showAlarms();
+}
+
+// Runs one command typed into the serial port (see settings.h)
+void handleCommand(const char *command) {
+  float value;
+  if (strcmp(command, "hb") == 0) {
+    // The data collection GUI's heartbeat, only the DAQ sketch keeps data while it's missing
+  } else if (strcmp(command, "?") == 0) {
+    showSettings();
+  } else if (strcmp(command, "save") == 0) {
+    settingsSave(settings, SETTINGS_VERSION);
+    Serial.println("#OK");
+  } else if (strcmp(command, "defaults") == 0) {
+    defaultSettings();
+    startHX711();
+    Serial.println("#OK");
+  } else if (commandSet(command, "period", value) && value >= 1000 && value <= 10000000) {
+    settings.samplePeriod = (uint32_t)value;
+    wakeHX711();  // it went to sleep for the old period
+    Serial.println("#OK");
+  } else if (commandSet(command, "gain", value) && (value == 128 || value == 64 || value == 32)) {
+    settings.gain = (uint8_t)value;
+    Serial.println("#OK");
+  } else if (commandSet(command, "datapin", value) && digitalPinToInterrupt((uint8_t)value) != NOT_AN_INTERRUPT) {
+    settings.dataPin = (uint8_t)value;
+    startHX711();
+    Serial.println("#OK");
+  } else if (commandSet(command, "clockpin", value) && value >= 0 && value <= 19) {
+    settings.clockPin = (uint8_t)value;
+    startHX711();
+    Serial.println("#OK");
+  } else {
+    Serial.println("#ERROR,unknown command or value out of range");
+  }
+}
+
 void setup() {
   // Serial Communication Setup
   Serial.begin(115200); // Note the highest recommended serial baud rate for stability is 115200.
   Serial.println("Times (us),interval (us),strain (raw),sensorValue0 (raw)"); // Print header for data
-  // Initialize the HX711
-  hx711.begin();
 
-  // Attach interrupt for HX711 data ready (DOUT goes LOW)
-  attachInterrupt(digitalPinToInterrupt(DATA_PIN), dataReadyISR, FALLING);
+  // Use the saved settings if there are any
+  defaultSettings();
+  settingsLoad(settings, SETTINGS_VERSION);
+
+  // Initialize the HX711
+  startHX711();
+  if (USE_SYNC) {
+    startSync();
+  }
 }
 
 void loop() {
+  const char *command = commands.poll();
+  if (command) {
+    handleCommand(command);
+  }
+
   currentMicros = micros(); // Get current microsecond timestamp
 
+  // Wake the HX711 up in time for the next sample
+  if (hx711Sleeping && (settings.samplePeriod <= HX711_SETTLE ||
+                        (currentMicros - previousMicros) >= settings.samplePeriod - HX711_SETTLE)) {
+    wakeHX711();
+  }
+
   // Check if new data is ready and minimum interval has passed
-  if (newDataReady && (currentMicros - previousMicros) >= SAMPLE_PERIOD) {
+  if (newDataReady && (currentMicros - previousMicros) >= settings.samplePeriod) {
     // Calculate interval since last reading
     intervalMicros = currentMicros - previousMicros;
     
@@ -73,12 +309,25 @@ void loop() {
     previousMicros = currentMicros;
 
     // Get the raw strain value
-    int32_t strain = hx711.readChannelRaw(CHAN_A_GAIN_128);
+    int32_t strain = hx711->readChannelRaw(gainChannel());
     newDataReady = false;
+    if (LOW_POWER && settings.samplePeriod >= HX711_SLEEP_PERIOD) {
+      hx711->powerDown(true);
+      hx711Sleeping = true;
+    }
    
     // Get the analog data (you can comment this out if you don't want it)
     int sensorValue0 = analogRead(A0);
 
+    // Alarms go out before the data line
+    if (USE_ALARMS) {
+      unsigned long detected = micros();
+      updateAlarm(strainAlarm, checkLimits(strainAlarm, strain, STRAIN_LOW, STRAIN_HIGH, STRAIN_HYSTERESIS),
+                  "strain", currentMicros, strain, detected);
+      updateAlarm(analogAlarm, checkLimits(analogAlarm, sensorValue0, ANALOG_LOW, ANALOG_HIGH, ANALOG_HYSTERESIS),
+                  "A0", currentMicros, sensorValue0, detected);
+    }
+
     // Output the data
     Serial.print(currentMicros);
     Serial.print(",");
@@ -88,4 +337,22 @@ void loop() {
     Serial.print(",");
     Serial.println(sensorValue0);
   }
-}
\ No newline at end of file
+
+  // No data from the HX711 for much longer than the sample period. The value is the time since
+  // the last sample in milliseconds.
+  if (USE_ALARMS && !hx711Sleeping && !newDataReady && strainAlarm != ALARM_STALLED &&
+      currentMicros - previousMicros > settings.samplePeriod + HX711_TIMEOUT) {
+    updateAlarm(strainAlarm, ALARM_STALLED, "strain", currentMicros,
+                (long)((currentMicros - previousMicros) / 1000), currentMicros);
+  }
+
+  if (USE_SYNC) {
+    sendSync();
+  }
+
+  // Sleep until the next interrupt
+  if (LOW_POWER) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+  }
+}
@@ -0,0 +1,249 @@
+/*
+ * DS18B20 temperature sensor on a one wire bus, with short interrupt pauses
+ *
+ * The OneWire library turns interrupts off for a whole bit (up to about 70 us), and every
+ * reading is over a hundred bits. That holds up the millis() timer, the serial port and the
+ * heater protection interrupt. This driver only turns them off where the one wire timing
+ * really needs it:
+ *
+ *   writing a 1   the 6 us low pulse (it must stay under 15 us)
+ *   reading       the 3 us low pulse up to the moment we sample the line, about 13 us
+ *   writing a 0   not at all: the low pulse must be at least 60 us, an interrupt in the
+ *                 middle only makes it longer, and the sensor accepts that
+ *   reset         not at all: the presence pulse is at least 60 us long, we watch for it
+ *                 with interrupts on
+ *
+ * The pin's port registers are looked up once in begin(), so every bit is a direct register
+ * write instead of digitalWrite()/pinMode(). Every scratchpad read is checked with its CRC.
+ *
+ * Several sensors can share the bus: search() finds their 8 byte ROM addresses, and a read
+ * with a ROM only talks to that sensor. Without a ROM the read goes to every sensor at once,
+ * which only works with one sensor on the bus. startConversion() always starts all of them
+ * together, so one conversion time covers every sensor.
+ */
+
+#ifndef DS18B20_H
+#define DS18B20_H
+
+#include <Arduino.h>
+
+class DS18B20 {
+public:
+  static const uint16_t CONVERSION_TIME = 750;  // ms, at the default 12 bit resolution
+
+  DS18B20() : out_(0), mode_(0), in_(0), mask_(0) {}
+
+  void begin(uint8_t pin) {
+    uint8_t port = digitalPinToPort(pin);
+    out_ = portOutputRegister(port);
+    mode_ = portModeRegister(port);
+    in_ = portInputRegister(port);
+    mask_ = digitalPinToBitMask(pin);
+    release();
+    uint8_t sreg = SREG;
+    cli();
+    *out_ &= (uint8_t)~mask_;  // drive low when switched to output, the pull-up pulls high
+    SREG = sreg;
+  }
+
+  // True if a sensor answers on the bus
+  bool present() { return reset(); }
+
+  static const uint8_t ROM_SIZE = 8;
+
+  // Starts a conversion on every sensor, the result is ready CONVERSION_TIME ms later
+  bool startConversion() {
+    if (!reset()) return false;
+    writeByte(SKIP_ROM);
+    writeByte(CONVERT);
+    return true;
+  }
+
+  // Reads the last conversion of the sensor with this ROM (0 = the only sensor on the bus).
+  // Returns false if no sensor answered or the CRC was wrong.
+  bool readTemperature(float &celsius, const uint8_t *rom = 0) {
+    uint8_t data[9];
+    if (!readScratchpad(data, rom)) return false;
+    int16_t raw = (int16_t)((data[1] << 8) | data[0]);
+    celsius = raw / 16.0f;
+    return true;
+  }
+
+  bool readScratchpad(uint8_t *data, const uint8_t *rom = 0) {
+    if (!select(rom)) return false;
+    writeByte(READ_SCRATCHPAD);
+    bool allOnes = true;
+    for (uint8_t i = 0; i < 9; i++) {
+      data[i] = readByte();
+      if (data[i] != 0xFF) allOnes = false;
+    }
+    return !allOnes && crc8(data, 8) == data[8];  // all ones: the sensor let go of the bus
+  }
+
+  // Finds the ROMs of up to max DS18B20s on the bus, in ROM order. Returns how many it found.
+  // Takes about 15 ms per sensor, busy() (if not 0) is called before each one.
+  uint8_t search(uint8_t (*roms)[ROM_SIZE], uint8_t max, void (*busy)() = 0) {
+    uint8_t count = 0;
+    uint8_t rom[ROM_SIZE] = {0};
+    int8_t lastBranch = -1;  // last bit where we took the 0 branch and a 1 branch is left
+    do {
+      if (busy) busy();
+      if (!reset()) break;
+      writeByte(SEARCH_ROM);
+      int8_t branch = -1;
+      for (uint8_t bit = 0; bit < 64; bit++) {
+        // Every sensor sends its bit and then its complement, the line is the AND of them
+        bool one = readBit();
+        bool zero = readBit();
+        if (one && zero) return count;  // nobody is left, the bus changed under us
+        bool direction;
+        if (one != zero) {
+          direction = one;  // all remaining sensors agree
+        } else {
+          // Sensors differ here: take the 0 branch the first time, then the 1 branch
+          bool previous = (rom[bit / 8] >> (bit % 8)) & 0x01;
+          direction = bit < lastBranch ? previous : bit == lastBranch;
+          if (!direction) branch = bit;
+        }
+        if (direction) {
+          rom[bit / 8] |= (uint8_t)(1 << (bit % 8));
+        } else {
+          rom[bit / 8] &= (uint8_t)~(1 << (bit % 8));
+        }
+        writeBit(direction);  // sensors with the other bit drop out
+      }
+      if (rom[0] == FAMILY && crc8(rom, ROM_SIZE - 1) == rom[ROM_SIZE - 1]) {
+        memcpy(roms[count++], rom, ROM_SIZE);
+      }
+      lastBranch = branch;
+    } while (lastBranch >= 0 && count < max);
+    return count;
+  }
+
+  // Dallas/Maxim CRC-8 (polynomial x^8 + x^5 + x^4 + 1)
+  static uint8_t crc8(const uint8_t *data, uint8_t length) {
+    uint8_t crc = 0;
+    while (length--) {
+      uint8_t byte = *data++;
+      for (uint8_t bit = 0; bit < 8; bit++) {
+        uint8_t mix = (crc ^ byte) & 0x01;
+        crc >>= 1;
+        if (mix) crc ^= 0x8C;
+        byte >>= 1;
+      }
+    }
+    return crc;
+  }
+
+private:
+  static const uint8_t FAMILY = 0x28;  // first ROM byte of every DS18B20
+  static const uint8_t SEARCH_ROM = 0xF0;
+  static const uint8_t MATCH_ROM = 0x55;
+  static const uint8_t SKIP_ROM = 0xCC;
+  static const uint8_t CONVERT = 0x44;
+  static const uint8_t READ_SCRATCHPAD = 0xBE;
+
+  // The port registers are shared with other pins, so every change is done with interrupts
+  // off (a couple of cycles) in case an interrupt changes another pin of the same port
+  void driveLow() {
+    uint8_t sreg = SREG;
+    cli();
+    *mode_ |= mask_;
+    SREG = sreg;
+  }
+
+  void release() {
+    uint8_t sreg = SREG;
+    cli();
+    *mode_ &= (uint8_t)~mask_;
+    SREG = sreg;
+  }
+
+  bool line() const { return (*in_ & mask_) != 0; }
+
+  bool reset() {
+    // Wait for the bus to come up (someone might still hold it low)
+    release();
+    uint8_t tries = 125;
+    while (!line()) {
+      if (--tries == 0) return false;
+      delayMicroseconds(2);
+    }
+    driveLow();
+    delayMicroseconds(480);
+    release();
+    // The presence pulse starts 15 - 60 us after we let go and lasts at least 60 us
+    bool presence = false;
+    for (uint8_t i = 0; i < 60; i++) {
+      delayMicroseconds(4);
+      if (!line()) presence = true;
+    }
+    delayMicroseconds(240);
+    return presence;
+  }
+
+  // Resets the bus and addresses the sensor with this ROM, or every sensor
+  bool select(const uint8_t *rom) {
+    if (!reset()) return false;
+    if (rom) {
+      writeByte(MATCH_ROM);
+      for (uint8_t i = 0; i < ROM_SIZE; i++) writeByte(rom[i]);
+    } else {
+      writeByte(SKIP_ROM);
+    }
+    return true;
+  }
+
+  void writeBit(bool bit) {
+    if (bit) {
+      uint8_t sreg = SREG;
+      cli();
+      *mode_ |= mask_;
+      delayMicroseconds(6);
+      *mode_ &= (uint8_t)~mask_;
+      SREG = sreg;
+      delayMicroseconds(64);
+    } else {
+      driveLow();
+      delayMicroseconds(60);
+      release();
+      delayMicroseconds(10);
+    }
+  }
+
+  bool readBit() {
+    uint8_t sreg = SREG;
+    cli();
+    *mode_ |= mask_;
+    delayMicroseconds(3);
+    *mode_ &= (uint8_t)~mask_;
+    delayMicroseconds(10);
+    bool bit = line();
+    SREG = sreg;
+    delayMicroseconds(53);
+    return bit;
+  }
+
+  void writeByte(uint8_t value) {
+    for (uint8_t i = 0; i < 8; i++) {
+      writeBit(value & 0x01);
+      value >>= 1;
+    }
+  }
+
+  uint8_t readByte() {
+    uint8_t value = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+      value >>= 1;
+      if (readBit()) value |= 0x80;
+    }
+    return value;
+  }
+
+  volatile uint8_t *out_;
+  volatile uint8_t *mode_;
+  volatile uint8_t *in_;
+  uint8_t mask_;
+};
+
+#endif
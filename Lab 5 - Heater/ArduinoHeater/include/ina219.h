@@ -0,0 +1,172 @@
+/*
+ * INA219 current sensor read in the background (see twi.h)
+ *
+ * startReading() queues the whole reading (shunt voltage, bus voltage, current and power)
+ * and returns right away. The TWI interrupt does the transfers, about 0.5 ms at 400 kHz,
+ * while loop() goes on. Once readingReady() is true the values can be read, until the next
+ * startReading() or startCurrent().
+ *
+ * startCurrent() queues just the current register, for the checks between samples. The
+ * current alarm is checked in the interrupt as soon as the current arrives, so an
+ * over-current reaches the protection without waiting for loop().
+ *
+ * Same range and scaling as Adafruit_INA219's default (32 V, 2 A, 0.1 ohm shunt):
+ * 0.1 mA and 2 mW per bit. The calibration is written again before every full reading,
+ * in case the sensor lost it (a brown-out resets it).
+ */
+
+#ifndef INA219_H
+#define INA219_H
+
+#include <Arduino.h>
+#include "twi.h"
+
+class INA219 {
+public:
+  explicit INA219(uint8_t address = 0x40)
+    : alarm_(0), alarmRaw_(0x7FFF) {
+    // The register reads: write the register number, then read its two bytes
+    static const uint8_t REGISTERS[READS] = {SHUNT_VOLTAGE, BUS_VOLTAGE, CURRENT, POWER};
+    for (uint8_t i = 0; i < READS; i++) {
+      registers_[i] = REGISTERS[i];
+      setup(reads_[i], address, &registers_[i], 1, data_[i], 2);
+    }
+    reads_[READ_CURRENT].done = currentDone;
+    reads_[READ_CURRENT].context = this;
+    setup(calibration_, address, calibrationData_, 3, 0, 0);
+    setup(config_, address, configData_, 3, 0, 0);
+  }
+
+  // Configures the sensor and returns true if it answered. Waits for the transfers, call
+  // from setup() after twiBegin().
+  bool begin() {
+    write(config_, configData_, CONFIG, CONFIG_VALUE);
+    write(calibration_, calibrationData_, CALIBRATION, CALIBRATION_VALUE);
+    while (!twiFinished(config_) || !twiFinished(calibration_)) {
+      twiPoll();
+    }
+    return config_.status == TWI_OK && calibration_.status == TWI_OK;
+  }
+
+  // Queues a full reading. Returns false if the last one is still going.
+  bool startReading() {
+    if (!twiFinished(calibration_) || !readsFinished()) {
+      return false;
+    }
+    write(calibration_, calibrationData_, CALIBRATION, CALIBRATION_VALUE);
+    for (uint8_t i = 0; i < READS; i++) {
+      twiSubmit(reads_[i]);
+    }
+    return true;
+  }
+
+  // Queues a current reading for the alarm. Returns false if a reading is still going.
+  bool startCurrent() {
+    return twiSubmit(reads_[READ_CURRENT]);
+  }
+
+  bool readingReady() const { return twiFinished(calibration_) && readsFinished(); }
+
+  // True if every register of the last reading arrived
+  bool readingOk() const {
+    for (uint8_t i = 0; i < READS; i++) {
+      if (reads_[i].status != TWI_OK) return false;
+    }
+    return true;
+  }
+
+  float shuntVoltage_mV() const { return raw(READ_SHUNT) * 0.01f; }
+  // The bus voltage register is unsigned, up to 32 V
+  float busVoltage_V() const { return (int16_t)(((uint16_t)raw(READ_BUS) >> 3) * 4) * 0.001f; }
+  float current_mA() const { return raw(READ_CURRENT) / (float)CURRENT_DIVIDER; }
+  float power_mW() const { return raw(READ_POWER) * (float)POWER_MULTIPLIER; }
+
+  // Powers the sensor down between readings, or back up. It needs one conversion time
+  // (about 1 ms) after powering up before the readings are fresh.
+  void powerSave(bool on) {
+    write(config_, configData_, CONFIG, (uint16_t)(on ? CONFIG_VALUE & ~MODE_MASK : CONFIG_VALUE));
+  }
+
+  // Calls alarm (from the TWI interrupt) every time a current above mA in either direction
+  // arrives
+  void setCurrentAlarm(float mA, void (*alarm)(float mA)) {
+    float raw = mA * (float)CURRENT_DIVIDER;
+    uint8_t sreg = SREG;
+    cli();
+    alarmRaw_ = raw < 0x7FFF ? (int16_t)raw : 0x7FFF;
+    alarm_ = alarm;
+    SREG = sreg;
+  }
+
+private:
+  // Registers
+  static const uint8_t CONFIG = 0x00;
+  static const uint8_t SHUNT_VOLTAGE = 0x01;
+  static const uint8_t BUS_VOLTAGE = 0x02;
+  static const uint8_t POWER = 0x03;
+  static const uint8_t CURRENT = 0x04;
+  static const uint8_t CALIBRATION = 0x05;
+
+  // 32 V range, 320 mV shunt range, 12 bit conversions, shunt and bus continuous
+  static const uint16_t CONFIG_VALUE = 0x399F;
+  static const uint16_t MODE_MASK = 0x0007;
+  static const uint16_t CALIBRATION_VALUE = 4096;
+  static const uint8_t CURRENT_DIVIDER = 10;  // raw per mA
+  static const uint8_t POWER_MULTIPLIER = 2;  // mW per raw
+
+  // The order of reads_
+  enum { READ_SHUNT, READ_BUS, READ_CURRENT, READ_POWER, READS };
+
+  static void setup(TwiTransaction &t, uint8_t address, const uint8_t *write, uint8_t writeLength,
+                    uint8_t *read, uint8_t readLength) {
+    t.address = address;
+    t.writeData = write;
+    t.writeLength = writeLength;
+    t.readData = read;
+    t.readLength = readLength;
+    t.done = 0;
+    t.context = 0;
+    t.status = TWI_IDLE;
+  }
+
+  // Queues a register write. If the last write of the same kind is still waiting it's skipped,
+  // the buffer is in use.
+  static void write(TwiTransaction &t, uint8_t *data, uint8_t reg, uint16_t value) {
+    if (!twiFinished(t)) return;
+    data[0] = reg;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)value;
+    twiSubmit(t);
+  }
+
+  bool readsFinished() const {
+    for (uint8_t i = 0; i < READS; i++) {
+      if (!twiFinished(reads_[i])) return false;
+    }
+    return true;
+  }
+
+  int16_t raw(uint8_t read) const { return (int16_t)((data_[read][0] << 8) | data_[read][1]); }
+
+  // Runs in the TWI interrupt when the current register has arrived
+  static void currentDone(TwiTransaction &t) {
+    INA219 &self = *(INA219 *)t.context;
+    if (t.status != TWI_OK || !self.alarm_) return;
+    int16_t raw = self.raw(READ_CURRENT);
+    if (raw > self.alarmRaw_ || raw < -self.alarmRaw_) {
+      self.alarm_(raw / (float)CURRENT_DIVIDER);
+    }
+  }
+
+  TwiTransaction reads_[READS];
+  TwiTransaction calibration_;
+  TwiTransaction config_;
+  uint8_t registers_[READS];
+  uint8_t data_[READS][2];
+  uint8_t calibrationData_[3];
+  uint8_t configData_[3];
+  void (*volatile alarm_)(float mA);
+  volatile int16_t alarmRaw_;
+};
+
+#endif
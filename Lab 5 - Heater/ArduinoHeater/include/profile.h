@@ -0,0 +1,140 @@
+/*
+ * Ramp/soak temperature profiles
+ *
+ * A profile is a list of segments. In each one the setpoint ramps from where it is to the
+ * segment's target at the segment's rate, and once the heater has caught up (the temperature
+ * is within soakBand of the target) it stays there for the hold time. Then the next segment
+ * starts. After the last one the setpoint stays at its target until the profile is stopped.
+ *
+ * The hold time only starts counting when the temperature is really at the target, so a slow
+ * heater gets the full soak even if it can't keep up with the ramp.
+ *
+ * The profile is stored in EEPROM next to the settings and runs on the Arduino, so a test
+ * doesn't need anybody to change setpoints at the right moment. Serial commands (see main.cpp):
+ *
+ *   seg N TARGET RATE HOLD  set segment N (0 = first): target in C, rate in C per minute
+ *                           (0 = jump straight to the target), hold in seconds. Segments
+ *                           after N are dropped, so enter them in order.
+ *   profile                 show the profile
+ *   run / stop              start or stop the profile
+ *   save                    stores the profile together with the settings
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <math.h>
+#include <stdint.h>
+
+struct Segment {
+  float target;   // C
+  float rate;     // C per minute, 0 = jump
+  uint16_t hold;  // seconds
+};
+
+const uint8_t MAX_SEGMENTS = 8;
+
+struct Profile {
+  uint8_t count;
+  Segment segments[MAX_SEGMENTS];
+};
+
+enum ProfilePhase : uint8_t { PROFILE_IDLE, PROFILE_RAMP, PROFILE_SOAK, PROFILE_DONE };
+
+class ProfileRunner {
+public:
+  explicit ProfileRunner(float soakBand)
+    : soakBand_(soakBand), profile_(0), phase_(PROFILE_IDLE), segment_(0), setpoint_(0),
+      rampFrom_(0), segmentStart_(0), soakStart_(0), changed_(false) {}
+
+  // Starts the profile at time now (ms), ramping from startSetpoint
+  void start(const Profile &profile, unsigned long now, float startSetpoint) {
+    profile_ = &profile;
+    setpoint_ = startSetpoint;
+    if (profile.count == 0) {
+      phase_ = PROFILE_DONE;
+      changed_ = true;
+      return;
+    }
+    enter(0, now);
+  }
+
+  void stop() {
+    if (phase_ != PROFILE_IDLE) {
+      phase_ = PROFILE_IDLE;
+      changed_ = true;
+    }
+  }
+
+  // Moves the profile along, call with every new temperature reading
+  void update(unsigned long now, float temperature, bool validTemperature) {
+    if (phase_ == PROFILE_RAMP) {
+      const Segment &s = profile_->segments[segment_];
+      // now can be a little before the start, readings are stamped when the conversion began
+      long elapsed = (long)(now - segmentStart_);
+      float step = s.rate * (elapsed > 0 ? elapsed : 0) / 60000.0f;
+      if (s.rate <= 0 || step >= fabs(s.target - rampFrom_)) {
+        setpoint_ = s.target;
+        if (validTemperature && fabs(temperature - s.target) <= soakBand_) {
+          phase_ = PROFILE_SOAK;
+          soakStart_ = now;
+          changed_ = true;
+        }
+      } else {
+        setpoint_ = rampFrom_ + (s.target > rampFrom_ ? step : -step);
+      }
+    } else if (phase_ == PROFILE_SOAK) {
+      if (now - soakStart_ >= profile_->segments[segment_].hold * 1000UL) {
+        if (segment_ + 1 < profile_->count) {
+          enter(segment_ + 1, now);
+        } else {
+          phase_ = PROFILE_DONE;
+          changed_ = true;
+        }
+      }
+    }
+  }
+
+  // True once after every change of segment or phase, time to print a marker
+  bool changed() {
+    bool changed = changed_;
+    changed_ = false;
+    return changed;
+  }
+
+  bool running() const { return phase_ == PROFILE_RAMP || phase_ == PROFILE_SOAK; }
+  bool active() const { return phase_ != PROFILE_IDLE; }
+  float setpoint() const { return setpoint_; }
+  uint8_t segment() const { return segment_; }
+  ProfilePhase phase() const { return phase_; }
+
+  const char *phaseName() const {
+    switch (phase_) {
+      case PROFILE_RAMP: return "ramp";
+      case PROFILE_SOAK: return "soak";
+      case PROFILE_DONE: return "done";
+      default: return "stopped";
+    }
+  }
+
+private:
+  void enter(uint8_t segment, unsigned long now) {
+    segment_ = segment;
+    phase_ = PROFILE_RAMP;
+    rampFrom_ = setpoint_;
+    segmentStart_ = now;
+    changed_ = true;
+  }
+
+  float soakBand_;
+  const Profile *profile_;
+  ProfilePhase phase_;
+  uint8_t segment_;
+  float setpoint_;
+  float rampFrom_;
+  unsigned long segmentStart_;
+  unsigned long soakStart_;
+  bool changed_;
+};
+
+#endif
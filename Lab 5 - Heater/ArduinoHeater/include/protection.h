@@ -0,0 +1,64 @@
+/*
+ * Heater protection that doesn't wait for the control loop
+ *
+ * The control loop only sees a new temperature once per sample period, and a stuck I2C or
+ * one wire bus can hold loop() up for much longer. These checks switch the heater off by
+ * themselves:
+ *
+ *   temperature  a reading above the limit trips as soon as it arrives
+ *   current      the sketch reads the INA219 current every few milliseconds between samples
+ *                (the INA219 has no alert pin), the I2C interrupt trips as soon as it arrives
+ *   stall        a 1 kHz Timer2 interrupt trips if loop() hasn't run for stallLimit ms
+ *   watchdog     if even the interrupts stop, the hardware watchdog switches the heater off
+ *                after 250 ms and then resets the board. The trip is reported after the restart.
+ *
+ * A trip latches: every heater stays off, and the timer interrupt keeps forcing the pins low, until
+ * the "reset" command clears it. Every trip is reported once as "#TRIP,cause,value,latency"
+ * where latency is the measured time in microseconds from detecting the fault to the pin being
+ * low, just after an "!ALARM,time,cause,tripped,value,latency_us" line for the operator (see
+ * alarm.h). Uses Timer2 and the watchdog, so tone() can't be used together with it (Uno only).
+ */
+
+#ifndef PROTECTION_H
+#define PROTECTION_H
+
+#include <stdint.h>
+
+enum TripCause : uint8_t { TRIP_NONE, TRIP_TEMPERATURE, TRIP_CURRENT, TRIP_STALL, TRIP_WATCHDOG };
+
+// Starts the timer interrupt and the watchdog. Call at the end of setup(), loop() must then
+// call protectionKick() at least every stallLimit ms (1 - 250).
+void protectionBegin(const uint8_t *heaterPins, uint8_t count, uint8_t stallLimit);
+
+// Changes the pins the protection forces low, one per heater zone. A trip switches them all off.
+void protectionPins(const uint8_t *heaterPins, uint8_t count);
+
+// Tells the protection that loop() is still running. Call at the top of loop(), and between
+// the steps of anything slow (EEPROM writes, a bus search). Does nothing before
+// protectionBegin(), so code that also runs in setup() can call it.
+void protectionKick();
+
+// Switches the heater off and latches the trip. detected is micros() when the fault was seen,
+// value is what was measured (C, mA, ms). Can be called from loop() or an interrupt.
+void protectionTrip(TripCause cause, float value, uint32_t detected);
+
+bool protectionTripped();
+TripCause protectionCause();
+const char *tripName(TripCause cause);
+
+// Clears the trip. The heater stays off until the control loop switches it on again.
+void protectionReset();
+
+// Prints the !ALARM and #TRIP lines of a new trip. Call from loop(), and right after a trip
+// from loop() so the alarm doesn't wait for the rest of it.
+void protectionReport();
+
+// Longest time the 1 kHz timer interrupt had to wait to run since the last clear, in us
+// (4 us steps). That is how long the rest of the sketch kept interrupts off at most.
+uint16_t protectionMaxLatency(bool clear);
+
+// Longest time loop() went without protectionKick() since the last clear, in ms (up to 255).
+// Anything near the stall limit is a trip waiting to happen.
+uint8_t protectionMaxStall(bool clear);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Settings that are kept in EEPROM and can be changed over the serial port
+ *
+ * The settings are stored as one block with a small header in front: a marker byte, a
+ * version number, the size of the block and a CRC of the contents. If any of those don't
+ * match (a new board, a sketch with a different settings layout, or a half-finished write)
+ * the block is ignored and the sketch uses its defaults. Change SETTINGS_VERSION in the
+ * sketch whenever you change the settings struct.
+ *
+ * Commands are plain text lines, so you can type them in the serial monitor:
+ *
+ *   ?              show the current settings
+ *   set NAME VALUE change a setting (takes effect right away)
+ *   save           store the current settings in EEPROM
+ *   defaults       go back to the settings the sketch was compiled with
+ *
+ * Every reply starts with # so the data collection GUI treats it as metadata, not data.
+ */
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+const uint8_t SETTINGS_MARKER = 0xA5;
+
+struct SettingsHeader {
+  uint8_t marker;
+  uint8_t version;
+  uint8_t size;
+  uint16_t crc;
+};
+
+// CRC-16/CCITT, good at catching a block that was only partly written
+inline uint16_t crc16(const uint8_t *data, uint16_t length, uint16_t crc = 0xFFFF) {
+  while (length--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Reads the settings block stored at address. Returns false (and leaves settings alone) if
+// there is no valid block.
+template <class T>
+bool settingsLoad(T &settings, uint8_t version, int address = 0) {
+  SettingsHeader header;
+  T stored;
+  EEPROM.get(address, header);
+  EEPROM.get(address + (int)sizeof(header), stored);
+  if (header.marker != SETTINGS_MARKER || header.version != version || header.size != sizeof(T) ||
+      header.crc != crc16((const uint8_t *)&stored, sizeof(stored))) {
+    return false;
+  }
+  settings = stored;
+  return true;
+}
+
+// Writes bytes that changed, calling busy() (if not 0) before each one. Every byte that
+// changes takes about 3.4 ms.
+inline void eepromWrite(int address, const void *data, uint16_t length, void (*busy)()) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (uint16_t i = 0; i < length; i++) {
+    if (busy) busy();
+    EEPROM.update(address + i, bytes[i]);
+  }
+}
+
+// The header is written last, so a write that gets interrupted leaves an invalid block.
+// A whole block can take a few hundred ms: busy() is called between the bytes, e.g. to tell a
+// watchdog that the sketch is still running.
+template <class T>
+void settingsSave(const T &settings, uint8_t version, int address = 0, void (*busy)() = 0) {
+  SettingsHeader header = {SETTINGS_MARKER, version, (uint8_t)sizeof(T),
+                           crc16((const uint8_t *)&settings, sizeof(settings))};
+  eepromWrite(address + (int)sizeof(header), &settings, sizeof(settings), busy);
+  eepromWrite(address, &header, sizeof(header), busy);
+}
+
+// Collects characters from the serial port into command lines
+class CommandReader {
+public:
+  CommandReader() : length_(0) {}
+
+  // Returns a complete command line (without the line ending), or 0 if there isn't one yet
+  const char *poll() {
+    while (Serial.available() > 0) {
+      char c = (char)Serial.read();
+      if (c == '\r' || c == '\n') {
+        if (length_ == 0) continue;
+        buffer_[length_] = '\0';
+        length_ = 0;
+        return buffer_;
+      }
+      if (length_ < sizeof(buffer_) - 1) buffer_[length_++] = c;
+    }
+    return 0;
+  }
+
+private:
+  char buffer_[32];
+  uint8_t length_;
+};
+
+// Checks for "set NAME VALUE" and reads the value
+inline bool commandSet(const char *command, const char *name, float &value) {
+  size_t n = strlen(name);
+  if (strncmp(command, "set ", 4) != 0 || strncmp(command + 4, name, n) != 0 || command[4 + n] != ' ') {
+    return false;
+  }
+  char *end;
+  value = (float)strtod(command + 5 + n, &end);
+  return end != command + 5 + n;
+}
+
+// Checks for "NAME VALUE VALUE ..." with exactly count numbers and reads them
+inline bool commandValues(const char *command, const char *name, float *values, uint8_t count) {
+  size_t n = strlen(name);
+  if (strncmp(command, name, n) != 0 || command[n] != ' ') {
+    return false;
+  }
+  const char *p = command + n;
+  for (uint8_t i = 0; i < count; i++) {
+    char *end;
+    values[i] = (float)strtod(p, &end);
+    if (end == p) {
+      return false;
+    }
+    p = end;
+  }
+  while (*p == ' ') p++;
+  return *p == '\0';
+}
+
+#endif
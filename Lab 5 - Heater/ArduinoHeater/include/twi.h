@@ -0,0 +1,59 @@
+/*
+ * I2C (TWI) transfers that run in the background
+ *
+ * The Wire library waits in a loop until every I2C transfer is finished, so each INA219
+ * register read holds up loop() for a few hundred microseconds (and much longer if the bus
+ * is stuck). Here a transfer is put in a queue and the TWI interrupt does the work one byte
+ * at a time. loop() carries on, and either checks the transfer's status later or lets its
+ * done() callback handle the result.
+ *
+ * A transfer writes writeLength bytes and then, after a repeated start, reads readLength
+ * bytes (either part may be empty), which covers "write a register" and "read a register".
+ * done() runs inside the interrupt, so keep it short.
+ *
+ * Replaces Wire, which can't be used at the same time (both need the TWI interrupt). Uno only.
+ */
+
+#ifndef TWI_H
+#define TWI_H
+
+#include <stdint.h>
+
+enum TwiStatus : uint8_t {
+  TWI_IDLE,     // never submitted
+  TWI_QUEUED,   // waiting or in progress
+  TWI_OK,
+  TWI_NACK,     // the device didn't answer or refused a byte
+  TWI_ERROR,    // bus error or lost arbitration
+  TWI_TIMEOUT   // took longer than TWI_TIMEOUT_US, the bus was reset
+};
+
+struct TwiTransaction {
+  uint8_t address;
+  const uint8_t *writeData;
+  uint8_t writeLength;
+  uint8_t *readData;
+  uint8_t readLength;
+  void (*done)(TwiTransaction &transaction);  // optional, called from the interrupt
+  void *context;                              // for done(), the transfer doesn't use it
+  volatile TwiStatus status;
+};
+
+// A transfer that takes longer than this is given up and the bus is reset (see twiPoll)
+const uint32_t TWI_TIMEOUT_US = 5000;
+
+void twiBegin(uint32_t frequency);
+
+// Puts a transfer in the queue. Returns false if it is still queued from last time or the
+// queue is full. The transfer and its buffers must stay untouched until it is finished.
+bool twiSubmit(TwiTransaction &transaction);
+
+// True once the transfer has finished, successfully or not
+inline bool twiFinished(const TwiTransaction &transaction) {
+  return transaction.status != TWI_QUEUED;
+}
+
+// Call from loop(): gives up a transfer that is stuck (a device holding the bus)
+void twiPoll();
+
+#endif
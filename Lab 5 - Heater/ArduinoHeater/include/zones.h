@@ -0,0 +1,122 @@
+/*
+ * Relay scheduling for an oven with several heater zones
+ *
+ * Every zone has its own control loop that says whether it wants heat. This decides which
+ * relays are really on, so the supply isn't hit by all the heaters at once:
+ *
+ *   stagger   relays switch on one at a time, at least staggerMs apart, so the inrush of
+ *             two heaters never adds up. Switching off is never held back.
+ *   cap       at most maxOn relays are on at the same time, which caps the supply current.
+ *   rotation  when zones are waiting because of the cap, a zone that has been on for
+ *             rotateMs gives way to the zone that has waited longest, so a zone that never
+ *             reaches its setpoint can't keep the others cold.
+ *
+ * Call update() from every pass of loop(), not only when a sample is taken, so a waiting
+ * relay comes on as soon as its turn comes.
+ */
+
+#ifndef ZONES_H
+#define ZONES_H
+
+#include <stdint.h>
+
+template <uint8_t ZONES>
+class RelayScheduler {
+public:
+  RelayScheduler(uint8_t maxOn, uint16_t staggerMs, uint32_t rotateMs)
+    : maxOn_(maxOn > 0 ? maxOn : 1), staggerMs_(staggerMs), rotateMs_(rotateMs),
+      lastSwitchOn_(0), switchedOn_(false) {
+    for (uint8_t z = 0; z < ZONES; z++) {
+      demand_[z] = false;
+      on_[z] = false;
+      since_[z] = 0;
+    }
+  }
+
+  // What the zone's control loop wants. now is millis().
+  void demand(uint8_t zone, bool on, unsigned long now) {
+    if (on && !demand_[zone] && !on_[zone]) {
+      since_[zone] = now;  // starts waiting
+    }
+    demand_[zone] = on;
+  }
+
+  // Switches at most one relay on, and any number off. Returns true if a relay changed.
+  bool update(unsigned long now) {
+    bool changed = false;
+    uint8_t count = 0;
+    for (uint8_t z = 0; z < ZONES; z++) {
+      if (on_[z] && !demand_[z]) {
+        on_[z] = false;
+        since_[z] = now;
+        changed = true;
+      }
+      if (on_[z]) count++;
+    }
+
+    int8_t next = longest(false, now, 0);
+    if (next < 0) {
+      return changed;
+    }
+
+    // Full: the zone that has been on longest makes room, if it has had its turn
+    if (count >= maxOn_) {
+      int8_t longestOn = longest(true, now, rotateMs_);
+      if (longestOn < 0) {
+        return changed;
+      }
+      on_[longestOn] = false;
+      since_[longestOn] = now;  // waits again, behind the zones already waiting
+      count--;
+      changed = true;
+    }
+
+    if (!switchedOn_ || now - lastSwitchOn_ >= staggerMs_) {
+      on_[next] = true;
+      since_[next] = now;
+      lastSwitchOn_ = now;
+      switchedOn_ = true;
+      changed = true;
+    }
+    return changed;
+  }
+
+  bool on(uint8_t zone) const { return on_[zone]; }
+  bool waiting(uint8_t zone) const { return demand_[zone] && !on_[zone]; }
+
+  uint8_t onCount() const {
+    uint8_t count = 0;
+    for (uint8_t z = 0; z < ZONES; z++) {
+      if (on_[z]) count++;
+    }
+    return count;
+  }
+
+private:
+  // The zone that is on (on = true) or waiting (on = false) since the longest time, at least
+  // minimum ms. -1 if there is none.
+  int8_t longest(bool on, unsigned long now, uint32_t minimum) const {
+    int8_t found = -1;
+    unsigned long age = 0;
+    for (uint8_t z = 0; z < ZONES; z++) {
+      bool match = on ? on_[z] : (demand_[z] && !on_[z]);
+      unsigned long a = now - since_[z];
+      if (match && a >= minimum && (found < 0 || a > age)) {
+        found = z;
+        age = a;
+      }
+    }
+    return found;
+  }
+
+  uint8_t maxOn_;
+  uint16_t staggerMs_;
+  uint32_t rotateMs_;
+  bool demand_[ZONES];
+  bool on_[ZONES];
+  unsigned long since_[ZONES];  // when the zone switched on, or started waiting
+  unsigned long lastSwitchOn_;
+  bool switchedOn_;
+};
+
+#endif
@@ -1,34 +1,172 @@
 // This script uses an Arduino to control a heater based on temperature readings. 
+// An oven with several heater zones can be run from one board: every zone has its own relay,
+// DS18B20 and control loop, and the relays are scheduled so they don't all switch at once
+// (see zones.h).
 // It also reads the current and voltage of the heater using an INA219 sensor. 
+// The INA219 is read in the background by the I2C interrupt (see ina219.h), so loop() keeps
+// running while the transfers are going on.
+// The sample period, pins and the setpoint are saved in EEPROM and can be changed over the
+// serial port without uploading the sketch again. Type ? in the serial monitor to see them
+// (see settings.h for the other commands).
+// Over-temperature, over-current and a stuck sketch switch the heater off within a bounded time,
+// independent of the sample period (see protection.h).
+// Trips and faulty temperature sensors are also sent as "!ALARM" lines the moment they are
+// noticed, which the data collection GUI shows right away (see alarm.h).
+// A ramp/soak profile can be stored in EEPROM and run on the Arduino (see profile.h).
 // Author: Prof. Gordon Hoople
 
 #include <Arduino.h> // Arduino library for basic functions
-#include <Wire.h> // Wire library for I2C communication
+#include <avr/sleep.h> // Sleep modes for the low power mode
 
-#include <Adafruit_INA219.h> // Adafruit library for the INA219 current sensor
+#include "twi.h" // I2C transfers done by the TWI interrupt, replaces Wire
+#include "ina219.h" // INA219 current sensor on top of twi.h, replaces Adafruit_INA219
 
-#include <OneWire.h> // OneWire library for the DS18B20 temperature sensor
-#include <DallasTemperature.h> // DallasTemperature library for the DS18B20 temperature sensor
+#include <OneWire.h> // OneWire library, only for the bench command that compares it with ds18b20.h
+#include "ds18b20.h" // DS18B20 temperature sensor, keeps interrupts off as briefly as possible
+
+#include "settings.h" // Settings saved in EEPROM and serial commands
+#include "protection.h" // Switches the heater off on faults, even if loop() is stuck
+#include "profile.h" // Ramp/soak setpoint profiles
+#include "zones.h" // Staggers the zone relays and caps how many are on
+#include "alarm.h" // Alarm lines that jump ahead of the data
 
 // Pin for the DS18B20 temperature sensor one wire bus. 
 #define ONE_WIRE_BUS 4 
 
-// Digital Pin for the heater relay
-int heater_pin = 2; // Pin for the heater
+// Heater zones. Each zone has a relay on its own pin and a DS18B20 on the shared one wire bus,
+// told apart by the sensor's ROM address. For an oven with three zones, for example:
+//   const uint8_t ZONES = 3;
+//   const uint8_t HEATER_PINS[ZONES] = {2, 3, 5};
+const uint8_t ZONES = 1;
+const uint8_t HEATER_PINS[ZONES] = {2}; // Digital pins for the heater relays
+
+// At most MAX_ZONES_ON relays are on at once and they switch on at least ZONE_STAGGER apart,
+// so the supply current stays capped. A zone that has been on for ZONE_ROTATE gives way to
+// one that is waiting.
+const uint8_t MAX_ZONES_ON = 2;
+const uint16_t ZONE_STAGGER = 100;   // milliseconds
+const uint32_t ZONE_ROTATE = 5000;   // milliseconds
+const uint8_t MAX_SENSORS = 8;       // How many DS18B20s the bus search looks for
+
+// Heater control: a zone's heater switches on below SETPOINT - HYSTERESIS and off above
+// SETPOINT + HYSTERESIS. The gap stops the relay from clicking on and off all the time.
+const float SETPOINT = 40.0;   // Target temperature in C
+const float HYSTERESIS = 0.5;  // C
 
-// Setup a oneWire instance to communicate with any OneWire devices (not just Maxim/Dallas temperature ICs)
-OneWire oneWire(ONE_WIRE_BUS);
+// Protection limits. Going over either one switches the heater off until you type "reset".
+const float MAX_TEMPERATURE = 80.0;          // C
+const float TEMPERATURE_LIMIT = 120.0;       // C, the highest maxtemp accepted (DS18B20: 125 C)
+const float MAX_CURRENT = 2000.0;            // mA, the INA219's default range is 3.2 A
+const unsigned long CURRENT_CHECK_PERIOD = 10; // Read the current this often between samples (milliseconds)
+const uint8_t STALL_LIMIT = 100;             // Heater off if loop() stops for this long (milliseconds)
 
-// Pass our oneWire reference to Dallas Temperature.
-DallasTemperature sensors(&oneWire);
+// The temperature sensors on the one wire bus
+DS18B20 thermometer;
+uint8_t sensorRoms[MAX_SENSORS][DS18B20::ROM_SIZE]; // The sensors the bus search found, in ROM order
+uint8_t sensorCount = 0;
+int8_t zoneSensor[ZONES];                           // Each zone's sensor in sensorRoms, -1 = none
 
-Adafruit_INA219 ina219; // Create an instance of the INA219 class for current sensing
-// The Adafruit_INA219 library uses the I2C bus to communicate with the INA219 chip.
+RelayScheduler<ZONES> relays(MAX_ZONES_ON, ZONE_STAGGER, ZONE_ROTATE);
+
+INA219 ina219; // The INA219 current sensor at its default I2C address
+const uint32_t I2C_FREQUENCY = 400000; // Hz, a reading then takes about half a millisecond
 
 const unsigned long SAMPLE_PERIOD = 500;  // Sample period in milliseconds, you can adjust this value.
 // You don't need this to be 4 ms like it was for reading accelerometer data.
 
+// Low power mode for a battery powered monitor: the Arduino sleeps while it waits for the next
+// sample and for the temperature conversion, and the INA219 is powered down between samples
+// (so the current is then only checked once per sample). The DS18B20 goes into standby by
+// itself after every conversion.
+const bool LOW_POWER = false;
+
+// The settings that are saved in EEPROM. The values above are the defaults.
+// Change SETTINGS_VERSION whenever you change this struct, so old saved settings are ignored.
+struct Settings {
+  uint16_t samplePeriod;  // milliseconds
+  uint8_t heaterPins[ZONES];
+  uint8_t oneWirePin;
+  float setpoints[ZONES]; // C
+  float hysteresis;       // C
+  float maxTemperature;   // C
+  float maxCurrent;       // mA
+  uint8_t sensors[ZONES][DS18B20::ROM_SIZE]; // ROM of each zone's sensor, all 0 = the next one found
+};
+const uint8_t SETTINGS_VERSION = 3;
+Settings settings;
+CommandReader commands;
+
+// The ramp/soak profile, saved in EEPROM after the settings. A segment's hold time starts
+// once the temperature is within SOAK_BAND of its target.
+const float SOAK_BAND = 1.0;       // C
+const int PROFILE_ADDRESS = 128;   // EEPROM address, after the settings block
+static_assert(sizeof(SettingsHeader) + sizeof(Settings) <= PROFILE_ADDRESS, "too many zones for the settings block");
+const uint8_t PROFILE_VERSION = 1;
+const int BENCH_ADDRESS = 512;     // EEPROM the bench command may overwrite, nothing is kept there
+Profile profile;                   // Empty until one is loaded or entered
+ProfileRunner runner(SOAK_BAND);
+
+bool haveINA219 = false;       // Found the current sensor at startup
+bool haveTemperature = false;  // Found a DS18B20 for at least one zone
+bool temperatureValid[ZONES];  // The zone's last reading was good
+bool sensorAlarm[ZONES];       // An alarm went out for the zone's sensor and it hasn't recovered yet
+
 unsigned long previousMillis = 0;  // Stores the last sampling time
+unsigned long lastCurrentCheck = 0;
+unsigned long conversionTime = 750;  // How long a conversion takes (milliseconds)
+uint8_t readingZone = 0;             // The zone to read next once the conversion is done
+
+// A sample goes through these steps, loop() keeps running in between
+enum SampleState : uint8_t {
+  SAMPLE_IDLE,        // Waiting for the next sample period
+  SAMPLE_CONVERTING,  // Waiting for the DS18B20s to finish the conversion, then reading them
+  SAMPLE_WAKING,      // Waiting for the INA219 to wake up (LOW_POWER) or for the I2C queue
+  SAMPLE_MEASURING    // The INA219 reading is on its way
+};
+SampleState sampleState = SAMPLE_IDLE;
+unsigned long wakeMillis = 0;        // When SAMPLE_WAKING started
+const unsigned long WAKE_TIME = 2;   // Let the INA219 finish one conversion after waking up (milliseconds)
+
+// Report-by-exception (deadband) output. The temperature and the heater readings often stay
+// the same for a long time. With USE_DEADBAND a field is only printed when it has changed by
+// more than its deadband since it was last printed, or when it hasn't been printed for
+// MAX_SILENCE. Unchanged fields are left empty and lines with nothing new are skipped; the
+// data collection GUI fills the gaps back in when it saves the file.
+const bool USE_DEADBAND = false;
+const unsigned long MAX_SILENCE = 10000; // Print every field at least this often (milliseconds)
+// Temperature (C) of every zone, the INA219 fields, then the Setpoint (C) of every zone
+const uint8_t INA_FIELDS = 5;
+const uint8_t NUM_FIELDS = ZONES + INA_FIELDS + ZONES;
+const float TEMPERATURE_DEADBAND = 0.1;
+// Shunt Voltage (mV), Bus Voltage (V), Current (mA), Power (mW), Load Voltage (V)
+const float INA_DEADBAND[INA_FIELDS] = {0.05, 0.05, 2.0, 20.0, 0.05};
+const float SETPOINT_DEADBAND = 0.05;
+
+float fieldDeadband(uint8_t field) {
+  if (field < ZONES) {
+    return TEMPERATURE_DEADBAND;
+  }
+  if (field < ZONES + INA_FIELDS) {
+    return INA_DEADBAND[field - ZONES];
+  }
+  return SETPOINT_DEADBAND;
+}
+
+float lastPrinted[NUM_FIELDS];                // Last value printed for each field
+unsigned long lastPrintedTime[NUM_FIELDS];    // When it was printed
+bool everPrinted[NUM_FIELDS] = {false};
+
+// Returns true if this field needs to be printed, and remembers it as printed
+bool fieldChanged(uint8_t field, float value, unsigned long now) {
+  if (USE_DEADBAND && everPrinted[field] && fabs(value - lastPrinted[field]) <= fieldDeadband(field)
+      && now - lastPrintedTime[field] < MAX_SILENCE) {
+    return false;
+  }
+  lastPrinted[field] = value;
+  lastPrintedTime[field] = now;
+  everPrinted[field] = true;
+  return true;
+}
 
 // Variables to hold sensor readings
 float shuntvoltage = 0;
@@ -36,88 +174,684 @@ float busvoltage = 0;
 float current_mA = 0;
 float loadvoltage = 0;
 float power_mW = 0;
-float tempC = 0;
+float tempC[ZONES];
+
+// Prints the column names. With one zone they are the same as they always were.
+void printHeader() {
+  Serial.print("Time (ms)");
+  for (uint8_t z = 0; z < ZONES; z++) {
+    Serial.print(", Temperature");
+    if (ZONES > 1) {
+      Serial.print(" ");
+      Serial.print(z);
+    }
+    Serial.print(" (C)");
+  }
+  Serial.print(", Shunt Voltage, Bus Voltage (V), Current (mA), Power (mW), Load Voltage (V)");
+  for (uint8_t z = 0; z < ZONES; z++) {
+    Serial.print(", Setpoint");
+    if (ZONES > 1) {
+      Serial.print(" ");
+      Serial.print(z);
+    }
+    Serial.print(" (C)");
+  }
+  Serial.println();
+}
+
+void defaultSettings() {
+  settings.samplePeriod = SAMPLE_PERIOD;
+  settings.oneWirePin = ONE_WIRE_BUS;
+  for (uint8_t z = 0; z < ZONES; z++) {
+    settings.heaterPins[z] = HEATER_PINS[z];
+    settings.setpoints[z] = SETPOINT;
+    memset(settings.sensors[z], 0, DS18B20::ROM_SIZE);
+  }
+  settings.hysteresis = HYSTERESIS;
+  settings.maxTemperature = MAX_TEMPERATURE;
+  settings.maxCurrent = MAX_CURRENT;
+}
+
+bool romEmpty(const uint8_t *rom) {
+  for (uint8_t i = 0; i < DS18B20::ROM_SIZE; i++) {
+    if (rom[i] != 0) return false;
+  }
+  return true;
+}
+
+// Gives every zone its sensor: the one with the saved ROM, or if none is saved the next
+// sensor (in ROM order) that no other zone has
+void assignSensors() {
+  bool used[MAX_SENSORS] = {false};
+  for (uint8_t z = 0; z < ZONES; z++) {
+    zoneSensor[z] = -1;
+    temperatureValid[z] = false;
+    sensorAlarm[z] = false;
+    for (uint8_t k = 0; k < sensorCount && !romEmpty(settings.sensors[z]); k++) {
+      if (memcmp(settings.sensors[z], sensorRoms[k], DS18B20::ROM_SIZE) == 0) {
+        zoneSensor[z] = k;
+        used[k] = true;
+      }
+    }
+  }
+  uint8_t next = 0;
+  for (uint8_t z = 0; z < ZONES; z++) {
+    if (!romEmpty(settings.sensors[z])) continue;
+    while (next < sensorCount && used[next]) next++;
+    if (next < sensorCount) {
+      zoneSensor[z] = next;
+      used[next] = true;
+    }
+  }
+  haveTemperature = false;
+  for (uint8_t z = 0; z < ZONES; z++) {
+    if (zoneSensor[z] >= 0) {
+      haveTemperature = true;
+    } else {
+      Serial.print("#WARNING,no DS18B20 temperature sensor found for zone ");
+      Serial.println(z);
+    }
+  }
+}
+
+// Looks for the temperature sensors on the one wire bus. This takes about 15 ms per sensor,
+// and a few milliseconds when nothing is connected.
+void startTemperatureSensor() {
+  thermometer.begin(settings.oneWirePin);
+  // We don't wait for the conversion, loop() keeps running (and checking the current) meanwhile
+  conversionTime = DS18B20::CONVERSION_TIME;
+  if (sampleState == SAMPLE_CONVERTING) {
+    sampleState = SAMPLE_IDLE; // That conversion was on the old pin
+  }
+  sensorCount = thermometer.search(sensorRoms, MAX_SENSORS, protectionKick);
+  assignSensors();
+}
+
+// The ROM of the zone's sensor, 0 if it has none
+const uint8_t *zoneRom(uint8_t zone) {
+  return zoneSensor[zone] >= 0 ? sensorRoms[zoneSensor[zone]] : 0;
+}
+
+void startHeaters() {
+  for (uint8_t z = 0; z < ZONES; z++) {
+    digitalWrite(settings.heaterPins[z], LOW); // Start with the heaters off
+    pinMode(settings.heaterPins[z], OUTPUT);
+  }
+  protectionPins(settings.heaterPins, ZONES);
+}
+
+// The profile's setpoint while one is loaded, otherwise the zone's fixed one
+float currentSetpoint(uint8_t zone) {
+  return runner.active() ? runner.setpoint() : settings.setpoints[zone];
+}
+
+// The temperature the profile goes by: the zone farthest from the profile's setpoint, so a
+// soak only starts once every zone has got there. False if a zone has no good reading.
+bool profileTemperature(float &temperature) {
+  bool valid = haveTemperature;
+  float worst = -1;
+  for (uint8_t z = 0; z < ZONES; z++) {
+    if (zoneSensor[z] < 0) continue;
+    valid = valid && temperatureValid[z];
+    float off = fabs(tempC[z] - runner.setpoint());
+    if (off > worst) {
+      worst = off;
+      temperature = tempC[z];
+    }
+  }
+  return valid;
+}
+
+// The coldest zone with a good reading. False if there is none.
+bool coldestTemperature(float &temperature) {
+  bool found = false;
+  for (uint8_t z = 0; z < ZONES; z++) {
+    if (temperatureValid[z] && (!found || tempC[z] < temperature)) {
+      temperature = tempC[z];
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Marks every change of profile segment or phase in the stream as
+// "#SEGMENT,time,segment,phase,target"
+void reportProfile(unsigned long now) {
+  if (!runner.changed()) {
+    return;
+  }
+  Serial.print("#SEGMENT,");
+  Serial.print(now);
+  Serial.print(",");
+  Serial.print(runner.segment());
+  Serial.print(",");
+  Serial.print(runner.phaseName());
+  Serial.print(",");
+  Serial.println(profile.count > 0 ? profile.segments[runner.segment()].target : currentSetpoint(0));
+}
+
+// Prints the profile as one "#PROFILE,segment,target,rate,hold" line per segment
+void showProfile() {
+  for (uint8_t i = 0; i < profile.count; i++) {
+    Serial.print("#PROFILE,");
+    Serial.print(i);
+    Serial.print(",");
+    Serial.print(profile.segments[i].target);
+    Serial.print(",");
+    Serial.print(profile.segments[i].rate);
+    Serial.print(",");
+    Serial.println(profile.segments[i].hold);
+  }
+  if (profile.count == 0) {
+    Serial.println("#PROFILE,empty");
+  }
+}
+
+// Prints "#BENCH,name,ms,gap_ms", with WARNING if the gap came close to a stall trip
+void benchLine(const char *name, unsigned long ms, uint8_t gap) {
+  Serial.print("#BENCH,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.print(ms);
+  Serial.print(",");
+  Serial.println(gap);
+  if (gap >= STALL_LIMIT / 2) {
+    Serial.print("#WARNING,");
+    Serial.print(name);
+    Serial.println(" came close to a stall trip");
+  }
+}
+
+// Measures how long interrupts are held off while reading the sensor, first with the OneWire
+// library and then with ds18b20.h (and with neither, for comparison). Prints the longest
+// wait of the protection's timer interrupt for each: "#BENCH,idle,us", "#BENCH,onewire,us"
+// and "#BENCH,ds18b20,us".
+// Then it checks that the slow commands keep the stall check fed: it saves a full profile where
+// every byte changes (the worst case of "save") at BENCH_ADDRESS, and searches the one wire bus,
+// and prints how long each took and the longest time without a kick, "#BENCH,save,ms,gap_ms"
+// and "#BENCH,search,ms,gap_ms". The gap must stay well under STALL_LIMIT.
+void runBench() {
+  const uint8_t BENCH_READS = 10;
+  uint8_t data[9];
+
+  protectionMaxLatency(true);
+  unsigned long start = millis();
+  while (millis() - start < 100) {
+    protectionKick();
+  }
+  uint16_t idle = protectionMaxLatency(true);
+
+  OneWire library(settings.oneWirePin);
+  for (uint8_t n = 0; n < BENCH_READS; n++) {
+    protectionKick();
+    library.reset();
+    library.skip();
+    library.write(0xBE); // Read scratchpad
+    for (uint8_t i = 0; i < 9; i++) {
+      data[i] = library.read();
+    }
+  }
+  uint16_t withLibrary = protectionMaxLatency(true);
+
+  thermometer.begin(settings.oneWirePin); // The library changed the pin's registers
+  for (uint8_t n = 0; n < BENCH_READS; n++) {
+    protectionKick();
+    thermometer.readScratchpad(data, zoneRom(0));
+  }
+  uint16_t withDriver = protectionMaxLatency(true);
+
+  Serial.print("#BENCH,idle,");
+  Serial.println(idle);
+  Serial.print("#BENCH,onewire,");
+  Serial.println(withLibrary);
+  Serial.print("#BENCH,ds18b20,");
+  Serial.println(withDriver);
+
+  // Eight segments that differ in every byte from what is stored there now
+  Profile full;
+  uint8_t *bytes = (uint8_t *)&full;
+  for (uint16_t i = 0; i < sizeof(full); i++) {
+    bytes[i] = (uint8_t)~EEPROM.read(BENCH_ADDRESS + (int)sizeof(SettingsHeader) + i);
+  }
+  full.count = MAX_SEGMENTS;
+  protectionKick();
+  protectionMaxStall(true);
+  start = millis();
+  settingsSave(full, PROFILE_VERSION, BENCH_ADDRESS, protectionKick);
+  benchLine("save", millis() - start, protectionMaxStall(true));
+
+  uint8_t roms[MAX_SENSORS][DS18B20::ROM_SIZE];
+  protectionKick();
+  start = millis();
+  thermometer.search(roms, MAX_SENSORS, protectionKick);
+  benchLine("search", millis() - start, protectionMaxStall(true));
+}
+
+// Called from the I2C interrupt when the INA219 reports a current above the limit
+void currentAlarm(float mA) {
+  protectionTrip(TRIP_CURRENT, mA, micros());
+}
+
+// Switches a zone's heater, but never on while the protection is tripped
+void setHeater(uint8_t zone, bool on) {
+  noInterrupts(); // So a trip can't come in between the check and the write
+  digitalWrite(settings.heaterPins[zone], on && !protectionTripped() ? HIGH : LOW);
+  interrupts();
+}
+
+// Sets every relay the way the scheduler has it
+void applyRelays() {
+  for (uint8_t z = 0; z < ZONES; z++) {
+    setHeater(z, relays.on(z));
+  }
+}
+
+void printRom(const uint8_t *rom) {
+  for (uint8_t i = 0; i < DS18B20::ROM_SIZE; i++) {
+    if (rom[i] < 0x10) Serial.print("0");
+    Serial.print(rom[i], HEX);
+  }
+}
+
+// Prints the sensors the bus search found as "#SENSOR,index,rom"
+void showSensors() {
+  for (uint8_t k = 0; k < sensorCount; k++) {
+    Serial.print("#SENSOR,");
+    Serial.print(k);
+    Serial.print(",");
+    printRom(sensorRoms[k]);
+    Serial.println();
+  }
+  if (sensorCount == 0) {
+    Serial.println("#SENSOR,none");
+  }
+}
+
+// Prints the settings as "#SETTINGS,period=500,onewirepin=4,...", the alarms sent so far as
+// "#ALARMS,count=1,max_latency_us=2900" and then every zone as
+// "#ZONE,zone,heaterpin,setpoint,sensor rom,relay"
+void showSettings() {
+  Serial.print("#SETTINGS,period=");
+  Serial.print(settings.samplePeriod);
+  Serial.print(",onewirepin=");
+  Serial.print(settings.oneWirePin);
+  Serial.print(",zones=");
+  Serial.print(ZONES);
+  Serial.print(",hysteresis=");
+  Serial.print(settings.hysteresis);
+  Serial.print(",maxtemp=");
+  Serial.print(settings.maxTemperature);
+  Serial.print(",maxcurrent=");
+  Serial.print(settings.maxCurrent);
+  Serial.print(",tripped=");
+  Serial.print(tripName(protectionCause()));
+  Serial.print(",irqlatency=");
+  Serial.println(protectionMaxLatency(false)); // Longest interrupt wait so far (us)
+  showAlarms();
+  for (uint8_t z = 0; z < ZONES; z++) {
+    Serial.print("#ZONE,");
+    Serial.print(z);
+    Serial.print(",");
+    Serial.print(settings.heaterPins[z]);
+    Serial.print(",");
+    Serial.print(settings.setpoints[z]);
+    Serial.print(",");
+    if (zoneSensor[z] >= 0) {
+      printRom(zoneRom(z));
+    } else {
+      Serial.print("none");
+    }
+    Serial.print(",");
+    Serial.println(relays.on(z) ? "on" : relays.waiting(z) ? "waiting" : "off");
+  }
+}
+
+// The highest temperature the setpoints or the profile ask for, maxtemp has to stay above it
+float highestSetpoint() {
+  float highest = settings.setpoints[0];
+  for (uint8_t z = 1; z < ZONES; z++) {
+    if (settings.setpoints[z] > highest) highest = settings.setpoints[z];
+  }
+  for (uint8_t i = 0; i < profile.count; i++) {
+    if (profile.segments[i].target > highest) highest = profile.segments[i].target;
+  }
+  return highest;
+}
+
+// Runs one command typed into the serial port (see settings.h). Setpoints must stay below
+// maxtemp, and maxtemp above them and at most TEMPERATURE_LIMIT, so a typo can neither switch
+// the over-temperature cutoff off nor make it trip all the time.
+void handleCommand(const char *command) {
+  float value;
+  float segment[4];
+  float zone[2];
+  if (strcmp(command, "hb") == 0) {
+    // The data collection GUI's heartbeat, only the DAQ sketch keeps data while it's missing
+  } else if (strcmp(command, "?") == 0) {
+    showSettings();
+  } else if (strcmp(command, "save") == 0) {
+    // A full profile changes about 90 bytes, 300 ms of EEPROM writes: keep the protection fed
+    settingsSave(settings, SETTINGS_VERSION, 0, protectionKick);
+    settingsSave(profile, PROFILE_VERSION, PROFILE_ADDRESS, protectionKick);
+    Serial.println("#OK");
+  } else if (strcmp(command, "bench") == 0) {
+    runBench();
+  } else if (strcmp(command, "profile") == 0) {
+    showProfile();
+  } else if (strcmp(command, "sensors") == 0) {
+    showSensors();
+  } else if (commandValues(command, "seg", segment, 4) && segment[0] >= 0 && segment[0] < MAX_SEGMENTS &&
+             segment[0] <= profile.count && segment[1] < settings.maxTemperature && segment[2] >= 0 &&
+             segment[3] >= 0 && segment[3] <= 65535) {
+    runner.stop(); // Changing the profile under a running one would skip around in it
+    reportProfile(millis());
+    uint8_t i = (uint8_t)segment[0];
+    profile.segments[i].target = segment[1];
+    profile.segments[i].rate = segment[2];
+    profile.segments[i].hold = (uint16_t)segment[3];
+    profile.count = i + 1;
+    Serial.println("#OK");
+  } else if (strcmp(command, "run") == 0 && profile.count == 0) {
+    Serial.println("#ERROR,the profile is empty");
+  } else if (strcmp(command, "run") == 0) {
+    // Ramp from the temperature the coldest zone is at, if we know it
+    float start = settings.setpoints[0];
+    coldestTemperature(start);
+    runner.start(profile, millis(), start);
+    Serial.println("#OK");
+    reportProfile(millis());
+  } else if (strcmp(command, "stop") == 0) {
+    runner.stop();
+    Serial.println("#OK");
+    reportProfile(millis());
+  } else if (strcmp(command, "defaults") == 0) {
+    for (uint8_t z = 0; z < ZONES; z++) {
+      digitalWrite(settings.heaterPins[z], LOW);
+    }
+    defaultSettings();
+    startHeaters();
+    startTemperatureSensor();
+    ina219.setCurrentAlarm(settings.maxCurrent, currentAlarm);
+    Serial.println("#OK");
+  } else if (commandSet(command, "period", value) && value >= 100 && value <= 60000) {
+    settings.samplePeriod = (uint16_t)value;
+    Serial.println("#OK");
+  } else if (commandSet(command, "setpoint", value) && value < settings.maxTemperature) {
+    for (uint8_t z = 0; z < ZONES; z++) {
+      settings.setpoints[z] = value;
+    }
+    Serial.println("#OK");
+  } else if (commandValues(command, "zonesetpoint", zone, 2) && zone[0] >= 0 && zone[0] < ZONES &&
+             zone[1] < settings.maxTemperature) {
+    settings.setpoints[(uint8_t)zone[0]] = zone[1];
+    Serial.println("#OK");
+  } else if (strcmp(command, "reset") == 0) {
+    protectionReset(); // The heater comes back on at the next sample if it should
+    Serial.println("#OK");
+  } else if (commandSet(command, "maxtemp", value) && value > highestSetpoint() &&
+             value <= TEMPERATURE_LIMIT) {
+    settings.maxTemperature = value;
+    Serial.println("#OK");
+  } else if (commandSet(command, "maxcurrent", value) && value > 0) {
+    settings.maxCurrent = value;
+    ina219.setCurrentAlarm(settings.maxCurrent, currentAlarm);
+    Serial.println("#OK");
+  } else if (commandSet(command, "hysteresis", value) && value >= 0) {
+    settings.hysteresis = value;
+    Serial.println("#OK");
+  } else if (commandValues(command, "zonepin", zone, 2) && zone[0] >= 0 && zone[0] < ZONES &&
+             zone[1] >= 0 && zone[1] <= 19) {
+    uint8_t z = (uint8_t)zone[0];
+    digitalWrite(settings.heaterPins[z], LOW); // Turn the heater off on the old pin
+    settings.heaterPins[z] = (uint8_t)zone[1];
+    startHeaters();
+    Serial.println("#OK");
+  } else if (commandValues(command, "zonesensor", zone, 2) && zone[0] >= 0 && zone[0] < ZONES &&
+             zone[1] >= -1 && zone[1] < sensorCount) {
+    // -1 goes back to taking the next free sensor
+    uint8_t z = (uint8_t)zone[0];
+    if (zone[1] < 0) {
+      memset(settings.sensors[z], 0, DS18B20::ROM_SIZE);
+    } else {
+      memcpy(settings.sensors[z], sensorRoms[(uint8_t)zone[1]], DS18B20::ROM_SIZE);
+    }
+    assignSensors();
+    Serial.println("#OK");
+  } else if (commandSet(command, "onewirepin", value) && value >= 0 && value <= 19) {
+    settings.oneWirePin = (uint8_t)value;
+    startTemperatureSensor();
+    Serial.println("#OK");
+  } else {
+    Serial.println("#ERROR,unknown command or value out of range");
+  }
+}
 
 void setup(){
   //Serial Setup
   Serial.begin(115200); // Note the highest recommended serial baud rate for stability is 115200. 
 
-  // Initialize the digital pin for the heater
-  pinMode(heater_pin, OUTPUT); 
+  // Use the saved settings if there are any
+  defaultSettings();
+  settingsLoad(settings, SETTINGS_VERSION);
+  settingsLoad(profile, PROFILE_VERSION, PROFILE_ADDRESS);
+  if (!(settings.maxTemperature <= TEMPERATURE_LIMIT)) {
+    settings.maxTemperature = MAX_TEMPERATURE; // Saved before the limit was checked
+  }
+
+  // Initialize the digital pins for the heaters
+  startHeaters();
 
   // Initialize the INA219.
   // By default the initialization will use the largest range (32V, 2A).
-  if (! ina219.begin()) {
-    Serial.println("Failed to find INA219 chip");
-    while (1) { delay(10); }
+  // If it isn't connected we carry on without it, so the heater still works.
+  // A stuck I2C bus is given up after TWI_TIMEOUT_US instead of hanging.
+  twiBegin(I2C_FREQUENCY);
+  haveINA219 = ina219.begin();
+  if (haveINA219 && LOW_POWER) {
+    ina219.powerSave(true);
   }
+  ina219.setCurrentAlarm(settings.maxCurrent, currentAlarm);
+
+  printHeader();
+  if (USE_DEADBAND) {
+    // Tells the GUI to fill in the empty fields at this sample period
+    Serial.print("#DEADBAND,");
+    Serial.print(settings.samplePeriod);
+    Serial.print(",");
+    Serial.println(MAX_SILENCE);
+  }
+  if (!haveINA219) {
+    Serial.println("#WARNING,no INA219 current sensor found");
+  }
+
+  // Find the temperature sensors
+  startTemperatureSensor();
 
-  Serial.println("Time (ms), Temperature (C), Shunt Voltage, Bus Voltage (V), Current (mA), Power (mW), Load Voltage (V)");
+  // From here on loop() must keep running
+  protectionBegin(settings.heaterPins, ZONES, STALL_LIMIT);
+}
 
-  // Start up the dallas temperature library
-  sensors.begin();
+// Reads one zone's finished temperature conversion. An over-temperature trips right here,
+// before the other zones and the INA219 reading.
+void readTemperature(uint8_t zone) {
+  if (zoneSensor[zone] < 0) {
+    return; // No sensor, the zone stays invalid
+  }
+  // Get the temperature in Celsius, checking the reading's CRC
+  uint32_t detected = micros();
+  temperatureValid[zone] = thermometer.readTemperature(tempC[zone], zoneRom(zone));
+  char name[] = "zone0";
+  name[4] = (char)('0' + zone);
+  if (!temperatureValid[zone]) {
+    if (!sensorAlarm[zone]) {
+      sensorAlarm[zone] = true;
+      sendAlarm(millis(), name, "fault", -999, detected);
+    }
+    Serial.print("Error: Temperature sensor disconnected or invalid reading! Zone ");
+    Serial.println(zone);
+    return;
+  }
+  if (sensorAlarm[zone]) {
+    sensorAlarm[zone] = false;
+    sendAlarm(millis(), name, "ok", tempC[zone], detected);
+  }
+  if (tempC[zone] > settings.maxTemperature) {
+    protectionTrip(TRIP_TEMPERATURE, tempC[zone], micros());
+    protectionReport();
+  }
+}
 
+// Next step of a sample after the temperature: in low power mode the INA219 has to be powered
+// up first
+void wakeINA219() {
+  sampleState = SAMPLE_WAKING;
+  wakeMillis = millis();
+  if (haveINA219 && LOW_POWER) {
+    ina219.powerSave(false);
+  }
+}
+
+// Last part of a sample, once the temperatures and the INA219 reading are in: prints the line
+// and runs every zone's control loop
+void finishSample(unsigned long sampleMillis) {
+  // Move the profile along. A trip stops it, the heaters can't follow it anymore.
+  if (protectionTripped()) {
+    runner.stop();
+  }
+  float profileTemp = 0;
+  bool validProfileTemp = profileTemperature(profileTemp);
+  runner.update(sampleMillis, profileTemp, validProfileTemp);
+  reportProfile(sampleMillis);
+
+  // Take the INA219 values, if the reading came through
+  bool validINA219 = haveINA219 && ina219.readingOk();
+  if (validINA219) {
+    shuntvoltage = ina219.shuntVoltage_mV();
+    busvoltage = ina219.busVoltage_V();
+    current_mA = ina219.current_mA();
+    power_mW = ina219.power_mW();
+    loadvoltage = busvoltage + (shuntvoltage / 1000);
+  }
+  if (haveINA219 && LOW_POWER) {
+    ina219.powerSave(true);
+  }
+
+  // Print out the data
+  float fields[NUM_FIELDS];
+  for (uint8_t z = 0; z < ZONES; z++) {
+    fields[z] = temperatureValid[z] ? tempC[z] : -999; // Use -999 to indicate invalid temperature
+    fields[ZONES + INA_FIELDS + z] = currentSetpoint(z);
+  }
+  const float ina[INA_FIELDS] = {shuntvoltage, busvoltage, current_mA, power_mW, loadvoltage};
+  for (uint8_t i = 0; i < INA_FIELDS; i++) {
+    fields[ZONES + i] = ina[i];
+  }
+  bool changed[NUM_FIELDS];
+  bool anyChanged = false;
+  for (uint8_t i = 0; i < NUM_FIELDS; i++) {
+    changed[i] = fieldChanged(i, fields[i], sampleMillis);
+    anyChanged = anyChanged || changed[i];
+  }
+  if (anyChanged) {
+    Serial.print(sampleMillis);
+    for (uint8_t i = 0; i < NUM_FIELDS; i++) {
+      Serial.print(",");
+      bool fromINA219 = i >= ZONES && i < ZONES + INA_FIELDS;
+      if (changed[i] && (!fromINA219 || validINA219)) { // Fields without a reading stay empty
+        Serial.print(fields[i]);
+      }
+    }
+    Serial.println();
+  }
+
+  // Heater control logic for every zone, only if its temperature is valid. This only says
+  // which zones want heat, the relay scheduler switches them (see loop()).
+  for (uint8_t z = 0; z < ZONES; z++) {
+    if (temperatureValid[z]) {
+
+      if (tempC[z] < currentSetpoint(z) - settings.hysteresis) { 
+        relays.demand(z, true, sampleMillis); // Too cold, heater on
+      } 
+      else if (tempC[z] > currentSetpoint(z) + settings.hysteresis) { 
+        relays.demand(z, false, sampleMillis); // Warm enough, heater off
+      }
+    }
+    else {
+      relays.demand(z, false, sampleMillis); // Without a temperature it isn't safe to heat
+    }
+  }
+  relays.update(millis());
+  applyRelays(); // Also brings the heaters back after a trip was reset
 }
 
 void loop() {
+  protectionKick();
+  protectionReport();
+
+  const char *command = commands.poll();
+  if (command) {
+    handleCommand(command);
+  }
+
   unsigned long currentMillis = millis();
-  unsigned long elapsedTime = currentMillis - previousMillis;
-  
+
+  // Give up on a stuck I2C transfer
+  twiPoll();
+
+  // Check the current between samples, so an over-current doesn't wait for the next sample.
+  // This only queues the read, the alarm trips the protection from the I2C interrupt.
+  if (haveINA219 && !LOW_POWER && sampleState != SAMPLE_MEASURING &&
+      currentMillis - lastCurrentCheck >= CURRENT_CHECK_PERIOD) {
+    lastCurrentCheck = currentMillis;
+    ina219.startCurrent();
+  }
+
   // Check if it's time to take a sample
-  if (elapsedTime >= SAMPLE_PERIOD) {
-  
+  if (sampleState == SAMPLE_IDLE && currentMillis - previousMillis >= settings.samplePeriod) {
     // Save the time of this sample
     previousMillis = currentMillis;
-    
-    // Read the temperature and convert to proper units
-    sensors.requestTemperatures(); // Send the command to get temperatures
-        
-        // Add a small delay to allow sensor to complete reading
-        delay(30);
-
-    tempC = sensors.getTempCByIndex(0); // Get the temperature in Celsius from the first sensor on the bus
-
-    // Check if the temperature reading is valid
-    bool validTemperature = true;
-    if (tempC == DEVICE_DISCONNECTED_C) {
-      Serial.println("Error: Temperature sensor disconnected or invalid reading!");
-      validTemperature = false; // Mark the temperature as invalid
-    }
-
-    // Request data from the INA219 sensor
-    shuntvoltage = ina219.getShuntVoltage_mV();
-    busvoltage = ina219.getBusVoltage_V();
-    current_mA = ina219.getCurrent_mA();
-    power_mW = ina219.getPower_mW();
-    loadvoltage = busvoltage + (shuntvoltage / 1000);
-
-    // Print out the data
-    Serial.print(currentMillis);
-    Serial.print(",");
-    Serial.print(validTemperature ? tempC : -999); // Use -999 to indicate invalid temperature
-    Serial.print(",");
-    Serial.print(shuntvoltage);
-    Serial.print(",");
-    Serial.print(busvoltage);
-    Serial.print(",");
-    Serial.print(current_mA);
-    Serial.print(",");
-    Serial.print(power_mW);
-    Serial.print(",");
-    Serial.println(loadvoltage);
+    if (haveTemperature) {
+      thermometer.startConversion(); // Starts every zone's conversion and returns right away
+      sampleState = SAMPLE_CONVERTING;
+      readingZone = 0;
+    } else {
+      wakeINA219();
+    }
+  }
 
-    // Heater control logic only if the temperature is valid
-    if (validTemperature) {
+  // The temperature conversion is done. One zone is read per pass, about 10 ms each, so the
+  // rest of loop() keeps running in between.
+  if (sampleState == SAMPLE_CONVERTING && millis() - previousMillis >= conversionTime) {
+    readTemperature(readingZone);
+    if (++readingZone >= ZONES) {
+      wakeINA219();
+    }
+  }
 
-      // Complete this heater control control logic
+  // Start the INA219 reading
+  if (sampleState == SAMPLE_WAKING) {
+    if (!haveINA219) {
+      finishSample(previousMillis);
+      sampleState = SAMPLE_IDLE;
+    } else if ((!LOW_POWER || millis() - wakeMillis >= WAKE_TIME) && ina219.startReading()) {
+      sampleState = SAMPLE_MEASURING; // Returns right away, the I2C interrupt does the rest
+    }
+  }
 
-      if () { 
+  // The INA219 reading is in
+  if (sampleState == SAMPLE_MEASURING && ina219.readingReady()) {
+    finishSample(previousMillis);
+    sampleState = SAMPLE_IDLE;
+  }
 
-      } 
-      else if () { 
-        
+  // Switch the relays whose turn it is
+  if (relays.update(millis())) {
+    applyRelays();
+  }
 
-      }
-    }
+  // Sleep until the next interrupt (at most a millisecond, the timer interrupts wake us up)
+  if (LOW_POWER) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
   }
 }
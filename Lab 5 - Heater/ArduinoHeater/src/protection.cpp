@@ -0,0 +1,233 @@
+// Heater protection, see protection.h
+
+#include <Arduino.h>
+#include <avr/wdt.h>
+#include "protection.h"
+#include "alarm.h"
+
+// The heater pins, grouped by port: one write per port switches all of its heaters off
+static const uint8_t MAX_PORTS = 4;
+static volatile uint8_t *heaterPorts[MAX_PORTS];
+static uint8_t heaterMasks[MAX_PORTS];
+static uint8_t heaterPortCount = 0;
+static uint8_t stallLimitMs = 100;
+
+static volatile TripCause tripCause = TRIP_NONE;
+static volatile bool reportPending = false;
+static volatile float reportValue = 0;
+static volatile uint32_t reportLatency = 0;
+static volatile uint32_t reportDetected = 0;  // micros() when the fault was seen
+static volatile unsigned long reportMillis = 0;
+
+static volatile uint8_t msSinceKick = 0;      // counted by the Timer2 interrupt
+static volatile uint8_t maxLate = 0;          // Timer2 counts (4 us) the interrupt started late
+static volatile uint8_t maxStall = 0;         // longest msSinceKick
+static bool started = false;
+static volatile uint32_t lastKickMicros = 0;
+
+// Kept through the reset the watchdog does (the .noinit section isn't cleared at startup),
+// so the trip can still be reported afterwards. marker and check tell it from power-on garbage.
+struct WatchdogRecord {
+  uint16_t marker;
+  uint16_t check;
+  uint32_t stalledUs;
+  uint32_t latencyUs;
+};
+static WatchdogRecord watchdogRecord __attribute__((section(".noinit")));
+const uint16_t WATCHDOG_MARKER = 0xD06F;
+
+// Only ever clears the heater bits, with direct port writes so it is quick from an interrupt
+static inline void forceOff() {
+  for (uint8_t i = 0; i < heaterPortCount; i++) {
+    *heaterPorts[i] &= (uint8_t)~heaterMasks[i];
+  }
+}
+
+void protectionPins(const uint8_t *heaterPins, uint8_t count) {
+  uint8_t sreg = SREG;
+  cli();
+  heaterPortCount = 0;
+  for (uint8_t p = 0; p < count; p++) {
+    volatile uint8_t *port = portOutputRegister(digitalPinToPort(heaterPins[p]));
+    uint8_t i = 0;
+    while (i < heaterPortCount && heaterPorts[i] != port) i++;
+    if (i == heaterPortCount) {
+      if (i == MAX_PORTS) continue;  // the Uno only has three ports
+      heaterPorts[i] = port;
+      heaterMasks[i] = 0;
+      heaterPortCount++;
+    }
+    heaterMasks[i] |= digitalPinToBitMask(heaterPins[p]);
+  }
+  if (tripCause != TRIP_NONE) {
+    forceOff();
+  }
+  SREG = sreg;
+}
+
+void protectionBegin(const uint8_t *heaterPins, uint8_t count, uint8_t stallLimit) {
+  stallLimitMs = stallLimit > 0 ? stallLimit : 1;
+  protectionPins(heaterPins, count);
+
+  // A trip the watchdog recorded just before it reset the board
+  if (watchdogRecord.marker == WATCHDOG_MARKER && watchdogRecord.check == (uint16_t)~WATCHDOG_MARKER) {
+    tripCause = TRIP_WATCHDOG;
+    reportValue = watchdogRecord.stalledUs / 1000.0;
+    reportLatency = watchdogRecord.latencyUs;
+    reportDetected = micros();  // the alarm's latency counts from the restart
+    reportMillis = millis();
+    reportPending = true;
+  }
+  watchdogRecord.marker = 0;
+
+  cli();
+  // Timer2 in CTC mode: 16 MHz / 64 / 250 = 1 kHz
+  TCCR2A = _BV(WGM21);
+  TCCR2B = _BV(CS22);
+  OCR2A = 249;
+  TCNT2 = 0;
+  TIMSK2 = _BV(OCIE2A);
+
+  // Watchdog: interrupt after 0.25 s, reset after another 0.25 s
+  MCUSR = 0;
+  wdt_reset();
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = _BV(WDIE) | _BV(WDE) | _BV(WDP2);
+  lastKickMicros = micros();
+  msSinceKick = 0;
+  started = true;
+  sei();
+}
+
+void protectionKick() {
+  if (!started) {
+    return;  // setting WDIE now would start the watchdog in interrupt mode
+  }
+  wdt_reset();
+  WDTCSR |= _BV(WDIE);  // the watchdog interrupt disarms itself when it fires, arm it again
+  uint8_t sreg = SREG;
+  cli();
+  lastKickMicros = micros();
+  msSinceKick = 0;
+  watchdogRecord.marker = 0;  // no reset came, the trip is reported by protectionReport()
+  SREG = sreg;
+}
+
+void protectionTrip(TripCause cause, float value, uint32_t detected) {
+  uint8_t sreg = SREG;
+  cli();
+  forceOff();
+  uint32_t latency = micros() - detected;
+  if (tripCause == TRIP_NONE) {
+    tripCause = cause;
+    reportValue = value;
+    reportLatency = latency;
+    reportDetected = detected;
+    reportMillis = millis();
+    reportPending = true;
+  }
+  SREG = sreg;
+}
+
+bool protectionTripped() { return tripCause != TRIP_NONE; }
+
+TripCause protectionCause() { return tripCause; }
+
+const char *tripName(TripCause cause) {
+  switch (cause) {
+    case TRIP_TEMPERATURE: return "temperature";
+    case TRIP_CURRENT: return "current";
+    case TRIP_STALL: return "stall";
+    case TRIP_WATCHDOG: return "watchdog";
+    default: return "none";
+  }
+}
+
+void protectionReset() {
+  uint8_t sreg = SREG;
+  cli();
+  tripCause = TRIP_NONE;
+  reportPending = false;
+  SREG = sreg;
+}
+
+void protectionReport() {
+  if (!reportPending) {
+    return;
+  }
+  uint8_t sreg = SREG;
+  cli();
+  TripCause cause = tripCause;
+  float value = reportValue;
+  uint32_t latency = reportLatency;
+  uint32_t detected = reportDetected;
+  unsigned long time = reportMillis;
+  reportPending = false;
+  SREG = sreg;
+
+  sendAlarm(time, tripName(cause), "tripped", value, detected);
+  Serial.print("#TRIP,");
+  Serial.print(tripName(cause));
+  Serial.print(",");
+  Serial.print(value);
+  Serial.print(",");
+  Serial.println(latency);
+}
+
+uint16_t protectionMaxLatency(bool clear) {
+  uint8_t sreg = SREG;
+  cli();
+  uint8_t late = maxLate;
+  if (clear) {
+    maxLate = 0;
+  }
+  SREG = sreg;
+  return late * 4;
+}
+
+uint8_t protectionMaxStall(bool clear) {
+  uint8_t sreg = SREG;
+  cli();
+  uint8_t stall = maxStall;
+  if (clear) {
+    maxStall = 0;
+  }
+  SREG = sreg;
+  return stall;
+}
+
+// Every millisecond: keeps a tripped heater off, and trips if loop() has stopped running
+ISR(TIMER2_COMPA_vect) {
+  // The timer restarted from 0 at the compare match, so it says how late we are
+  uint8_t late = TCNT2;
+  if (late > maxLate) {
+    maxLate = late;
+  }
+  if (tripCause != TRIP_NONE) {
+    forceOff();
+    return;
+  }
+  if (msSinceKick < 255) {
+    msSinceKick++;
+  }
+  if (msSinceKick > maxStall) {
+    maxStall = msSinceKick;
+  }
+  if (msSinceKick >= stallLimitMs) {
+    protectionTrip(TRIP_STALL, msSinceKick, micros());
+  }
+}
+
+// Nothing ran for 0.25 s, not even the timer interrupt above
+ISR(WDT_vect) {
+  uint32_t now = micros();
+  forceOff();
+  uint32_t latency = micros() - now;
+  uint32_t stalled = now - lastKickMicros;
+  watchdogRecord.marker = WATCHDOG_MARKER;
+  watchdogRecord.check = (uint16_t)~WATCHDOG_MARKER;
+  watchdogRecord.stalledUs = stalled;
+  watchdogRecord.latencyUs = latency;
+  // If loop() gets going again before the reset, report it right away instead
+  protectionTrip(TRIP_WATCHDOG, stalled / 1000.0, now);
+}
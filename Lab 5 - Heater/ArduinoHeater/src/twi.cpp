@@ -0,0 +1,151 @@
+// Background I2C transfers, see twi.h
+
+#include <Arduino.h>
+#include "twi.h"
+
+static const uint8_t QUEUE_LENGTH = 8;  // Must be a power of two
+static TwiTransaction *volatile queue[QUEUE_LENGTH];
+static volatile uint8_t queueHead = 0;  // transfer in progress
+static volatile uint8_t queueTail = 0;  // next free slot
+static volatile bool busy = false;
+static volatile uint32_t startedAt = 0;  // micros() when the current transfer started
+
+static volatile uint8_t position = 0;    // byte of the current transfer
+static volatile bool reading = false;    // in the read part of the current transfer
+
+// TWCR values: keep the interface and its interrupt on, and clear TWINT to go on
+static const uint8_t TWCR_NEXT = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+
+// Starts the transfer at the head of the queue, if there is one (interrupts are off)
+static void startNext() {
+  if (queueHead == queueTail) {
+    busy = false;
+    return;
+  }
+  busy = true;
+  position = 0;
+  reading = queue[queueHead]->writeLength == 0;
+  startedAt = micros();
+  // Right after another transfer without a stop in between, this is a repeated start
+  TWCR = TWCR_NEXT | _BV(TWSTA);
+}
+
+// Ends the current transfer and goes on with the next one (interrupts are off)
+static void finish(TwiStatus status) {
+  TwiTransaction *t = queue[queueHead];
+  queueHead = (queueHead + 1) & (QUEUE_LENGTH - 1);
+  t->status = status;
+  if (t->done) {
+    t->done(*t);
+  }
+  if (status == TWI_OK && queueHead != queueTail) {
+    startNext();
+    return;
+  }
+  // Stop condition. It takes a few microseconds, the next start has to wait for it.
+  TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+  for (uint8_t wait = 0; (TWCR & _BV(TWSTO)) && wait < 200; wait++) {
+    delayMicroseconds(1);
+  }
+  startNext();
+}
+
+void twiBegin(uint32_t frequency) {
+  uint8_t sreg = SREG;
+  cli();
+  // The Uno's SDA and SCL pins (A4, A5) with the internal pull-ups, add 4.7k for 400 kHz
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+  TWSR = 0;  // prescaler 1
+  TWBR = (uint8_t)((F_CPU / frequency - 16) / 2);
+  TWCR = _BV(TWEN) | _BV(TWIE);
+  queueHead = queueTail = 0;
+  busy = false;
+  SREG = sreg;
+}
+
+bool twiSubmit(TwiTransaction &transaction) {
+  uint8_t sreg = SREG;
+  cli();
+  uint8_t next = (queueTail + 1) & (QUEUE_LENGTH - 1);
+  if (transaction.status == TWI_QUEUED || next == queueHead) {
+    SREG = sreg;
+    return false;
+  }
+  transaction.status = TWI_QUEUED;
+  queue[queueTail] = &transaction;
+  queueTail = next;
+  if (!busy) {
+    startNext();
+  }
+  SREG = sreg;
+  return true;
+}
+
+void twiPoll() {
+  uint8_t sreg = SREG;
+  cli();
+  if (busy && micros() - startedAt > TWI_TIMEOUT_US) {
+    // Switch the interface off and on again, that lets go of the bus
+    TWCR = 0;
+    TWCR = _BV(TWEN) | _BV(TWIE);
+    TwiTransaction *t = queue[queueHead];
+    queueHead = (queueHead + 1) & (QUEUE_LENGTH - 1);
+    t->status = TWI_TIMEOUT;
+    if (t->done) {
+      t->done(*t);
+    }
+    startNext();
+  }
+  SREG = sreg;
+}
+
+ISR(TWI_vect) {
+  TwiTransaction *t = queue[queueHead];
+  switch (TWSR & 0xF8) {
+    case 0x08:  // start sent
+    case 0x10:  // repeated start sent
+      TWDR = (uint8_t)((t->address << 1) | (reading ? 1 : 0));
+      TWCR = TWCR_NEXT;
+      break;
+
+    case 0x18:  // address + write acknowledged
+    case 0x28:  // data byte acknowledged
+      if (position < t->writeLength) {
+        TWDR = t->writeData[position++];
+        TWCR = TWCR_NEXT;
+      } else if (t->readLength > 0) {
+        reading = true;
+        position = 0;
+        TWCR = TWCR_NEXT | _BV(TWSTA);
+      } else {
+        finish(TWI_OK);
+      }
+      break;
+
+    case 0x40:  // address + read acknowledged
+      // Acknowledge every byte but the last one
+      TWCR = t->readLength > 1 ? TWCR_NEXT | _BV(TWEA) : TWCR_NEXT;
+      break;
+
+    case 0x50:  // data byte received, acknowledged
+      t->readData[position++] = TWDR;
+      TWCR = position + 1 < t->readLength ? TWCR_NEXT | _BV(TWEA) : TWCR_NEXT;
+      break;
+
+    case 0x58:  // last data byte received
+      t->readData[position++] = TWDR;
+      finish(TWI_OK);
+      break;
+
+    case 0x20:  // address + write not acknowledged
+    case 0x30:  // data byte not acknowledged
+    case 0x48:  // address + read not acknowledged
+      finish(TWI_NACK);
+      break;
+
+    default:  // bus error (0x00), lost arbitration (0x38)
+      finish(TWI_ERROR);
+      break;
+  }
+}
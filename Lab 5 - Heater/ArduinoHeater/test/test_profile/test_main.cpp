@@ -0,0 +1,116 @@
+// Checks the ramp/soak profile runner in include/profile.h.
+// Run with: pio test -e native
+
+#include <unity.h>
+
+#include "profile.h"
+
+// millis() 5 s before it wraps around (unsigned long is wider on a computer, the wrap works
+// the same)
+const unsigned long BEFORE_WRAP = (unsigned long)-1 - 4999;
+
+static Profile profile;
+
+void setUp() {
+  // Up to 50 C at 60 C/min and hold 10 s, then down to 30 C at 120 C/min and hold 5 s
+  profile.count = 2;
+  profile.segments[0].target = 50;
+  profile.segments[0].rate = 60;
+  profile.segments[0].hold = 10;
+  profile.segments[1].target = 30;
+  profile.segments[1].rate = 120;
+  profile.segments[1].hold = 5;
+}
+
+void tearDown() {}
+
+// Runs the whole profile starting at start, the heater following the setpoint a little late
+static void runProfile(unsigned long start) {
+  ProfileRunner runner(1.0f);
+  runner.start(profile, start, 20);
+  TEST_ASSERT_TRUE(runner.changed());
+  TEST_ASSERT_EQUAL(PROFILE_RAMP, runner.phase());
+
+  runner.update(start + 10000, 25, true);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 30, runner.setpoint());
+  runner.update(start + 30000, 40, true);  // at the target, the heater isn't
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 50, runner.setpoint());
+  TEST_ASSERT_EQUAL(PROFILE_RAMP, runner.phase());
+  TEST_ASSERT_FALSE(runner.changed());
+
+  // The hold only starts once the temperature is within the band
+  runner.update(start + 40000, 49.5f, true);
+  TEST_ASSERT_EQUAL(PROFILE_SOAK, runner.phase());
+  TEST_ASSERT_TRUE(runner.changed());
+  runner.update(start + 49999, 50, true);
+  TEST_ASSERT_EQUAL(PROFILE_SOAK, runner.phase());
+  runner.update(start + 50000, 50, true);
+  TEST_ASSERT_EQUAL(PROFILE_RAMP, runner.phase());
+  TEST_ASSERT_EQUAL_UINT8(1, runner.segment());
+  TEST_ASSERT_TRUE(runner.changed());
+
+  // The next segment ramps from where the last one ended, downwards
+  runner.update(start + 55000, 48, true);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 40, runner.setpoint());
+  runner.update(start + 60000, 30.5f, true);
+  TEST_ASSERT_EQUAL(PROFILE_SOAK, runner.phase());
+  runner.update(start + 65000, 30, true);
+  TEST_ASSERT_EQUAL(PROFILE_DONE, runner.phase());
+  TEST_ASSERT_FALSE(runner.running());
+  TEST_ASSERT_TRUE(runner.active());
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 30, runner.setpoint());
+
+  runner.stop();
+  TEST_ASSERT_FALSE(runner.active());
+  TEST_ASSERT_EQUAL_STRING("stopped", runner.phaseName());
+}
+
+void test_profile_ramp_and_soak() {
+  runProfile(1000);
+}
+
+void test_profile_across_millis_wrap() {
+  runProfile(BEFORE_WRAP);
+}
+
+// Rate 0 jumps to the target, but the soak still waits for a valid reading in the band
+void test_profile_jump_and_band() {
+  profile.segments[0].rate = 0;
+  ProfileRunner runner(2.0f);
+  runner.start(profile, 0, 20);
+  runner.update(100, 47.9f, true);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 50, runner.setpoint());
+  TEST_ASSERT_EQUAL(PROFILE_RAMP, runner.phase());
+  runner.update(200, 50, false);  // a failed reading doesn't count
+  TEST_ASSERT_EQUAL(PROFILE_RAMP, runner.phase());
+  runner.update(300, 51.9f, true);
+  TEST_ASSERT_EQUAL(PROFILE_SOAK, runner.phase());
+}
+
+// A reading stamped just before the start doesn't move the setpoint backwards
+void test_profile_reading_before_start() {
+  ProfileRunner runner(1.0f);
+  runner.start(profile, 5000, 20);
+  runner.update(4900, 20, true);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 20, runner.setpoint());
+  TEST_ASSERT_EQUAL(PROFILE_RAMP, runner.phase());
+}
+
+void test_profile_empty() {
+  Profile empty;
+  empty.count = 0;
+  ProfileRunner runner(1.0f);
+  runner.start(empty, 0, 20);
+  TEST_ASSERT_EQUAL(PROFILE_DONE, runner.phase());
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 20, runner.setpoint());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_profile_ramp_and_soak);
+  RUN_TEST(test_profile_across_millis_wrap);
+  RUN_TEST(test_profile_jump_and_band);
+  RUN_TEST(test_profile_reading_before_start);
+  RUN_TEST(test_profile_empty);
+  return UNITY_END();
+}
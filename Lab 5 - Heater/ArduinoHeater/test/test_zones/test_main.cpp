@@ -0,0 +1,121 @@
+// Checks the relay scheduler of the multi-zone oven in include/zones.h.
+// Run with: pio test -e native
+
+#include <unity.h>
+
+#include "zones.h"
+
+// millis() 30 s before it wraps around (unsigned long is wider on a computer, the wrap works
+// the same)
+const unsigned long BEFORE_WRAP = (unsigned long)-1 - 29999;
+
+void setUp() {}
+
+void tearDown() {}
+
+// Relays come on one at a time, staggerMs apart, but go off at once
+void test_zones_stagger() {
+  RelayScheduler<3> relays(3, 1000, 60000);
+  for (uint8_t z = 0; z < 3; z++) relays.demand(z, true, 0);
+  TEST_ASSERT_TRUE(relays.update(0));
+  TEST_ASSERT_TRUE(relays.on(0));
+  TEST_ASSERT_EQUAL_UINT8(1, relays.onCount());
+  TEST_ASSERT_FALSE(relays.update(999));
+  TEST_ASSERT_TRUE(relays.update(1000));
+  TEST_ASSERT_TRUE(relays.on(1));
+  TEST_ASSERT_TRUE(relays.waiting(2));
+
+  relays.demand(0, false, 1500);
+  TEST_ASSERT_TRUE(relays.update(1500));
+  TEST_ASSERT_FALSE(relays.on(0));
+  TEST_ASSERT_FALSE(relays.on(2));  // still held back by the stagger
+  TEST_ASSERT_TRUE(relays.update(2000));
+  TEST_ASSERT_TRUE(relays.on(2));
+}
+
+// With the cap reached the others wait, and after rotateMs the zone on longest gives way to
+// the one that waited longest
+void test_zones_cap_and_rotate() {
+  RelayScheduler<3> relays(2, 0, 10000);
+  for (uint8_t z = 0; z < 3; z++) relays.demand(z, true, 0);
+  relays.update(0);
+  relays.update(1);
+  relays.update(2);
+  TEST_ASSERT_TRUE(relays.on(0));
+  TEST_ASSERT_TRUE(relays.on(1));
+  TEST_ASSERT_TRUE(relays.waiting(2));
+
+  TEST_ASSERT_FALSE(relays.update(9999));
+  TEST_ASSERT_TRUE(relays.update(10000));
+  TEST_ASSERT_FALSE(relays.on(0));
+  TEST_ASSERT_TRUE(relays.on(2));
+  TEST_ASSERT_TRUE(relays.update(10001));
+  TEST_ASSERT_TRUE(relays.on(0));
+  TEST_ASSERT_FALSE(relays.on(1));
+  TEST_ASSERT_EQUAL_UINT8(2, relays.onCount());
+}
+
+// Four zones that always want heat, two allowed on, across the millis() wrap: never more
+// than two on, never two switched on closer than the stagger, and every zone gets its turns
+static void runAll(unsigned long start) {
+  const uint16_t STAGGER = 500;
+  const uint32_t ROTATE = 5000;
+  RelayScheduler<4> relays(2, STAGGER, ROTATE);
+  for (uint8_t z = 0; z < 4; z++) relays.demand(z, true, start);
+
+  bool was[4] = {false, false, false, false};
+  uint32_t onTime[4] = {0, 0, 0, 0};
+  bool switchedOn = false;
+  unsigned long lastOn = 0;
+  for (unsigned long t = 0; t <= 60000; t += 10) {
+    unsigned long now = start + t;
+    relays.update(now);
+    TEST_ASSERT_TRUE(relays.onCount() <= 2);
+    for (uint8_t z = 0; z < 4; z++) {
+      if (relays.on(z) && !was[z]) {
+        TEST_ASSERT_TRUE(!switchedOn || now - lastOn >= STAGGER);
+        switchedOn = true;
+        lastOn = now;
+      }
+      was[z] = relays.on(z);
+      if (was[z]) onTime[z] += 10;
+    }
+  }
+  // Each zone gets about a quarter of the two relays' time
+  for (uint8_t z = 0; z < 4; z++) {
+    TEST_ASSERT_TRUE(onTime[z] > 25000);
+    TEST_ASSERT_TRUE(onTime[z] < 35000);
+  }
+}
+
+void test_zones_share() {
+  runAll(0);
+}
+
+void test_zones_across_millis_wrap() {
+  runAll(BEFORE_WRAP);
+}
+
+// A zone that stops wanting heat while it waits is dropped from the queue
+void test_zones_demand_withdrawn() {
+  RelayScheduler<2> relays(1, 0, 60000);
+  relays.demand(0, true, 0);
+  relays.demand(1, true, 0);
+  relays.update(0);
+  TEST_ASSERT_TRUE(relays.waiting(1));
+  relays.demand(1, false, 100);
+  TEST_ASSERT_FALSE(relays.waiting(1));
+  relays.demand(0, false, 200);
+  relays.update(200);
+  TEST_ASSERT_EQUAL_UINT8(0, relays.onCount());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_zones_stagger);
+  RUN_TEST(test_zones_cap_and_rotate);
+  RUN_TEST(test_zones_share);
+  RUN_TEST(test_zones_across_millis_wrap);
+  RUN_TEST(test_zones_demand_withdrawn);
+  return UNITY_END();
+}